@@ -0,0 +1,27 @@
+# Turns a SPIR-V binary into a header with a constexpr uint32_t array, run as a build step with:
+#   cmake -DSPIRV=<file.spv> -DHEADER=<file.spv.h> -DVAR_NAME=<name> -P embed_spirv.cmake
+
+file(READ ${SPIRV} SPIRV_HEX HEX)
+string(LENGTH "${SPIRV_HEX}" SPIRV_HEX_LENGTH)
+math(EXPR SPIRV_WORD_COUNT "${SPIRV_HEX_LENGTH} / 8")
+
+# SPIR-V words are little-endian, swap every group of 4 bytes into a uint32_t literal
+string(REGEX REPLACE "([0-9a-f][0-9a-f])([0-9a-f][0-9a-f])([0-9a-f][0-9a-f])([0-9a-f][0-9a-f])" "0x\\4\\3\\2\\1," SPIRV_WORDS "${SPIRV_HEX}")
+# Break the line every 8 words so the header stays readable, CMake regexes have no {n} repetition
+string(REPEAT "0x[0-9a-f]+," 8 SPIRV_LINE_REGEX)
+string(REGEX REPLACE "(${SPIRV_LINE_REGEX})" "\\1\n    " SPIRV_WORDS "${SPIRV_WORDS}")
+
+get_filename_component(SPIRV_NAME ${SPIRV} NAME)
+
+file(WRITE ${HEADER}
+"// Generated from ${SPIRV_NAME}, do not edit
+#pragma once
+
+#include <cstdint>
+
+namespace shaders {
+inline constexpr uint32_t ${VAR_NAME}[${SPIRV_WORD_COUNT}] = {
+    ${SPIRV_WORDS}
+};
+}
+")
\ No newline at end of file
@@ -0,0 +1,13 @@
+#version 450
+
+layout (location = 0) in vec2 inUV;
+
+layout (location = 0) out vec4 outFragColor;
+
+// Background rendered by the compute effects, possibly at a lower resolution
+layout(set = 0, binding = 0) uniform sampler2D backgroundTex;
+
+void main() 
+{
+	outFragColor = texture(backgroundTex, inUV);
+}
\ No newline at end of file
@@ -3,6 +3,12 @@
 #extension GL_GOOGLE_include_directive : require
 #include "input_structures.glsl"
 
+// Set per pipeline variant, see MaterialFeatureBits. Branches on these are removed when the pipeline is compiled
+layout (constant_id = 0) const bool TEXTURED = true;
+layout (constant_id = 1) const bool LIT = true;
+layout (constant_id = 2) const bool ALPHA_BLEND = false;
+layout (constant_id = 3) const bool DOUBLE_SIDED = false;
+
 layout (location = 0) in vec3 inNormal;
 layout (location = 1) in vec3 inColor;
 layout (location = 2) in vec2 inUV;
@@ -11,10 +17,18 @@ layout (location = 0) out vec4 outFragColor;
 
 void main() 
 {
-	float lightValue = max(dot(inNormal, sceneData.sunlightDirection.xyz), 0.1f);
+	vec4 color = vec4(inColor, materialData.colorFactors.w);
+	if (TEXTURED) {
+		color *= texture(colorTex, inUV);
+	}
+
+	if (LIT) {
+		vec3 normal = DOUBLE_SIDED && !gl_FrontFacing ? -inNormal : inNormal;
+		float lightValue = max(dot(normal, sceneData.sunlightDirection.xyz), 0.1f);
+		vec3 ambient = color.xyz *  sceneData.ambientColor.xyz;
 
-	vec3 color = inColor * texture(colorTex,inUV).xyz;
-	vec3 ambient = color *  sceneData.ambientColor.xyz;
+		color.xyz = color.xyz * lightValue *  sceneData.sunlightColor.w + ambient;
+	}
 
-	outFragColor = vec4(color * lightValue *  sceneData.sunlightColor.w + ambient ,1.0f);
+	outFragColor = vec4(color.xyz, ALPHA_BLEND ? color.w : 1.0f);
 }
\ No newline at end of file
@@ -0,0 +1,552 @@
+// Microbenchmarks for the CPU-side hot paths of the engine.
+// Runs without a window, results are written as JSON so they can be diffed between commits:
+//
+//     td_bench [--out td_bench.json] [--filter name] [--iterations N] [--gltf path]
+//
+// NOTE: The descriptor allocator benchmark needs a Vulkan device (a software one like lavapipe works),
+// it is reported as skipped when none is available.
+
+#include "../defs.h"
+#include "../map_editor/map.h"
+#include "../renderer/vk_renderable.h"
+#include "../renderer/vk_visibility_cache.h"
+#include "../renderer/vk_descriptors.h"
+#include "../renderer/vk_gltf_mesh.h"
+#include "../renderer/camera.h"
+
+#include <VkBootstrap.h>
+
+#include <fastgltf/core.hpp>
+
+#include <glm/gtx/transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <print>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct BenchResult {
+    std::string name;
+    uint32_t iterations = 0;
+    // Work items processed by one iteration (objects, nodes, vertices...), 0 when it does not apply
+    uint64_t items = 0;
+
+    double mean_ns = 0;
+    double median_ns = 0;
+    double min_ns = 0;
+    double max_ns = 0;
+
+    bool skipped = false;
+    std::string note;
+};
+
+struct BenchConfig {
+    std::filesystem::path out_path = "td_bench.json";
+    std::filesystem::path gltf_path = "../assets/basicmesh.glb";
+    std::string filter;
+    uint32_t iterations = 100;
+};
+
+// Keeps the compiler from throwing away results we never read
+volatile uint64_t sink = 0;
+
+void do_not_optimize(uint64_t value) {
+    sink = sink + value;
+}
+
+// Times `body` `iterations` times, `setup` runs before each iteration and is not timed
+BenchResult run_bench(const std::string& name, uint32_t iterations, uint64_t items,
+    const std::function<void()>& setup, const std::function<void()>& body)
+{
+    // Warm caches and allocators
+    for (uint32_t i = 0; i < std::max(1u, iterations / 10); i++) {
+        setup();
+        body();
+    }
+
+    std::vector<double> times;
+    times.reserve(iterations);
+
+    for (uint32_t i = 0; i < iterations; i++) {
+        setup();
+
+        const auto start = std::chrono::steady_clock::now();
+        body();
+        const auto end = std::chrono::steady_clock::now();
+
+        times.push_back(std::chrono::duration<double, std::nano>(end - start).count());
+    }
+
+    std::sort(times.begin(), times.end());
+
+    BenchResult result;
+    result.name = name;
+    result.iterations = iterations;
+    result.items = items;
+    result.min_ns = times.front();
+    result.max_ns = times.back();
+    result.median_ns = times[times.size() / 2];
+
+    double total = 0;
+    for (double t : times) {
+        total += t;
+    }
+    result.mean_ns = total / times.size();
+
+    return result;
+}
+
+BenchResult skipped_bench(const std::string& name, const std::string& note) {
+    BenchResult result;
+    result.name = name;
+    result.skipped = true;
+    result.note = note;
+    return result;
+}
+
+//
+// MapLayout::from_path
+//
+
+// Writes a valid square map of `size` tiles: a core in the middle with two straight paths to the left and right edges
+std::filesystem::path write_map(uint32_t size) {
+    const std::filesystem::path path = std::filesystem::temp_directory_path() / std::format("td_bench_map_{}.tdm", size);
+
+    std::ofstream file(path, std::ios::out | std::ios::trunc);
+    const uint32_t mid = size / 2;
+    for (uint32_t r = 0; r < size; r++) {
+        std::string line(size, tile_type_to_char(TileType::Wall));
+        if (r == mid) {
+            std::fill(line.begin(), line.end(), tile_type_to_char(TileType::Path));
+            line[mid] = tile_type_to_char(TileType::Core);
+        }
+        file << line << "\n";
+    }
+
+    return path;
+}
+
+void bench_map_layout(const BenchConfig& config, std::vector<BenchResult>& results) {
+    for (uint32_t size : { 16u, 64u, 256u, 1024u }) {
+        const std::filesystem::path path = write_map(size);
+
+        results.push_back(run_bench(std::format("map_layout_from_path/{}", size), config.iterations, size * size,
+            [](){},
+            [&]() {
+                MapLayout layout = MapLayout::from_path(path);
+                do_not_optimize(layout.entry_points.size());
+            }));
+
+        std::filesystem::remove(path);
+    }
+}
+
+//
+// Culling and sorting, matching what `VkEngine::draw_geometry` does every frame
+//
+
+struct SceneFixture {
+    RenderWorld world;
+    std::vector<MaterialInstance> materials;
+    PerspectiveCamera camera;
+    glm::mat4 view_proj;
+};
+
+SceneFixture make_scene(uint32_t object_count) {
+    SceneFixture scene;
+    std::mt19937 rng(1337);
+    std::uniform_real_distribution<float> position(-200.f, 200.f);
+    std::uniform_real_distribution<float> extent(0.5f, 4.f);
+
+    // A handful of materials and meshes, like a real scene where many objects share them
+    scene.materials.resize(32);
+    std::uniform_int_distribution<uint32_t> material(0, scene.materials.size() - 1);
+    std::uniform_int_distribution<uint64_t> mesh(1, 64);
+
+    for (uint32_t i = 0; i < object_count; i++) {
+        RenderObject obj;
+        obj.index_count = 36;
+        obj.first_index = 0;
+        obj.index_buffer = (VkBuffer)(uintptr_t) mesh(rng);
+        obj.material = &scene.materials[material(rng)];
+        // NOTE: Placed through the bounds origin, the identity transforms keep the sort key cheap to reason about
+        obj.transform = glm::mat4 { 1.f };
+        obj.bounds.origin = glm::vec3 { position(rng), position(rng), position(rng) };
+        obj.bounds.extents = glm::vec3 { extent(rng), extent(rng), extent(rng) };
+        obj.bounds.sphere_radius = glm::length(obj.bounds.extents);
+        obj.vertex_buffer_address = 0;
+        scene.world.add(obj);
+    }
+    scene.world.update_bvh();
+
+    scene.camera.velocity = glm::vec3(0.f);
+    scene.camera.position = glm::vec3 { 0.f, 20.f, 150.f };
+    scene.view_proj = scene.camera.get_proj_matrix(16.f / 9.f) * scene.camera.get_view_matrix();
+
+    return scene;
+}
+
+void bench_culling_and_sorting(const BenchConfig& config, std::vector<BenchResult>& results) {
+    for (uint32_t count : { 1000u, 10000u, 100000u }) {
+        SceneFixture scene = make_scene(count);
+
+        std::vector<uint32_t> draws;
+        draws.reserve(count);
+
+        results.push_back(run_bench(std::format("is_visible/{}", count), config.iterations, count,
+            [&]() { draws.clear(); },
+            [&]() {
+                for (uint32_t i = 0; i < scene.world.size(); i++) {
+                    if (is_visible(scene.world.bounds[i], scene.world.transforms[i], scene.view_proj)) {
+                        draws.push_back(i);
+                    }
+                }
+                do_not_optimize(draws.size());
+            }));
+
+        results.push_back(run_bench(std::format("bvh_cull/{}", count), config.iterations, count,
+            [&]() { draws.clear(); },
+            [&]() {
+                scene.world.cull(scene.view_proj, draws);
+                do_not_optimize(draws.size());
+            }));
+
+        std::vector<uint32_t> handles(count);
+        for (uint32_t i = 0; i < count; i++) {
+            handles[i] = i;
+        }
+
+        // Every record moved, the worst case for the incremental refit
+        results.push_back(run_bench(std::format("bvh_refit/{}", count), config.iterations, count,
+            [](){},
+            [&]() {
+                for (uint32_t id : handles) {
+                    scene.world.set_transform(RenderHandle { id }, glm::mat4 { 1.f });
+                }
+                scene.world.update_bvh();
+                do_not_optimize(scene.world.bvh().node_count());
+            }));
+
+        // A still camera with a few movers, the common case in play
+        VisibilityCache cache;
+        cache.update(scene.world, scene.view_proj, scene.camera);
+        results.push_back(run_bench(std::format("visibility_cache_static/{}", count), config.iterations, count,
+            [&]() {
+                for (uint32_t id = 0; id < 16; id++) {
+                    scene.world.set_transform(RenderHandle { id * (count / 16) }, glm::mat4 { 1.f });
+                }
+            },
+            [&]() {
+                cache.update(scene.world, scene.view_proj, scene.camera);
+                do_not_optimize(cache.opaque.size());
+            }));
+
+        std::vector<uint32_t> unsorted(count);
+        for (uint32_t i = 0; i < count; i++) {
+            unsorted[i] = i;
+        }
+        std::shuffle(unsorted.begin(), unsorted.end(), std::mt19937(7));
+
+        results.push_back(run_bench(std::format("sort_opaque_draws/{}", count), config.iterations, count,
+            [&]() { draws = unsorted; },
+            [&]() {
+                sort_opaque_draws(draws, scene.world);
+                do_not_optimize(draws.front());
+            }));
+
+        results.push_back(run_bench(std::format("sort_transparent_draws/{}", count), config.iterations, count,
+            [&]() { draws = unsorted; },
+            [&]() {
+                sort_transparent_draws(draws, scene.world, scene.camera);
+                do_not_optimize(draws.front());
+            }));
+    }
+}
+
+//
+// TransformHierarchy::update
+//
+
+// Adds `depth` levels where every node has `fanout` children, returns the root
+TransformHandle build_hierarchy(TransformHierarchy& hierarchy, uint32_t depth, uint32_t fanout) {
+    const TransformHandle node = hierarchy.add(glm::translate(glm::vec3 { 0.1f, 0.f, 0.f }) * glm::rotate(0.01f, glm::vec3 { 0.f, 1.f, 0.f }));
+
+    if (depth > 1) {
+        for (uint32_t i = 0; i < fanout; i++) {
+            const TransformHandle child = build_hierarchy(hierarchy, depth - 1, fanout);
+            hierarchy.set_parent(child, node);
+        }
+    }
+
+    return node;
+}
+
+void bench_transform_update(const BenchConfig& config, std::vector<BenchResult>& results) {
+    struct Shape { const char* name; uint32_t depth; uint32_t fanout; };
+    const Shape shapes[] = {
+        { "chain", 64, 1 },
+        { "chain", 1024, 1 },
+        { "tree4", 6, 4 },
+        { "tree8", 5, 8 },
+    };
+
+    for (const Shape& shape : shapes) {
+        TransformHierarchy hierarchy;
+        const TransformHandle root = build_hierarchy(hierarchy, shape.depth, shape.fanout);
+        const glm::mat4 root_transform = hierarchy.local(root);
+
+        // Moving the root dirties every transform, the worst case
+        results.push_back(run_bench(std::format("transform_update/all_dirty/{}/{}", shape.name, shape.depth), config.iterations, hierarchy.size(),
+            [&]() { hierarchy.set_local(root, root_transform); },
+            [&]() {
+                hierarchy.update();
+                do_not_optimize((uint64_t) hierarchy.world(root)[3][0]);
+            }));
+
+        // Nothing moved, only the dirty checks
+        results.push_back(run_bench(std::format("transform_update/clean/{}/{}", shape.name, shape.depth), config.iterations, hierarchy.size(),
+            [](){},
+            [&]() {
+                hierarchy.update();
+                do_not_optimize((uint64_t) hierarchy.world(root)[3][0]);
+            }));
+    }
+}
+
+//
+// glTF vertex conversion
+//
+
+void bench_gltf_conversion(const BenchConfig& config, std::vector<BenchResult>& results) {
+    const std::string name = std::format("gltf_vertex_conversion/{}", config.gltf_path.filename().string());
+
+    fastgltf::Expected<fastgltf::GltfDataBuffer> data = fastgltf::GltfDataBuffer::FromPath(config.gltf_path);
+    if (data.error() != fastgltf::Error::None) {
+        results.push_back(skipped_bench(name, std::format("could not read {}", config.gltf_path.string())));
+        return;
+    }
+
+    constexpr auto gltf_options = fastgltf::Options::AllowDouble
+            | fastgltf::Options::LoadGLBBuffers
+            | fastgltf::Options::LoadExternalBuffers
+            | fastgltf::Options::GenerateMeshIndices;
+
+    fastgltf::Parser parser {};
+    auto load = fastgltf::determineGltfFileType(data.get()) == fastgltf::GltfType::GLB
+        ? parser.loadGltfBinary(data.get(), config.gltf_path.parent_path(), gltf_options)
+        : parser.loadGltf(data.get(), config.gltf_path.parent_path(), gltf_options);
+    if (!load) {
+        results.push_back(skipped_bench(name, std::string(fastgltf::getErrorName(load.error()))));
+        return;
+    }
+    fastgltf::Asset gltf = std::move(load.get());
+
+    std::vector<uint32_t> indices;
+    std::vector<Vertex> vertices;
+
+    // Count once up front so `items` is the number of vertices converted per iteration
+    for (const fastgltf::Mesh& mesh : gltf.meshes) {
+        for (const fastgltf::Primitive& p : mesh.primitives) {
+            gltf_mesh::append_primitive(gltf, p, indices, vertices);
+        }
+    }
+
+    results.push_back(run_bench(name, config.iterations, vertices.size(),
+        [&]() {
+            indices.clear();
+            vertices.clear();
+        },
+        [&]() {
+            for (const fastgltf::Mesh& mesh : gltf.meshes) {
+                for (const fastgltf::Primitive& p : mesh.primitives) {
+                    gltf_mesh::append_primitive(gltf, p, indices, vertices);
+                }
+            }
+            do_not_optimize(indices.size());
+        }));
+}
+
+//
+// DescriptorAllocator growth
+//
+
+void bench_descriptor_allocator(const BenchConfig& config, std::vector<BenchResult>& results) {
+    const std::string name = "descriptor_allocator_growth/10000";
+
+    vkb::InstanceBuilder instance_builder;
+    vkb::Result<vkb::Instance> instance_result = instance_builder.set_app_name(APP_NAME)
+        .set_headless(true)
+        .require_api_version(1, 3, 0)
+        .build();
+    if (!instance_result) {
+        results.push_back(skipped_bench(name, "no Vulkan instance"));
+        return;
+    }
+    vkb::Instance instance = instance_result.value();
+
+    vkb::PhysicalDeviceSelector selector{ instance };
+    vkb::Result<vkb::PhysicalDevice> physical_device_result = selector.set_minimum_version(1, 3).select();
+    if (!physical_device_result) {
+        vkb::destroy_instance(instance);
+        results.push_back(skipped_bench(name, "no Vulkan device"));
+        return;
+    }
+
+    vkb::DeviceBuilder device_builder{ physical_device_result.value() };
+    vkb::Result<vkb::Device> device_result = device_builder.build();
+    if (!device_result) {
+        vkb::destroy_instance(instance);
+        results.push_back(skipped_bench(name, "could not create Vulkan device"));
+        return;
+    }
+    vkb::Device device = device_result.value();
+
+    DescriptorLayoutBuilder layout_builder;
+    layout_builder.add_binding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+    layout_builder.add_binding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    VkDescriptorSetLayout layout = layout_builder.build(device.device, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
+
+    std::vector<DescriptorAllocator::PoolSizeRatio> sizes = {
+        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1 },
+        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1 },
+    };
+
+    // Starts small so that most of the time is spent growing, the same way the per-frame allocators do on load
+    constexpr uint32_t set_count = 10000;
+    DescriptorAllocator allocator;
+    bool initialized = false;
+
+    results.push_back(run_bench(name, config.iterations, set_count,
+        [&]() {
+            if (initialized) {
+                allocator.destroy_pools(device.device);
+            }
+            allocator.init(device.device, 16, sizes);
+            initialized = true;
+        },
+        [&]() {
+            for (uint32_t i = 0; i < set_count; i++) {
+                VkDescriptorSet set = allocator.allocate(device.device, layout);
+                do_not_optimize((uint64_t)(uintptr_t) set);
+            }
+        }));
+
+    allocator.destroy_pools(device.device);
+    vkDestroyDescriptorSetLayout(device.device, layout, nullptr);
+    vkb::destroy_device(device);
+    vkb::destroy_instance(instance);
+}
+
+//
+// Output
+//
+
+std::string json_escape(const std::string& s) {
+    std::string out;
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+        }
+        out += c;
+    }
+    return out;
+}
+
+bool write_json(const std::filesystem::path& path, const std::vector<BenchResult>& results) {
+    std::ofstream file(path, std::ios::out | std::ios::trunc);
+    if (!file) {
+        std::print("Could not open benchmark output at: {}\n", path.string());
+        return false;
+    }
+
+#ifdef NDEBUG
+    constexpr const char* build_type = "release";
+#else
+    constexpr const char* build_type = "debug";
+#endif
+
+    file << "{\n";
+    file << std::format("  \"build\": \"{}\",\n", build_type);
+    file << "  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        file << std::format("    {{\"name\": \"{}\", ", json_escape(r.name));
+        if (r.skipped) {
+            file << std::format("\"skipped\": true, \"note\": \"{}\"}}", json_escape(r.note));
+        } else {
+            file << std::format("\"iterations\": {}, \"items\": {}, \"mean_ns\": {:.1f}, \"median_ns\": {:.1f}, \"min_ns\": {:.1f}, \"max_ns\": {:.1f}}}",
+                r.iterations, r.items, r.mean_ns, r.median_ns, r.min_ns, r.max_ns);
+        }
+        file << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    file << "  ]\n";
+    file << "}\n";
+
+    return true;
+}
+
+}
+
+auto main(int argc, char** argv) -> int {
+    BenchConfig config;
+
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (arg == "--out" && has_value) {
+            config.out_path = argv[++i];
+        } else if (arg == "--filter" && has_value) {
+            config.filter = argv[++i];
+        } else if (arg == "--iterations" && has_value) {
+            config.iterations = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--gltf" && has_value) {
+            config.gltf_path = argv[++i];
+        } else {
+            std::print("Usage: td_bench [--out path] [--filter name] [--iterations N] [--gltf path]\n");
+            return -1;
+        }
+    }
+
+    struct Suite {
+        const char* name;
+        void (*run)(const BenchConfig&, std::vector<BenchResult>&);
+    };
+    const Suite suites[] = {
+        { "map_layout_from_path", bench_map_layout },
+        { "culling_and_sorting", bench_culling_and_sorting },
+        { "transform_update", bench_transform_update },
+        { "gltf_vertex_conversion", bench_gltf_conversion },
+        { "descriptor_allocator_growth", bench_descriptor_allocator },
+    };
+
+    std::vector<BenchResult> results;
+    for (const Suite& suite : suites) {
+        if (!config.filter.empty() && std::string(suite.name).find(config.filter) == std::string::npos) {
+            continue;
+        }
+        suite.run(config, results);
+    }
+
+    for (const BenchResult& r : results) {
+        if (r.skipped) {
+            std::print("{:<48} skipped ({})\n", r.name, r.note);
+        } else {
+            std::print("{:<48} median {:>12.1f} ns  min {:>12.1f} ns  max {:>12.1f} ns\n", r.name, r.median_ns, r.min_ns, r.max_ns);
+        }
+    }
+
+    if (!write_json(config.out_path, results)) {
+        return -1;
+    }
+    std::print("Wrote {} results to: {}\n", results.size(), config.out_path.string());
+
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+// Content hash for cache invalidation, not for hash tables or anything security related.
+// Mixes 8 bytes at a time, so hashing a whole asset file is far cheaper than parsing it.
+inline uint64_t hash_bytes(std::span<const uint8_t> bytes)
+{
+    constexpr uint64_t multiplier = 0x9E3779B97F4A7C15ull;
+
+    uint64_t hash = 0xCBF29CE484222325ull ^ (bytes.size() * multiplier);
+    size_t i = 0;
+    for (; i + 8 <= bytes.size(); i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes.data() + i, sizeof(word));
+        hash = (hash ^ word) * multiplier;
+        hash ^= hash >> 29;
+    }
+    for (; i < bytes.size(); i++) {
+        hash = (hash ^ bytes[i]) * multiplier;
+    }
+
+    return hash ^ (hash >> 32);
+}
+
+// Order dependent, for keying one cache on several files
+inline uint64_t hash_combine(uint64_t hash, uint64_t value)
+{
+    hash = (hash ^ value) * 0x9E3779B97F4A7C15ull;
+    return hash ^ (hash >> 29);
+}
\ No newline at end of file
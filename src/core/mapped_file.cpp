@@ -0,0 +1,112 @@
+#include "mapped_file.h"
+
+#include <utility>
+
+#ifdef _WIN32
+#   define WIN32_LEAN_AND_MEAN
+#   define NOMINMAX
+#   include <windows.h>
+#else
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
+std::optional<MappedFile> MappedFile::open(const std::filesystem::path& path)
+{
+    MappedFile mapped;
+
+#ifdef _WIN32
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return {};
+    }
+    mapped.file_handle = file;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        return {};
+    }
+    mapped.size = static_cast<size_t>(size.QuadPart);
+
+    mapped.mapping_handle = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapped.mapping_handle) {
+        return {};
+    }
+
+    mapped.data = static_cast<const uint8_t*>(MapViewOfFile(mapped.mapping_handle, FILE_MAP_READ, 0, 0, 0));
+    if (!mapped.data) {
+        return {};
+    }
+#else
+    const int file = ::open(path.c_str(), O_RDONLY);
+    if (file < 0) {
+        return {};
+    }
+
+    struct stat info;
+    if (fstat(file, &info) != 0 || info.st_size == 0) {
+        ::close(file);
+        return {};
+    }
+    mapped.size = static_cast<size_t>(info.st_size);
+
+    // NOTE: The mapping keeps its own reference to the file
+    void* data = mmap(nullptr, mapped.size, PROT_READ, MAP_PRIVATE, file, 0);
+    ::close(file);
+    if (data == MAP_FAILED) {
+        return {};
+    }
+    mapped.data = static_cast<const uint8_t*>(data);
+#endif
+
+    return mapped;
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+{
+    *this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+    if (this != &other) {
+        close();
+        data = std::exchange(other.data, nullptr);
+        size = std::exchange(other.size, 0);
+#ifdef _WIN32
+        file_handle = std::exchange(other.file_handle, nullptr);
+        mapping_handle = std::exchange(other.mapping_handle, nullptr);
+#endif
+    }
+    return *this;
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+void MappedFile::close()
+{
+#ifdef _WIN32
+    if (data) {
+        UnmapViewOfFile(data);
+    }
+    if (mapping_handle) {
+        CloseHandle(mapping_handle);
+    }
+    if (file_handle) {
+        CloseHandle(file_handle);
+    }
+    file_handle = nullptr;
+    mapping_handle = nullptr;
+#else
+    if (data) {
+        munmap(const_cast<uint8_t*>(data), size);
+    }
+#endif
+    data = nullptr;
+    size = 0;
+}
\ No newline at end of file
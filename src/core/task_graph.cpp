@@ -0,0 +1,110 @@
+#include "task_graph.h"
+#include "worker_pool.h"
+
+#include "../defs.h"
+#include "../profiler/profiler.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+TaskGraph::TaskId TaskGraph::add(const char* name, std::function<void()>&& task,
+    std::initializer_list<TaskId> dependencies, Affinity affinity)
+{
+    const TaskId id = static_cast<TaskId>(tasks.size());
+
+    Task new_task;
+    new_task.name = name;
+    new_task.function = std::move(task);
+    new_task.affinity = affinity;
+    new_task.dependency_count = static_cast<uint32_t>(dependencies.size());
+    tasks.push_back(std::move(new_task));
+
+    for (TaskId dependency : dependencies) {
+        M_Assert(dependency < id, "Task dependencies must be added before the tasks that depend on them");
+        tasks[dependency].dependents.push_back(id);
+    }
+
+    return id;
+}
+
+void TaskGraph::run(WorkerPool& pool) {
+    task_timings.assign(tasks.size(), Timing{});
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<TaskId> any_ready;
+    std::deque<TaskId> main_ready;
+    std::vector<uint32_t> remaining(tasks.size());
+    size_t finished = 0;
+    // Workers still inside the loop below, they reference this frame until they leave it
+    uint32_t active_workers = pool.worker_count();
+
+    for (TaskId id = 0; id < tasks.size(); id++) {
+        remaining[id] = tasks[id].dependency_count;
+        if (remaining[id] == 0) {
+            (tasks[id].affinity == Affinity::MainThread ? main_ready : any_ready).push_back(id);
+        }
+    }
+
+    // Runs a task outside the lock, then releases its dependents
+    const auto execute = [&](TaskId id, bool main_thread) {
+        Task& task = tasks[id];
+        const uint64_t start = profiler::now_ns();
+        {
+            PROFILE_SCOPE(task.name);
+            task.function();
+        }
+        task_timings[id] = Timing{ task.name, start, profiler::now_ns(), main_thread };
+
+        std::lock_guard<std::mutex> lock(mutex);
+        finished++;
+        for (TaskId dependent : task.dependents) {
+            if (--remaining[dependent] == 0) {
+                (tasks[dependent].affinity == Affinity::MainThread ? main_ready : any_ready).push_back(dependent);
+            }
+        }
+        cv.notify_all();
+    };
+
+    const uint32_t worker_count = pool.worker_count();
+    for (uint32_t i = 0; i < worker_count; i++) {
+        pool.submit([&]() {
+            while (true) {
+                TaskId id;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cv.wait(lock, [&]() { return !any_ready.empty() || finished == tasks.size(); });
+                    if (any_ready.empty()) {
+                        active_workers--;
+                        cv.notify_all();
+                        return;
+                    }
+                    id = any_ready.front();
+                    any_ready.pop_front();
+                }
+                execute(id, false);
+            }
+        });
+    }
+
+    while (true) {
+        TaskId id;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&]() { return !main_ready.empty() || !any_ready.empty() || finished == tasks.size(); });
+            if (finished == tasks.size()) {
+                break;
+            }
+
+            // Pinned tasks first, they are usually what everything else ends up waiting on
+            std::deque<TaskId>& queue = main_ready.empty() ? any_ready : main_ready;
+            id = queue.front();
+            queue.pop_front();
+        }
+        execute(id, true);
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [&]() { return active_workers == 0; });
+}
\ No newline at end of file
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <vector>
+
+struct WorkerPool;
+
+// Runs a one-shot set of tasks with dependencies on the threads of a `WorkerPool`.
+// Tasks that need the main thread (SDL, ImGui, the immediate submit command buffer) are pinned to
+// the thread calling `run`, which also picks up any other ready task while it has nothing pinned to do.
+struct TaskGraph {
+    using TaskId = uint32_t;
+
+    enum class Affinity {
+        Any,
+        MainThread,
+    };
+
+    struct Timing {
+        const char* name;
+        uint64_t start_ns;
+        uint64_t end_ns;
+        bool main_thread;
+    };
+
+    // NOTE: `name` must outlive the graph, string literals only. Dependencies must already be added
+    TaskId add(const char* name, std::function<void()>&& task,
+        std::initializer_list<TaskId> dependencies = {}, Affinity affinity = Affinity::Any);
+
+    // Blocks until every task has finished, `pool` lends its workers for the duration
+    void run(WorkerPool& pool);
+
+    // Filled by `run`, in task order, timestamps come from `profiler::now_ns`
+    const std::vector<Timing>& timings() const { return task_timings; }
+
+private:
+    struct Task {
+        const char* name;
+        std::function<void()> function;
+        Affinity affinity;
+        std::vector<TaskId> dependents;
+        uint32_t dependency_count = 0;
+    };
+
+    std::vector<Task> tasks;
+    std::vector<Timing> task_timings;
+};
\ No newline at end of file
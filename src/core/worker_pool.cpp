@@ -0,0 +1,52 @@
+#include "worker_pool.h"
+
+#include "../defs.h"
+
+WorkerPool::~WorkerPool() {
+    stop();
+}
+
+void WorkerPool::start(uint32_t worker_count) {
+    M_Assert(workers.empty(), "WorkerPool is already started");
+
+    stopping = false;
+    workers.reserve(worker_count);
+    for (uint32_t i = 0; i < worker_count; i++) {
+        workers.emplace_back([this]() {
+            while (true) {
+                std::function<void()> job;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cv.wait(lock, [this]() { return !jobs.empty() || stopping; });
+                    if (jobs.empty()) {
+                        return;
+                    }
+                    job = std::move(jobs.front());
+                    jobs.pop_front();
+                }
+                job();
+            }
+        });
+    }
+}
+
+void WorkerPool::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cv.notify_all();
+
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+}
+
+void WorkerPool::submit(std::function<void()>&& job) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(std::move(job));
+    }
+    cv.notify_one();
+}
\ No newline at end of file
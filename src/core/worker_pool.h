@@ -0,0 +1,34 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Long-lived worker threads that task graphs run on.
+// NOTE: Threads are kept for the whole run, each one that ever records a profiler zone holds a ring buffer
+// that is never freed, so spawning threads per job would grow memory with every load
+struct WorkerPool {
+    WorkerPool() = default;
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+    ~WorkerPool();
+
+    void start(uint32_t worker_count);
+    // Waits for queued jobs to finish, then joins the threads
+    void stop();
+
+    uint32_t worker_count() const { return static_cast<uint32_t>(workers.size()); }
+
+    void submit(std::function<void()>&& job);
+
+private:
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::function<void()>> jobs;
+    std::vector<std::thread> workers;
+    bool stopping = false;
+};
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include "cube.h"
 
+#include "optimize_mesh.h"
 #include "../renderer/vk_engine.h"
 
 #define GLM_ENABLE_EXPERIMENTAL
@@ -8,14 +9,21 @@
 Cube::Cube(VkEngine* engine, std::string name, 
     glm::vec3 translate, glm::quat rotation, glm::vec3 scale,
     glm::vec4 color) 
+    : MeshNode(engine->_transforms)
 {
     creator = engine;
 
     material_data_buffer = engine->create_buffer(
-        sizeof(FlatColorMaterial::MaterialConstants),
+        sizeof(GLTFMetallic_Roughness::MaterialConstants),
         VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU
     );
 
+    // The tile color lives in the vertices, the factors only need to leave it alone
+    GLTFMetallic_Roughness::MaterialConstants* constants =
+        (GLTFMetallic_Roughness::MaterialConstants*) material_data_buffer.allocation->GetMappedData();
+    constants->color_factors = glm::vec4{1.f};
+    constants->metal_rough_factors = glm::vec4{0.f};
+
     mesh = std::make_shared<MeshAsset>();
     mesh->name = std::move(name);
 
@@ -153,17 +161,26 @@ Cube::Cube(VkEngine* engine, std::string name,
         indices.insert(indices.end(), plane_indices.begin(), plane_indices.end());
     }
 
+    const IndexRange surface_range = { 0, static_cast<uint32_t>(indices.size()) };
+    optimize_mesh(indices, vertices, std::span(&surface_range, 1));
+
     // Create surface
     GeoSurface new_surface;
     new_surface.start_index = 0;
     new_surface.count = indices.size();
     new_surface.material = std::make_shared<GLTFMaterial>();
 
-    FlatColorMaterial::MaterialResources material_resources;
+    // NOTE: The textures are never sampled by the untextured variant, but the descriptors still have to be valid
+    GLTFMetallic_Roughness::MaterialResources material_resources;
+    material_resources.color_image = engine->_default_images._white_image;
+    material_resources.color_sampler = engine->_default_images._sampler_nearest;
+    material_resources.metal_rough_image = engine->_default_images._white_image;
+    material_resources.metal_rough_sampler = engine->_default_images._sampler_nearest;
     material_resources.data_buffer = material_data_buffer.buffer;
     material_resources.data_buffer_offset = 0;
 
-    new_surface.material->data = engine->flat_color_material.write_material(engine->vk_device(), material_resources, engine->_global_descriptor_allocator);
+    // Flat colored, unlit, drawn from both sides
+    new_surface.material->data = engine->metal_rough_material.write_material(engine->vk_device(), MATERIAL_FEATURE_DOUBLE_SIDED_BIT, material_resources, engine->_global_descriptor_allocator);
 
     // Calculate bounds
     // TODO: Duplicated code
@@ -188,9 +205,7 @@ Cube::Cube(VkEngine* engine, std::string name,
     glm::mat4 tm = glm::translate(glm::mat4(1.f), translate);
     glm::mat4 rm = glm::toMat4(rotation);
     glm::mat4 sm = glm::scale(glm::mat4(1.f), scale);
-    local_transform = tm * rm * sm;
-
-    refresh_transform(glm::mat4 { 1.f });
+    set_local_transform(tm * rm * sm);
 }
 
 Cube::~Cube() {
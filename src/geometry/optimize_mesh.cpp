@@ -0,0 +1,201 @@
+#include "optimize_mesh.h"
+
+#include <meshoptimizer.h>
+
+#include <print>
+
+namespace {
+    // Typical post-transform cache of desktop GPUs, only used for the report
+    constexpr uint32_t analyzed_cache_size = 16;
+    // Triangles may be reordered as long as overdraw optimization keeps the cache efficiency within 5%
+    constexpr float overdraw_threshold = 1.05f;
+
+    // Relative to the mesh extent, simplification stops at the triangle target or at this error
+    constexpr float max_lod_error = 0.05f;
+    // Coarser levels than this are not worth an extra range
+    constexpr size_t min_lod_indices = 3 * 32;
+    // A level has to drop at least this fraction of the previous level's triangles
+    constexpr float min_lod_reduction = 0.15f;
+
+    // 124 instead of 128 triangles keeps a meshlet's 8 bit triangle list within 372 bytes, as recommended for mesh shaders
+    constexpr size_t max_meshlet_vertices = 64;
+    constexpr size_t max_meshlet_triangles = 124;
+    // Trades some vertex reuse for tighter normal cones, so more meshlets can be backface culled
+    constexpr float meshlet_cone_weight = 0.25f;
+    // Surfaces with fewer triangles than a few meshlets are not split
+    constexpr size_t min_clustered_indices = 3 * 4 * max_meshlet_triangles;
+}
+
+void MeshStats::add(const MeshStats& other)
+{
+    triangles += other.triangles;
+    vertices += other.vertices;
+    vertices_transformed += other.vertices_transformed;
+    pixels_covered += other.pixels_covered;
+    pixels_shaded += other.pixels_shaded;
+    bytes_fetched += other.bytes_fetched;
+}
+
+MeshStats analyze_mesh(std::span<const uint32_t> indices, std::span<const Vertex> vertices)
+{
+    if (indices.empty() || vertices.empty()) {
+        return {};
+    }
+
+    const meshopt_VertexCacheStatistics cache = meshopt_analyzeVertexCache(
+        indices.data(), indices.size(), vertices.size(), analyzed_cache_size, 0, 0);
+    const meshopt_OverdrawStatistics overdraw = meshopt_analyzeOverdraw(
+        indices.data(), indices.size(), &vertices[0].position.x, vertices.size(), sizeof(Vertex));
+    const meshopt_VertexFetchStatistics fetch = meshopt_analyzeVertexFetch(
+        indices.data(), indices.size(), vertices.size(), sizeof(Vertex));
+
+    MeshStats stats;
+    stats.triangles = indices.size() / 3;
+    stats.vertices = vertices.size();
+    stats.vertices_transformed = cache.vertices_transformed;
+    stats.pixels_covered = overdraw.pixels_covered;
+    stats.pixels_shaded = overdraw.pixels_shaded;
+    stats.bytes_fetched = fetch.bytes_fetched;
+    return stats;
+}
+
+void optimize_mesh(std::vector<uint32_t>& indices, std::vector<Vertex>& vertices, std::span<const IndexRange> surfaces)
+{
+    if (indices.empty() || vertices.empty()) {
+        return;
+    }
+
+    // Deduplicate, also drops vertices no index refers to
+    std::vector<uint32_t> remap(vertices.size());
+    const size_t unique_count = meshopt_generateVertexRemap(
+        remap.data(), indices.data(), indices.size(), vertices.data(), vertices.size(), sizeof(Vertex));
+
+    std::vector<Vertex> unique_vertices(unique_count);
+    meshopt_remapIndexBuffer(indices.data(), indices.data(), indices.size(), remap.data());
+    meshopt_remapVertexBuffer(unique_vertices.data(), vertices.data(), vertices.size(), sizeof(Vertex), remap.data());
+
+    // Per surface, so every surface still draws a contiguous index range
+    for (const IndexRange& surface : surfaces) {
+        uint32_t* surface_indices = indices.data() + surface.start;
+        meshopt_optimizeVertexCache(surface_indices, surface_indices, surface.count, unique_count);
+        meshopt_optimizeOverdraw(surface_indices, surface_indices, surface.count,
+            &unique_vertices[0].position.x, unique_count, sizeof(Vertex), overdraw_threshold);
+    }
+
+    // NOTE: Rewrites the indices in place, after the triangle order is final
+    vertices.resize(unique_count);
+    const size_t fetched_count = meshopt_optimizeVertexFetch(
+        vertices.data(), indices.data(), indices.size(), unique_vertices.data(), unique_count, sizeof(Vertex));
+    vertices.resize(fetched_count);
+}
+
+void generate_lods(std::vector<uint32_t>& indices, std::span<const Vertex> vertices, IndexRange surface,
+    std::vector<SurfaceLod>& lods)
+{
+    if (vertices.empty() || surface.count < 2 * min_lod_indices) {
+        return;
+    }
+
+    const float* positions = &vertices[0].position.x;
+    // Errors of meshopt_simplify are relative to this
+    const float mesh_scale = meshopt_simplifyScale(positions, vertices.size(), sizeof(Vertex));
+
+    std::vector<SurfaceLod> levels = { { surface.start, surface.count, 0.f } };
+    std::vector<uint32_t> source(indices.begin() + surface.start, indices.begin() + surface.start + surface.count);
+    std::vector<uint32_t> simplified(source.size());
+    float error = 0.f;
+
+    while (levels.size() < max_lod_count) {
+        const size_t target = source.size() / 2 / 3 * 3;
+        if (target < min_lod_indices) {
+            break;
+        }
+
+        // NOTE: Borders are locked so neighbouring surfaces don't open up cracks between them
+        float level_error = 0.f;
+        const size_t count = meshopt_simplify(simplified.data(), source.data(), source.size(), positions,
+            vertices.size(), sizeof(Vertex), target, max_lod_error, meshopt_SimplifyLockBorder, &level_error);
+        if (count == 0 || float(count) > float(source.size()) * (1.f - min_lod_reduction)) {
+            break;
+        }
+
+        meshopt_optimizeVertexCache(simplified.data(), simplified.data(), count, vertices.size());
+
+        // Every level is simplified from the previous one, so the errors add up
+        error += level_error;
+        levels.push_back({ static_cast<uint32_t>(indices.size()), static_cast<uint32_t>(count), error * mesh_scale });
+        indices.insert(indices.end(), simplified.begin(), simplified.begin() + count);
+
+        source.assign(simplified.begin(), simplified.begin() + count);
+    }
+
+    if (levels.size() > 1) {
+        lods.insert(lods.end(), levels.begin(), levels.end());
+    }
+}
+
+void build_meshlets(std::vector<uint32_t>& indices, std::span<const Vertex> vertices, IndexRange surface,
+    bool double_sided, std::vector<Meshlet>& meshlets)
+{
+    if (vertices.empty() || surface.count < min_clustered_indices) {
+        return;
+    }
+
+    const float* positions = &vertices[0].position.x;
+    uint32_t* surface_indices = indices.data() + surface.start;
+
+    const size_t max_meshlets = meshopt_buildMeshletsBound(surface.count, max_meshlet_vertices, max_meshlet_triangles);
+    std::vector<meshopt_Meshlet> built(max_meshlets);
+    std::vector<uint32_t> meshlet_vertices(max_meshlets * max_meshlet_vertices);
+    std::vector<uint8_t> meshlet_triangles(max_meshlets * max_meshlet_triangles * 3);
+    built.resize(meshopt_buildMeshlets(built.data(), meshlet_vertices.data(), meshlet_triangles.data(),
+        surface_indices, surface.count, positions, vertices.size(), sizeof(Vertex),
+        max_meshlet_vertices, max_meshlet_triangles, meshlet_cone_weight));
+
+    size_t clustered_count = 0;
+    for (const meshopt_Meshlet& m : built) {
+        clustered_count += m.triangle_count * 3;
+    }
+    // NOTE: The meshlets have to cover the surface exactly, otherwise the range can't be rewritten in place
+    if (clustered_count != surface.count) {
+        return;
+    }
+
+    // The meshlet local triangle lists are expanded back into mesh vertex indices, so the regular
+    // vertex pipeline can draw a meshlet as an index range
+    uint32_t* out = surface_indices;
+    for (const meshopt_Meshlet& m : built) {
+        const uint32_t* local_vertices = &meshlet_vertices[m.vertex_offset];
+        const uint8_t* local_triangles = &meshlet_triangles[m.triangle_offset];
+
+        const meshopt_Bounds bounds = meshopt_computeMeshletBounds(local_vertices, local_triangles, m.triangle_count,
+            positions, vertices.size(), sizeof(Vertex));
+
+        Meshlet meshlet {};
+        meshlet.center = glm::vec3(bounds.center[0], bounds.center[1], bounds.center[2]);
+        meshlet.radius = bounds.radius;
+        meshlet.cone_apex = glm::vec3(bounds.cone_apex[0], bounds.cone_apex[1], bounds.cone_apex[2]);
+        meshlet.cone_axis = glm::vec3(bounds.cone_axis[0], bounds.cone_axis[1], bounds.cone_axis[2]);
+        meshlet.cone_cutoff = double_sided ? 1.f : bounds.cone_cutoff;
+        meshlet.first_index = static_cast<uint32_t>(out - indices.data());
+        meshlet.index_count = m.triangle_count * 3;
+        meshlets.push_back(meshlet);
+
+        for (uint32_t k = 0; k < m.triangle_count * 3; k++) {
+            *out++ = local_vertices[local_triangles[k]];
+        }
+    }
+}
+
+void print_mesh_stats(std::string_view name, const MeshStats& before, const MeshStats& after)
+{
+    const auto ratio = [](uint64_t a, uint64_t b) { return b > 0 ? double(a) / double(b) : 0.0; };
+
+    std::print("{}: {} triangles, {} -> {} vertices\n", name, after.triangles, before.vertices, after.vertices);
+    std::print("    ACMR {:.3f} -> {:.3f}, ATVR {:.3f} -> {:.3f}\n",
+        ratio(before.vertices_transformed, before.triangles), ratio(after.vertices_transformed, after.triangles),
+        ratio(before.vertices_transformed, before.vertices), ratio(after.vertices_transformed, after.vertices));
+    std::print("    overdraw {:.3f} -> {:.3f}, overfetch {:.3f} -> {:.3f}\n",
+        ratio(before.pixels_shaded, before.pixels_covered), ratio(after.pixels_shaded, after.pixels_covered),
+        ratio(before.bytes_fetched, before.vertices * sizeof(Vertex)), ratio(after.bytes_fetched, after.vertices * sizeof(Vertex)));
+}
\ No newline at end of file
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "../renderer/vk_types.h"
+#include "../renderer/vk_render_world.h"
+
+#include <span>
+#include <string_view>
+#include <vector>
+
+// A surface's part of a mesh index array
+struct IndexRange {
+    uint32_t start;
+    uint32_t count;
+};
+
+// Summed over meshes so a whole file can be reported at once, see `print_mesh_stats`
+struct MeshStats {
+    uint64_t triangles = 0;
+    uint64_t vertices = 0;
+    // Post-transform cache simulation, ACMR = transformed / triangles, ATVR = transformed / vertices
+    uint64_t vertices_transformed = 0;
+    // Software rasterized from a few directions, overdraw = shaded / covered
+    uint64_t pixels_covered = 0;
+    uint64_t pixels_shaded = 0;
+    // Vertex fetch simulation, overfetch = fetched / (vertices * sizeof(Vertex))
+    uint64_t bytes_fetched = 0;
+
+    void add(const MeshStats& other);
+};
+
+MeshStats analyze_mesh(std::span<const uint32_t> indices, std::span<const Vertex> vertices);
+
+// Runs a mesh through meshoptimizer:
+//  1. Merges bitwise identical vertices
+//  2. Reorders the triangles of every surface for the post-transform vertex cache, then for less overdraw
+//  3. Reorders the vertices in the order the indices first use them, for vertex fetch locality
+// Surfaces keep their index ranges, only the triangles inside a range move.
+void optimize_mesh(std::vector<uint32_t>& indices, std::vector<Vertex>& vertices, std::span<const IndexRange> surfaces);
+
+// Simplifies a surface of an optimized mesh into up to `max_lod_count - 1` coarser levels, each about half the
+// triangles of the previous one. Their indices are appended to `indices`, they share the mesh's vertices.
+// Appends every level to `lods` with the surface itself first, or nothing if it doesn't simplify
+void generate_lods(std::vector<uint32_t>& indices, std::span<const Vertex> vertices, IndexRange surface,
+    std::vector<SurfaceLod>& lods);
+
+// Splits a surface of an optimized mesh into meshlets of up to 64 vertices and 124 triangles, and reorders the
+// surface's triangles so every meshlet is a contiguous range of it. Appends them to `meshlets`, their index ranges
+// are into the mesh's indices. Meshlets of double sided surfaces are never backface culled.
+// Small surfaces are left alone, they are culled as a whole anyway
+void build_meshlets(std::vector<uint32_t>& indices, std::span<const Vertex> vertices, IndexRange surface,
+    bool double_sided, std::vector<Meshlet>& meshlets);
+
+void print_mesh_stats(std::string_view name, const MeshStats& before, const MeshStats& after);
\ No newline at end of file
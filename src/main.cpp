@@ -1,18 +1,38 @@
 #include <iostream>
 #include <print>
+#include <string_view>
 
 #include "renderer/vk_engine.h"
+#include "scenario/scenario.h"
 
 auto main(int argc, char** argv) -> int {
+    // `TD --scenario <path>` plays a scripted benchmark run instead of the interactive game
+    std::optional<Scenario> scenario;
+    if (argc == 3 && std::string_view(argv[1]) == "--scenario") {
+        scenario = Scenario::from_path(argv[2]);
+        if (!scenario.has_value()) {
+            return -1;
+        }
+    } else if (argc != 1) {
+        std::print("Usage: TD [--scenario <path>]\n");
+        return -1;
+    }
+
     VkEngine engine;
 
-    const std::optional<EngineInitError> init_result = engine.init();
+    const std::optional<EngineInitError> init_result = scenario.has_value()
+        ? engine.init(scenario->map_path)
+        : engine.init();
     if (init_result.has_value()) {
         std::print("Could not initialize VkEngine\n");
         return -1;
     }
 
-    engine.run();
+    if (scenario.has_value()) {
+        engine.run_scenario(*scenario);
+    } else {
+        engine.run();
+    }
 
     engine.cleanup();
     
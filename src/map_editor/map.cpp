@@ -1,7 +1,14 @@
 #include "map.h"
 
 #include "../renderer/vk_engine.h"
+#include "../profiler/profiler.h"
 
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <cmath>
 #include <fstream>
 #include <print>
 #include <unordered_map>
@@ -25,6 +32,8 @@ template<> struct std::hash<RowColPair> {
 };
 
 MapLayout MapLayout::from_path(const std::filesystem::path& path) {
+    PROFILE_SCOPE("MapLayout::from_path");
+
     std::fstream map_file;
 	map_file.open(path, std::ios::in);
 	if (!map_file) {
@@ -197,6 +206,8 @@ void MapLayout::print() const {
 
 
 Map::Map(VkEngine* engine, MapLayout& layout) {
+    PROFILE_SCOPE("Map::Map");
+
     // TODO: This whole function is a mess.
     // Pull out all the known variables to the top later, use them consistently.
     // Also separate into more clear steps.
@@ -213,6 +224,11 @@ Map::Map(VkEngine* engine, MapLayout& layout) {
     const float size_x = layout.tiles[0].size() * cube_scale;
     const float size_y = layout.tiles.size() * cube_scale;
 
+    // Floor tiles sit at 0, walls one tile up
+    tile_size = cube_scale;
+    tile_min_height = -cube_half_scale;
+    tile_max_height = cube_scale + cube_half_scale;
+
     for (int r = 0; r < layout.tiles.size(); ++r) {
         std::vector<std::unique_ptr<Cube>> cube_line;
         for (int c = 0; c < layout.tiles[0].size(); ++c) {
@@ -511,24 +527,87 @@ Map::Map(VkEngine* engine, MapLayout& layout) {
     ));
 }
 
-void Map::draw(const glm::mat4& top_matrix, DrawContext& ctx) const {
+void Map::register_renderables(RenderWorld& world, RenderWorld& tile_world) const {
+    PROFILE_SCOPE("Map::register_renderables");
+
     for (const auto& line : map_cubes) {
         for (const auto& cube : line) {
-            cube->draw(top_matrix, ctx);
+            cube->register_renderables(tile_world);
         }
     }
 
     for (const auto& cube : spawn_cubes) {
-        cube->draw(top_matrix, ctx);
+        cube->register_renderables(world);
     }
 
     for (const auto& cube : outer_cubes) {
-        cube->draw(top_matrix, ctx);
+        cube->register_renderables(world);
     }
 
     for (const auto& cube : margins) {
-        cube->draw(top_matrix, ctx);
+        cube->register_renderables(world);
+    }
+
+    core_model->register_renderables(world);
+}
+
+TileRange Map::visible_tiles(const glm::mat4& view_proj) const {
+    if (map_cubes.empty()) {
+        return TileRange{};
+    }
+
+    // The orthographic view volume is a box, bring its 8 corners back to world space
+    const glm::mat4 inv_view_proj = glm::inverse(view_proj);
+    std::array<glm::vec3, 8> corners;
+    for (int i = 0; i < 8; i++) {
+        const glm::vec4 ndc = glm::vec4(i & 1 ? 1.f : -1.f, i & 2 ? 1.f : -1.f, i & 4 ? 1.f : 0.f, 1.f);
+        const glm::vec4 world = inv_view_proj * ndc;
+        corners[i] = glm::vec3(world) / world.w;
     }
 
-    core_model->draw(top_matrix, ctx);
+    // Only the part of the box inside the slab of heights the tiles occupy matters. That part is convex, so its
+    // footprint is bounded by the box corners inside the slab and where the box edges cross the slab planes
+    constexpr std::array<std::pair<int, int>, 12> edges = {{
+        { 0, 1 }, { 2, 3 }, { 4, 5 }, { 6, 7 },
+        { 0, 2 }, { 1, 3 }, { 4, 6 }, { 5, 7 },
+        { 0, 4 }, { 1, 5 }, { 2, 6 }, { 3, 7 },
+    }};
+
+    glm::vec2 min = glm::vec2(FLT_MAX);
+    glm::vec2 max = glm::vec2(-FLT_MAX);
+    auto extend = [&](const glm::vec3& p) {
+        min = glm::min(min, glm::vec2(p.x, p.z));
+        max = glm::max(max, glm::vec2(p.x, p.z));
+    };
+
+    for (const glm::vec3& corner : corners) {
+        if (corner.y >= tile_min_height && corner.y <= tile_max_height) {
+            extend(corner);
+        }
+    }
+    for (const auto& [a, b] : edges) {
+        const glm::vec3 pa = corners[a];
+        const glm::vec3 pb = corners[b];
+        for (const float height : { tile_min_height, tile_max_height }) {
+            if ((pa.y - height) * (pb.y - height) < 0.f) {
+                extend(glm::mix(pa, pb, (height - pa.y) / (pb.y - pa.y)));
+            }
+        }
+    }
+
+    if (min.x > max.x) {
+        // The view volume misses the tile slab entirely
+        return TileRange{};
+    }
+
+    // Tile (r, c) spans [c - 0.5, c + 0.5] * tile_size, round outwards
+    const int rows = static_cast<int>(map_cubes.size());
+    const int cols = static_cast<int>(map_cubes[0].size());
+
+    TileRange range;
+    range.col_begin = std::clamp(static_cast<int>(std::floor(min.x / tile_size + 0.5f)), 0, cols);
+    range.col_end = std::clamp(static_cast<int>(std::floor(max.x / tile_size + 0.5f)) + 1, 0, cols);
+    range.row_begin = std::clamp(static_cast<int>(std::floor(min.y / tile_size + 0.5f)), 0, rows);
+    range.row_end = std::clamp(static_cast<int>(std::floor(max.y / tile_size + 0.5f)) + 1, 0, rows);
+    return range;
 }
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include "../geometry/cube.h"
 #include "tile_types.h"
 
+#include <algorithm>
 #include <filesystem>
 
 struct MapLayout {
@@ -15,6 +16,16 @@ struct MapLayout {
     std::vector<std::pair<int, int>> entry_points;
 };
 
+// Tiles [row_begin, row_end) x [col_begin, col_end), empty when either range is
+struct TileRange {
+    int row_begin = 0;
+    int row_end = 0;
+    int col_begin = 0;
+    int col_end = 0;
+
+    int count() const { return std::max(0, row_end - row_begin) * std::max(0, col_end - col_begin); }
+};
+
 struct Map {
     Map() {}
     Map(VkEngine* engine, MapLayout& layout);
@@ -28,11 +39,22 @@ struct Map {
         core_model.reset();
     }
     
-    void draw(const glm::mat4& top_matrix, DrawContext& ctx) const;
+    // The cubes stay registered until the map is cleared. Grid tiles go into `tile_world` so they can be
+    // culled by `visible_tiles` without ever visiting the ones off screen
+    void register_renderables(RenderWorld& world, RenderWorld& tile_world) const;
+
+    // Conservative range of grid tiles inside an orthographic `view_proj`, O(1) regardless of map size
+    TileRange visible_tiles(const glm::mat4& view_proj) const;
+    RenderHandle tile_handle(int row, int col) const { return map_cubes[row][col]->render_handles[0]; }
 
     std::vector<std::vector<std::unique_ptr<Cube>>> map_cubes;
     std::vector<std::unique_ptr<Cube>> spawn_cubes;
     std::vector<std::unique_ptr<Cube>> outer_cubes;
     std::vector<std::unique_ptr<Cube>> margins;
     std::unique_ptr<Cube> core_model;
+
+    // Grid placement, tile (r, c) is centered at (c * tile_size, _, r * tile_size)
+    float tile_size = 0.f;
+    float tile_min_height = 0.f;
+    float tile_max_height = 0.f;
 };
\ No newline at end of file
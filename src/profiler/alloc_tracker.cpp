@@ -0,0 +1,268 @@
+#include "alloc_tracker.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
+
+namespace {
+    constexpr uint32_t subsystem_count = static_cast<uint32_t>(alloc_tracker::Subsystem::Count);
+
+    struct AtomicCounters {
+        std::atomic<uint64_t> allocations = 0;
+        std::atomic<uint64_t> bytes = 0;
+        std::atomic<uint64_t> frees = 0;
+    };
+
+    // NOTE: Everything here is plain static storage, nothing in this file may allocate through operator new
+    std::array<AtomicCounters, subsystem_count> current;
+    std::array<alloc_tracker::Counters, subsystem_count> last;
+
+    std::atomic<alloc_tracker::FrameGuard> guard = alloc_tracker::FrameGuard::Off;
+
+    std::atomic<uint64_t> violations = 0;
+    std::atomic<uint32_t> first_violation_subsystem = 0;
+    std::atomic<uint64_t> first_violation_size = 0;
+
+    uint64_t last_violations = 0;
+    alloc_tracker::Subsystem last_first_violation_subsystem = alloc_tracker::Subsystem::Other;
+    uint64_t last_first_violation_size = 0;
+
+    thread_local alloc_tracker::Subsystem current_subsystem = alloc_tracker::Subsystem::Other;
+    // Only the thread running the frame loop is checked by the guard
+    thread_local bool in_frame = false;
+
+#ifndef TD_ALLOC_TRACKER_DISABLED
+    // Stored right in front of every pointer we hand out, so a free is charged to the subsystem that allocated,
+    // not to whichever scope the thread freeing it happens to be in
+    struct alignas(__STDCPP_DEFAULT_NEW_ALIGNMENT__) AllocationHeader {
+        alloc_tracker::Subsystem subsystem;
+        // From the start of the underlying block to the pointer handed out
+        uint32_t offset;
+    };
+
+    AllocationHeader& header_of(void* ptr) {
+        return static_cast<AllocationHeader*>(ptr)[-1];
+    }
+
+    void* write_header(void* block, size_t offset) {
+        if (block == nullptr) {
+            return nullptr;
+        }
+
+        void* ptr = static_cast<uint8_t*>(block) + offset;
+        header_of(ptr) = AllocationHeader { current_subsystem, static_cast<uint32_t>(offset) };
+        return ptr;
+    }
+
+    void record_allocation(size_t size) {
+        const uint32_t s = static_cast<uint32_t>(current_subsystem);
+        current[s].allocations.fetch_add(1, std::memory_order_relaxed);
+        current[s].bytes.fetch_add(size, std::memory_order_relaxed);
+
+        if (!in_frame) {
+            return;
+        }
+
+        const alloc_tracker::FrameGuard g = guard.load(std::memory_order_relaxed);
+        if (g == alloc_tracker::FrameGuard::Off) {
+            return;
+        }
+
+        if (violations.fetch_add(1, std::memory_order_relaxed) == 0) {
+            first_violation_subsystem.store(s, std::memory_order_relaxed);
+            first_violation_size.store(size, std::memory_order_relaxed);
+        }
+
+        if (g == alloc_tracker::FrameGuard::Assert) {
+            // No std::print here, it could allocate and recurse
+            std::fprintf(stderr, "Heap allocation of %zu bytes inside a frame, subsystem: %s\n",
+                size, alloc_tracker::subsystem_name(current_subsystem));
+            std::abort();
+        }
+    }
+
+    // Returns the start of the underlying block
+    void* record_free(void* ptr) {
+        const AllocationHeader& header = header_of(ptr);
+        current[static_cast<uint32_t>(header.subsystem)].frees.fetch_add(1, std::memory_order_relaxed);
+        return static_cast<uint8_t*>(ptr) - header.offset;
+    }
+
+    void* allocate(size_t size) {
+        record_allocation(size);
+        constexpr size_t offset = sizeof(AllocationHeader);
+        return write_header(std::malloc(offset + size), offset);
+    }
+
+    void* allocate_aligned(size_t size, std::align_val_t alignment) {
+        record_allocation(size);
+        // Both are powers of two, so the pointer after the header keeps the alignment
+        const size_t align = static_cast<size_t>(alignment);
+        const size_t offset = std::max(align, sizeof(AllocationHeader));
+#ifdef _MSC_VER
+        return write_header(_aligned_malloc(offset + size, align), offset);
+#else
+        // aligned_alloc wants the size to be a multiple of the alignment
+        const size_t rounded = (offset + size + align - 1) / align * align;
+        return write_header(std::aligned_alloc(align, rounded), offset);
+#endif
+    }
+
+    void deallocate(void* ptr) {
+        if (ptr == nullptr) {
+            return;
+        }
+        std::free(record_free(ptr));
+    }
+
+    void deallocate_aligned(void* ptr) {
+        if (ptr == nullptr) {
+            return;
+        }
+#ifdef _MSC_VER
+        _aligned_free(record_free(ptr));
+#else
+        std::free(record_free(ptr));
+#endif
+    }
+#endif
+};
+
+alloc_tracker::ScopedSubsystem::ScopedSubsystem(Subsystem subsystem)
+    : previous(current_subsystem)
+{
+    current_subsystem = subsystem;
+}
+
+alloc_tracker::ScopedSubsystem::~ScopedSubsystem() {
+    current_subsystem = previous;
+}
+
+void alloc_tracker::set_frame_guard(FrameGuard g) {
+    guard.store(g, std::memory_order_relaxed);
+}
+
+alloc_tracker::FrameGuard alloc_tracker::frame_guard() {
+    return guard.load(std::memory_order_relaxed);
+}
+
+void alloc_tracker::begin_frame() {
+    in_frame = true;
+}
+
+void alloc_tracker::end_frame() {
+    in_frame = false;
+
+    for (uint32_t s = 0; s < subsystem_count; s++) {
+        last[s].allocations = current[s].allocations.exchange(0, std::memory_order_relaxed);
+        last[s].bytes = current[s].bytes.exchange(0, std::memory_order_relaxed);
+        last[s].frees = current[s].frees.exchange(0, std::memory_order_relaxed);
+    }
+
+    last_violations = violations.exchange(0, std::memory_order_relaxed);
+    last_first_violation_subsystem = static_cast<Subsystem>(first_violation_subsystem.load(std::memory_order_relaxed));
+    last_first_violation_size = first_violation_size.load(std::memory_order_relaxed);
+}
+
+alloc_tracker::Counters alloc_tracker::last_frame(Subsystem subsystem) {
+    return last[static_cast<uint32_t>(subsystem)];
+}
+
+alloc_tracker::Counters alloc_tracker::last_frame_total() {
+    Counters total{};
+    for (const Counters& c : last) {
+        total.allocations += c.allocations;
+        total.bytes += c.bytes;
+        total.frees += c.frees;
+    }
+    return total;
+}
+
+uint64_t alloc_tracker::last_frame_violations() {
+    return last_violations;
+}
+
+alloc_tracker::Subsystem alloc_tracker::last_violation_subsystem() {
+    return last_first_violation_subsystem;
+}
+
+uint64_t alloc_tracker::last_violation_size() {
+    return last_first_violation_size;
+}
+
+#ifndef TD_ALLOC_TRACKER_DISABLED
+
+//
+// Global operator new/delete replacements
+//
+
+void* operator new(size_t size) {
+    void* ptr = allocate(size);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void* operator new[](size_t size) {
+    void* ptr = allocate(size);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return allocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return allocate(size);
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+    void* ptr = allocate_aligned(size, alignment);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+    void* ptr = allocate_aligned(size, alignment);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return allocate_aligned(size, alignment);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return allocate_aligned(size, alignment);
+}
+
+void operator delete(void* ptr) noexcept { deallocate(ptr); }
+void operator delete[](void* ptr) noexcept { deallocate(ptr); }
+void operator delete(void* ptr, size_t) noexcept { deallocate(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { deallocate(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { deallocate(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { deallocate(ptr); }
+
+void operator delete(void* ptr, std::align_val_t) noexcept { deallocate_aligned(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { deallocate_aligned(ptr); }
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept { deallocate_aligned(ptr); }
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept { deallocate_aligned(ptr); }
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { deallocate_aligned(ptr); }
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { deallocate_aligned(ptr); }
+
+#endif
\ No newline at end of file
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+
+// Counts heap allocations made through global operator new, per frame and per subsystem.
+// The frame guard flags any allocation made by the main loop thread while a frame is in flight,
+// which is how we keep the steady-state render loop allocation free.
+// Define TD_ALLOC_TRACKER_DISABLED to keep the default operator new and compile the scopes out.
+namespace alloc_tracker {
+
+enum class Subsystem : uint32_t {
+    Other,
+    SceneUpdate,
+    DrawGeometry,
+    DeletionQueue,
+    Descriptors,
+    Count
+};
+
+static const char* subsystem_name(Subsystem subsystem) {
+    switch (subsystem) {
+        case Subsystem::Other: { return "other"; }
+        case Subsystem::SceneUpdate: { return "scene_update"; }
+        case Subsystem::DrawGeometry: { return "draw_geometry"; }
+        case Subsystem::DeletionQueue: { return "deletion_queue"; }
+        case Subsystem::Descriptors: { return "descriptors"; }
+        default: { return "unknown"; }
+    }
+}
+
+enum class FrameGuard : uint32_t {
+    // Only count
+    Off,
+    // Count allocations inside the frame as violations, shown in the stats window
+    Report,
+    // Abort on the first allocation inside the frame, run under a debugger to get the callstack
+    Assert,
+};
+
+struct Counters {
+    uint64_t allocations;
+    uint64_t bytes;
+    // Charged to the subsystem that made the allocation, whichever scope frees it
+    uint64_t frees;
+};
+
+// Attributes allocations made by this thread to `subsystem` until it goes out of scope, the innermost scope wins
+struct ScopedSubsystem {
+    explicit ScopedSubsystem(Subsystem subsystem);
+    ~ScopedSubsystem();
+
+    ScopedSubsystem(const ScopedSubsystem&) = delete;
+    ScopedSubsystem& operator=(const ScopedSubsystem&) = delete;
+
+private:
+    Subsystem previous;
+};
+
+void set_frame_guard(FrameGuard guard);
+FrameGuard frame_guard();
+
+// Called by the main loop around the work of a frame, allocations in between are checked by the frame guard.
+// `end_frame` also publishes the counters of the frame that just finished
+void begin_frame();
+void end_frame();
+
+Counters last_frame(Subsystem subsystem);
+Counters last_frame_total();
+
+// Allocations the frame guard flagged in the last frame, and where the first one came from
+uint64_t last_frame_violations();
+Subsystem last_violation_subsystem();
+uint64_t last_violation_size();
+
+};
+
+#ifndef TD_ALLOC_TRACKER_DISABLED
+#   define ALLOC_CONCAT_INNER(a, b) a##b
+#   define ALLOC_CONCAT(a, b) ALLOC_CONCAT_INNER(a, b)
+#   define ALLOC_SCOPE(subsystem) alloc_tracker::ScopedSubsystem ALLOC_CONCAT(alloc_scope_, __LINE__)(alloc_tracker::Subsystem::subsystem)
+#else
+#   define ALLOC_SCOPE(subsystem)
+#endif
\ No newline at end of file
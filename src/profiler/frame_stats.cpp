@@ -0,0 +1,78 @@
+#include "frame_stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <numeric>
+#include <print>
+
+namespace {
+    // Nearest-rank percentile, `values` gets partially reordered
+    float percentile(std::vector<float>& values, float p) {
+        // Smallest value with at least `p` of the samples at or below it
+        const double n = static_cast<double>(values.size());
+        const size_t rank = static_cast<size_t>(std::clamp(std::ceil(p * n) - 1.0, 0.0, n - 1.0));
+        std::nth_element(values.begin(), values.begin() + rank, values.end());
+        return values[rank];
+    }
+};
+
+void FrameStatsHistory::push(const Sample& sample) {
+    samples[count % capacity] = sample;
+    count++;
+}
+
+uint32_t FrameStatsHistory::size() const {
+    return static_cast<uint32_t>(std::min<uint64_t>(count, capacity));
+}
+
+void FrameStatsHistory::window_samples(FrameMetric metric, uint32_t window, std::vector<float>& out) const {
+    const uint32_t n = std::min(window, size());
+    const uint32_t m = static_cast<uint32_t>(metric);
+
+    out.clear();
+    out.reserve(n);
+    for (uint64_t i = count - n; i < count; i++) {
+        out.push_back(samples[i % capacity][m]);
+    }
+}
+
+FrameStatsHistory::Summary FrameStatsHistory::summarize(FrameMetric metric, uint32_t window) const {
+    window_samples(metric, window, scratch);
+    if (scratch.empty()) {
+        return Summary{};
+    }
+
+    Summary summary;
+    summary.mean = std::accumulate(scratch.begin(), scratch.end(), 0.f) / scratch.size();
+    summary.max = *std::max_element(scratch.begin(), scratch.end());
+    summary.p50 = percentile(scratch, 0.50f);
+    summary.p95 = percentile(scratch, 0.95f);
+    summary.p99 = percentile(scratch, 0.99f);
+    return summary;
+}
+
+bool FrameStatsHistory::dump_csv(const std::filesystem::path& path) const {
+    std::ofstream file(path, std::ios::out | std::ios::trunc);
+    if (!file) {
+        std::print("Could not open frame stats file at: {}\n", path.string());
+        return false;
+    }
+
+    std::print(file, "frame");
+    for (uint32_t m = 0; m < metric_count; m++) {
+        std::print(file, ",{}_ms", frame_metric_name(FrameMetric(m)));
+    }
+    std::print(file, "\n");
+
+    for (uint64_t i = count - size(); i < count; i++) {
+        std::print(file, "{}", i);
+        for (uint32_t m = 0; m < metric_count; m++) {
+            std::print(file, ",{:.4f}", samples[i % capacity][m]);
+        }
+        std::print(file, "\n");
+    }
+
+    std::print("Wrote {} frames of stats to: {}\n", size(), path.string());
+    return true;
+}
\ No newline at end of file
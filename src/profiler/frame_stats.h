@@ -0,0 +1,61 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+enum class FrameMetric : uint32_t {
+    FrameTime,
+    SceneUpdate,
+    DrawRecord,
+    FenceWait,
+    GpuTime,
+    Count
+};
+
+static const char* frame_metric_name(FrameMetric metric) {
+    switch (metric) {
+        case FrameMetric::FrameTime: { return "frametime"; }
+        case FrameMetric::SceneUpdate: { return "scene_update"; }
+        case FrameMetric::DrawRecord: { return "draw_record"; }
+        case FrameMetric::FenceWait: { return "fence_wait"; }
+        case FrameMetric::GpuTime: { return "gpu"; }
+        default: { return "unknown"; }
+    }
+}
+
+// Fixed-size ring of per-frame timings (in ms), so we can look at tail latency instead of a single last-frame value
+struct FrameStatsHistory {
+    static constexpr uint32_t metric_count = static_cast<uint32_t>(FrameMetric::Count);
+    static constexpr uint32_t capacity = 4096;
+
+    using Sample = std::array<float, metric_count>;
+
+    struct Summary {
+        float p50;
+        float p95;
+        float p99;
+        float max;
+        float mean;
+    };
+
+    void push(const Sample& sample);
+
+    // Number of samples available, at most `capacity`
+    uint32_t size() const;
+
+    // Copies the last `window` samples of a metric, oldest first
+    void window_samples(FrameMetric metric, uint32_t window, std::vector<float>& out) const;
+    Summary summarize(FrameMetric metric, uint32_t window) const;
+
+    bool dump_csv(const std::filesystem::path& path) const;
+
+private:
+    std::array<Sample, capacity> samples;
+    // Total number of samples ever pushed
+    uint64_t count = 0;
+
+    // Reused between calls to avoid allocating every frame
+    mutable std::vector<float> scratch;
+};
\ No newline at end of file
@@ -0,0 +1,152 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <print>
+#include <vector>
+
+namespace {
+    // 64k zones per thread, a few seconds worth of frames
+    constexpr uint64_t ring_capacity = 1 << 16;
+
+    struct ThreadBuffer {
+        uint32_t thread_id;
+        uint32_t depth = 0;
+        // Total number of zones ever written, the ring index is `head % ring_capacity`
+        std::atomic<uint64_t> head = 0;
+        std::array<profiler::Zone, ring_capacity> zones;
+    };
+
+    const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+    // NOTE: Buffers are never freed, so zones of threads that already exited can still be exported
+    std::mutex buffers_mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+
+    ThreadBuffer& thread_buffer() {
+        thread_local ThreadBuffer* buffer = []() {
+            std::lock_guard<std::mutex> lock(buffers_mutex);
+            buffers.push_back(std::make_unique<ThreadBuffer>());
+            buffers.back()->thread_id = static_cast<uint32_t>(buffers.size() - 1);
+            return buffers.back().get();
+        }();
+        return *buffer;
+    }
+
+    // Frame capture, only touched by the thread calling `end_frame`
+    std::vector<profiler::Zone> last_frame;
+    uint64_t current_frame_start = 0;
+    uint64_t last_frame_start = 0;
+    uint64_t last_frame_end = 0;
+};
+
+uint64_t profiler::now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+profiler::ScopedZone::ScopedZone(const char* name)
+    : name(name)
+{
+    ThreadBuffer& buffer = thread_buffer();
+    depth = buffer.depth++;
+    start_ns = now_ns();
+}
+
+profiler::ScopedZone::~ScopedZone() {
+    const uint64_t end_ns = now_ns();
+
+    ThreadBuffer& buffer = thread_buffer();
+    buffer.depth--;
+
+    const uint64_t head = buffer.head.load(std::memory_order_relaxed);
+    buffer.zones[head % ring_capacity] = Zone {
+        .name = name,
+        .start_ns = start_ns,
+        .end_ns = end_ns,
+        .depth = depth,
+        .thread_id = buffer.thread_id,
+    };
+    buffer.head.store(head + 1, std::memory_order_release);
+}
+
+void profiler::end_frame() {
+    const uint64_t now = now_ns();
+    ThreadBuffer& buffer = thread_buffer();
+
+    last_frame.clear();
+
+    // Zones are written when they end, so walking back from the newest one we can stop at the first zone
+    // that ended before the frame started
+    const uint64_t head = buffer.head.load(std::memory_order_acquire);
+    for (uint64_t i = head; i > 0 && head - i < ring_capacity; i--) {
+        const Zone& zone = buffer.zones[(i - 1) % ring_capacity];
+        if (zone.end_ns < current_frame_start) {
+            break;
+        }
+        if (zone.start_ns >= current_frame_start) {
+            last_frame.push_back(zone);
+        }
+    }
+
+    std::sort(last_frame.begin(), last_frame.end(), [](const Zone& a, const Zone& b) {
+        if (a.start_ns == b.start_ns) {
+            return a.depth < b.depth;
+        }
+        return a.start_ns < b.start_ns;
+    });
+
+    last_frame_start = current_frame_start;
+    last_frame_end = now;
+    current_frame_start = now;
+}
+
+std::span<const profiler::Zone> profiler::last_frame_zones() {
+    return last_frame;
+}
+
+uint64_t profiler::last_frame_start_ns() {
+    return last_frame_start;
+}
+
+uint64_t profiler::last_frame_end_ns() {
+    return last_frame_end;
+}
+
+bool profiler::export_chrome_trace(const std::filesystem::path& path) {
+    std::ofstream file(path, std::ios::out | std::ios::trunc);
+    if (!file) {
+        std::print("Could not open trace file at: {}\n", path.string());
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+
+    // NOTE: Other threads may keep recording while we export, the oldest zones of a busy thread could be
+    // overwritten mid-export. Good enough for a debugging tool.
+    std::print(file, "{{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    for (const std::unique_ptr<ThreadBuffer>& buffer : buffers) {
+        const uint64_t head = buffer->head.load(std::memory_order_acquire);
+        const uint64_t tail = head > ring_capacity ? head - ring_capacity : 0;
+
+        for (uint64_t i = tail; i < head; i++) {
+            const Zone& zone = buffer->zones[i % ring_capacity];
+            std::print(file, "{}{{\"name\":\"{}\",\"ph\":\"X\",\"ts\":{:.3f},\"dur\":{:.3f},\"pid\":0,\"tid\":{}}}",
+                first ? "" : ",\n",
+                zone.name,
+                zone.start_ns / 1000.0,
+                (zone.end_ns - zone.start_ns) / 1000.0,
+                zone.thread_id);
+            first = false;
+        }
+    }
+    std::print(file, "\n]}}\n");
+
+    std::print("Exported trace to: {}\n", path.string());
+    return true;
+}
\ No newline at end of file
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <span>
+
+// Low-overhead scoped CPU profiler.
+// Each thread records finished zones into its own ring buffer, so recording never takes a lock.
+// Define TD_PROFILER_DISABLED to compile all the zones out.
+namespace profiler {
+
+struct Zone {
+    const char* name;
+    uint64_t start_ns;
+    uint64_t end_ns;
+    uint32_t depth;
+    uint32_t thread_id;
+};
+
+struct ScopedZone {
+    // NOTE: `name` must outlive the profiler, string literals or `__func__` only
+    explicit ScopedZone(const char* name);
+    ~ScopedZone();
+
+    ScopedZone(const ScopedZone&) = delete;
+    ScopedZone& operator=(const ScopedZone&) = delete;
+
+private:
+    const char* name;
+    uint64_t start_ns;
+    uint32_t depth;
+};
+
+// Nanoseconds since the profiler was started, on a steady clock
+uint64_t now_ns();
+
+// Marks a frame boundary, capturing the zones recorded by the calling thread since the previous call
+void end_frame();
+
+// Zones of the last completed frame, sorted by start time
+std::span<const Zone> last_frame_zones();
+uint64_t last_frame_start_ns();
+uint64_t last_frame_end_ns();
+
+// Writes every zone still in the ring buffers as a Chrome/Perfetto trace (chrome://tracing, ui.perfetto.dev)
+bool export_chrome_trace(const std::filesystem::path& path);
+
+};
+
+#ifndef TD_PROFILER_DISABLED
+#   define PROFILE_CONCAT_INNER(a, b) a##b
+#   define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#   define PROFILE_SCOPE(name) profiler::ScopedZone PROFILE_CONCAT(profile_zone_, __LINE__)(name)
+#   define PROFILE_FUNCTION() PROFILE_SCOPE(__func__)
+#else
+#   define PROFILE_SCOPE(name)
+#   define PROFILE_FUNCTION()
+#endif
\ No newline at end of file
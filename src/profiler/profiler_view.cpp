@@ -0,0 +1,62 @@
+#include "profiler_view.h"
+#include "profiler.h"
+
+#include "imgui.h"
+
+#include <algorithm>
+#include <functional>
+
+namespace {
+    ImU32 zone_color(const char* name) {
+        // Stable color per zone name
+        const size_t hash = std::hash<const void*>{}(name);
+        const ImU8 r = 90 + (hash & 0x7F);
+        const ImU8 g = 90 + ((hash >> 8) & 0x7F);
+        const ImU8 b = 90 + ((hash >> 16) & 0x7F);
+        return IM_COL32(r, g, b, 255);
+    }
+};
+
+void profiler::draw_flame_graph() {
+    const std::span<const Zone> zones = last_frame_zones();
+    const uint64_t frame_start = last_frame_start_ns();
+    const uint64_t frame_end = last_frame_end_ns();
+    if (zones.empty() || frame_end <= frame_start) {
+        ImGui::Text("No zones recorded");
+        return;
+    }
+
+    const double frame_duration = static_cast<double>(frame_end - frame_start);
+    ImGui::Text("cpu frame %f ms, %i zones", frame_duration / 1000000.0, (int) zones.size());
+
+    uint32_t max_depth = 0;
+    for (const Zone& zone : zones) {
+        max_depth = std::max(max_depth, zone.depth);
+    }
+
+    const float width = ImGui::GetContentRegionAvail().x;
+    const float row_height = ImGui::GetTextLineHeightWithSpacing();
+    const ImVec2 origin = ImGui::GetCursorScreenPos();
+    ImDrawList* draw_list = ImGui::GetWindowDrawList();
+
+    for (const Zone& zone : zones) {
+        const float x0 = origin.x + static_cast<float>((zone.start_ns - frame_start) / frame_duration) * width;
+        const float x1 = origin.x + static_cast<float>((zone.end_ns - frame_start) / frame_duration) * width;
+        const float y0 = origin.y + zone.depth * row_height;
+        const float y1 = y0 + row_height - 1.f;
+
+        const ImVec2 min = ImVec2(x0, y0);
+        const ImVec2 max = ImVec2(std::max(x1, x0 + 1.f), y1);
+        draw_list->AddRectFilled(min, max, zone_color(zone.name));
+
+        if (ImGui::CalcTextSize(zone.name).x < max.x - min.x) {
+            draw_list->AddText(ImVec2(x0 + 2.f, y0), IM_COL32_BLACK, zone.name);
+        }
+
+        if (ImGui::IsMouseHoveringRect(min, max)) {
+            ImGui::SetTooltip("%s: %f ms", zone.name, (zone.end_ns - zone.start_ns) / 1000000.0);
+        }
+    }
+
+    ImGui::Dummy(ImVec2(width, (max_depth + 1) * row_height));
+}
\ No newline at end of file
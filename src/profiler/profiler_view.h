@@ -0,0 +1,8 @@
+#pragma once
+
+namespace profiler {
+
+// Draws the zones of the last frame as a flame graph inside the current ImGui window
+void draw_flame_graph();
+
+};
\ No newline at end of file
@@ -0,0 +1,201 @@
+#include "vk_cluster_cull.h"
+
+#include "vk_engine.h"
+#include "vk_descriptors.h"
+#include "vk_pipelines.h"
+#include "vk_image.h"
+
+#include "../profiler/profiler.h"
+
+#include <shaders/meshlet_cull.comp.spv.h>
+
+#include <algorithm>
+
+static_assert(sizeof(ClusterDraw) == 96, "ClusterDraw must match the std430 layout in meshlet_cull.comp");
+static_assert(sizeof(Meshlet) == 64, "Meshlet must match the std430 layout in meshlet_cull.comp");
+
+void ClusterCuller::init(VkEngine* engine, uint32_t frame_count) {
+    const VkDevice device = engine->_device;
+
+    frames.resize(frame_count);
+
+    {
+        DescriptorLayoutBuilder builder;
+        builder.add_binding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+        builder.add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+        builder.add_binding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+        builder.add_binding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+        builder.add_binding(4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+        set_layout = builder.build(device, VK_SHADER_STAGE_COMPUTE_BIT);
+    }
+
+    layout = vkutil::create_compute_layout(device, set_layout, sizeof(ClusterCullPushConstants));
+    pipeline = vkutil::create_compute_pipeline(device, engine->_pipeline_cache, layout, shaders::meshlet_cull_comp);
+
+    engine->_main_deletion_queue.push_function([=, this]() {
+        for (FrameResources& frame : frames) {
+            destroy_buffers(engine, frame);
+            engine->destroy_buffer(frame.stats);
+        }
+
+        vkDestroyPipeline(device, pipeline, nullptr);
+        vkDestroyPipelineLayout(device, layout, nullptr);
+        vkDestroyDescriptorSetLayout(device, set_layout, nullptr);
+    });
+
+    for (FrameResources& frame : frames) {
+        frame.stats = engine->create_buffer(3 * sizeof(uint32_t),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU);
+    }
+}
+
+void ClusterCuller::prepare(VkEngine* engine, uint32_t frame_index, const RenderWorld& world,
+    std::span<const uint32_t> opaque) {
+    PROFILE_SCOPE("ClusterCuller::prepare");
+
+    FrameResources& frame = frames[frame_index];
+
+    // Only full detail draws are split, the simplified levels have no meshlets
+    opaque_cluster_draws.assign(opaque.size(), no_cluster_draw);
+    draw_first_commands.clear();
+    draw_meshlet_counts.clear();
+
+    uint32_t command_count = 0;
+    for (uint32_t k = 0; k < opaque.size(); k++) {
+        const uint32_t i = opaque[k];
+        if (world.meshlet_counts[i] == 0 || world.lod_levels[i] != 0) {
+            continue;
+        }
+
+        opaque_cluster_draws[k] = static_cast<uint32_t>(draw_first_commands.size());
+        draw_first_commands.push_back(command_count);
+        draw_meshlet_counts.push_back(world.meshlet_counts[i]);
+        command_count += world.meshlet_counts[i];
+    }
+    frame.draw_count = static_cast<uint32_t>(draw_first_commands.size());
+
+    // The frame slot's fence was waited on, its old buffers are not in use anymore
+    if (frame.draw_count > frame.draw_capacity || command_count > frame.command_capacity) {
+        destroy_buffers(engine, frame);
+
+        frame.draw_capacity = std::max(frame.draw_count, frame.draw_capacity * 2);
+        frame.command_capacity = std::max(command_count, frame.command_capacity * 2);
+        frame.draws = engine->create_buffer(frame.draw_capacity * sizeof(ClusterDraw),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+        for (uint32_t phase = 0; phase < phase_count; phase++) {
+            frame.commands[phase] = engine->create_buffer(frame.command_capacity * sizeof(VkDrawIndexedIndirectCommand),
+                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+            frame.counts[phase] = engine->create_buffer(frame.draw_capacity * sizeof(uint32_t),
+                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                VMA_MEMORY_USAGE_GPU_ONLY);
+        }
+    }
+
+    ClusterDraw* draws = (ClusterDraw*)frame.draws.allocation->GetMappedData();
+    for (uint32_t k = 0; k < opaque.size(); k++) {
+        const uint32_t d = opaque_cluster_draws[k];
+        if (d == no_cluster_draw) {
+            continue;
+        }
+
+        const uint32_t i = opaque[k];
+        ClusterDraw& draw = draws[d];
+        draw.transform = world.transforms[i];
+        draw.meshlets = world.meshlet_addresses[i];
+        draw.meshlet_count = world.meshlet_counts[i];
+        draw.first_command = draw_first_commands[d];
+        draw.occlusion_command = k;
+    }
+}
+
+void ClusterCuller::record(VkEngine* engine, VkCommandBuffer cmd, uint32_t frame_index, uint32_t phase,
+    const glm::mat4& view, const glm::mat4& view_proj, VkBuffer gate) {
+    FrameResources& frame = frames[frame_index];
+
+    if (phase == 0) {
+        vkCmdFillBuffer(cmd, frame.stats.buffer, 0, VK_WHOLE_SIZE, 0);
+    }
+    if (frame.draw_count == 0) {
+        return;
+    }
+    vkCmdFillBuffer(cmd, frame.counts[phase].buffer, 0, frame.draw_count * sizeof(uint32_t), 0);
+
+    // Covers the resets and the occlusion pass, which wrote the gate commands
+    vkutil::memory_barrier(cmd,
+        VK_PIPELINE_STAGE_2_TRANSFER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+        VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+        VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT);
+
+    VkDescriptorSet set = engine->get_current_frame()._frame_descriptors.allocate(engine->_device, set_layout);
+    {
+        DescriptorWriter writer;
+        writer.write_buffer(0, frame.draws.buffer, frame.draw_count * sizeof(ClusterDraw), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+        writer.write_buffer(1, frame.commands[phase].buffer, frame.command_capacity * sizeof(VkDrawIndexedIndirectCommand), 0,
+            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+        writer.write_buffer(2, frame.counts[phase].buffer, frame.draw_count * sizeof(uint32_t), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+        // NOTE: Never read without a gate, the draws only keep the binding valid
+        writer.write_buffer(3, gate != VK_NULL_HANDLE ? gate : frame.draws.buffer, VK_WHOLE_SIZE, 0,
+            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+        writer.write_buffer(4, frame.stats.buffer, 3 * sizeof(uint32_t), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+        writer.update_set(engine->_device, set);
+    }
+
+    // Normalized so the shader can compare plane distances against the meshlet radii.
+    // NOTE: The zero far plane of an infinite projection is left as is, it rejects nothing
+    const Frustum frustum = Frustum::from_view_proj(view_proj);
+    ClusterCullPushConstants push_constants;
+    for (uint32_t p = 0; p < 6; p++) {
+        const float length = glm::length(glm::vec3(frustum.planes[p]));
+        push_constants.frustum[p] = length > 0.f ? frustum.planes[p] / length : frustum.planes[p];
+    }
+    push_constants.camera_position = glm::inverse(view)[3];
+    push_constants.draw_count = frame.draw_count;
+    push_constants.gated = gate != VK_NULL_HANDLE ? 1 : 0;
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, layout, 0, 1, &set, 0, nullptr);
+    vkCmdPushConstants(cmd, layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ClusterCullPushConstants), &push_constants);
+    vkCmdDispatch(cmd, frame.draw_count, 1, 1);
+
+    vkutil::memory_barrier(cmd, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_HOST_BIT,
+        VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_2_HOST_READ_BIT);
+
+    frame.pending = true;
+}
+
+void ClusterCuller::draw(VkCommandBuffer cmd, uint32_t frame_index, uint32_t phase, uint32_t cluster_draw) const {
+    const FrameResources& frame = frames[frame_index];
+    vkCmdDrawIndexedIndirectCount(cmd,
+        frame.commands[phase].buffer, draw_first_commands[cluster_draw] * sizeof(VkDrawIndexedIndirectCommand),
+        frame.counts[phase].buffer, cluster_draw * sizeof(uint32_t),
+        draw_meshlet_counts[cluster_draw], sizeof(VkDrawIndexedIndirectCommand));
+}
+
+void ClusterCuller::collect(VkEngine* engine, uint32_t frame_index) {
+    FrameResources& frame = frames[frame_index];
+    if (!frame.pending) {
+        return;
+    }
+
+    vmaInvalidateAllocation(engine->_allocator, frame.stats.allocation, 0, VK_WHOLE_SIZE);
+    const uint32_t* stats = (const uint32_t*)frame.stats.allocation->GetMappedData();
+    drawn_count = stats[0];
+    frustum_culled_count = stats[1];
+    backface_culled_count = stats[2];
+
+    frame.pending = false;
+}
+
+void ClusterCuller::destroy_buffers(VkEngine* engine, FrameResources& frame) {
+    if (frame.draw_capacity == 0) {
+        return;
+    }
+
+    engine->destroy_buffer(frame.draws);
+    for (uint32_t phase = 0; phase < phase_count; phase++) {
+        engine->destroy_buffer(frame.commands[phase]);
+        engine->destroy_buffer(frame.counts[phase]);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <span>
+#include <vector>
+
+#include "vk_types.h"
+#include "vk_render_world.h"
+
+struct VkEngine;
+
+// Per draw input of `meshlet_cull.comp`, matches `ClusterDraw` there (std430)
+struct ClusterDraw {
+    glm::mat4 transform;
+    VkDeviceAddress meshlets;
+    uint32_t meshlet_count;
+    uint32_t first_command;
+    // Command of the draw in the occlusion pass
+    uint32_t occlusion_command;
+    uint32_t padding[3];
+};
+
+struct ClusterCullPushConstants {
+    glm::vec4 frustum[6];
+    glm::vec4 camera_position;
+    uint32_t draw_count;
+    uint32_t gated;
+};
+
+// Per meshlet culling of the opaque draws whose surface was split into meshlets, while drawn at full detail.
+// A compute pass tests every meshlet's bounding sphere against the frustum and its normal cone against the camera,
+// and appends an index range command for each one that is left. The draw then only reads as many commands as were
+// written through vkCmdDrawIndexedIndirectCount, so a large mesh that is partly off screen or facing away only
+// rasterizes the rest of it.
+//
+// With occlusion culling the pass runs once per phase, and a draw only emits meshlets if the occlusion command of that
+// phase draws it. The phases write separate commands, the early ones are still read while the late pass runs.
+struct ClusterCuller {
+    static constexpr uint32_t no_cluster_draw = UINT32_MAX;
+    static constexpr uint32_t phase_count = 2;
+
+    void init(VkEngine* engine, uint32_t frame_count);
+
+    // `opaque` are dense indices into `world`, `opaque[k]` has the occlusion command k
+    void prepare(VkEngine* engine, uint32_t frame_index, const RenderWorld& world, std::span<const uint32_t> opaque);
+    // Outside of a render pass. `gate` is the occlusion pass' command buffer of this phase, or VK_NULL_HANDLE without one
+    void record(VkEngine* engine, VkCommandBuffer cmd, uint32_t frame_index, uint32_t phase, const glm::mat4& view,
+        const glm::mat4& view_proj, VkBuffer gate);
+
+    // Cluster draw of `opaque[k]`, or `no_cluster_draw` if it is drawn as a whole
+    uint32_t cluster_draw(uint32_t k) const { return opaque_cluster_draws[k]; }
+    // Inside the render pass, with the pipeline, index buffer and push constants of the draw bound
+    void draw(VkCommandBuffer cmd, uint32_t frame_index, uint32_t phase, uint32_t cluster_draw) const;
+
+    // Must be called after waiting on the frame's fence
+    void collect(VkEngine* engine, uint32_t frame_index);
+
+    // Of the last collected frame, meshlets of both phases
+    uint32_t drawn_count = 0;
+    uint32_t frustum_culled_count = 0;
+    uint32_t backface_culled_count = 0;
+
+private:
+    struct FrameResources {
+        AllocatedBuffer draws {};
+        AllocatedBuffer commands[phase_count] {};
+        // Per draw, how many of its commands were written
+        AllocatedBuffer counts[phase_count] {};
+        AllocatedBuffer stats {};
+        uint32_t draw_capacity = 0;
+        uint32_t command_capacity = 0;
+        uint32_t draw_count = 0;
+        bool pending = false;
+    };
+
+    void destroy_buffers(VkEngine* engine, FrameResources& frame);
+
+    std::vector<FrameResources> frames;
+
+    // Of the frame being recorded
+    std::vector<uint32_t> opaque_cluster_draws;
+    std::vector<uint32_t> draw_first_commands;
+    std::vector<uint32_t> draw_meshlet_counts;
+
+    VkDescriptorSetLayout set_layout = VK_NULL_HANDLE;
+    VkPipelineLayout layout = VK_NULL_HANDLE;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+};
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "vk_descriptors.h"
+#include "../profiler/alloc_tracker.h"
 
 #include <cassert>
 
@@ -81,6 +82,8 @@ void DescriptorAllocator::destroy_pools(VkDevice device)
 
 VkDescriptorSet DescriptorAllocator::allocate(VkDevice device, VkDescriptorSetLayout layout, void* p_next)
 {
+    ALLOC_SCOPE(Descriptors);
+
     VkDescriptorPool pool_to_use = get_pool(device);
 
 	VkDescriptorSetAllocateInfo alloc_info = {};
@@ -150,6 +153,8 @@ VkDescriptorPool DescriptorAllocator::create_pool(VkDevice device, uint32_t set_
 
 void DescriptorWriter::write_buffer(int binding, VkBuffer buffer, size_t size, size_t offset, VkDescriptorType type)
 {
+    ALLOC_SCOPE(Descriptors);
+
 	const VkDescriptorBufferInfo& info = buffer_infos.emplace_back(VkDescriptorBufferInfo{
 		.buffer = buffer,
 		.offset = offset,
@@ -170,6 +175,8 @@ void DescriptorWriter::write_buffer(int binding, VkBuffer buffer, size_t size, s
 
 void DescriptorWriter::write_image(int binding,VkImageView image, VkSampler sampler,  VkImageLayout layout, VkDescriptorType type)
 {
+    ALLOC_SCOPE(Descriptors);
+
     const VkDescriptorImageInfo& info = image_infos.emplace_back(VkDescriptorImageInfo{
 		.sampler = sampler,
 		.imageView = image,
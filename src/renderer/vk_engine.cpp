@@ -2,7 +2,17 @@
 #include "vk_engine.h"
 #include "vk_initializers.h"
 #include "vk_image.h"
+#include "vk_ktx2.h"
 #include "vk_pipelines.h"
+#include "../profiler/profiler.h"
+#include "../profiler/profiler_view.h"
+#include "../core/task_graph.h"
+#include "../profiler/alloc_tracker.h"
+
+#include "shaders/gradient.comp.spv.h"
+#include "shaders/sky.comp.spv.h"
+#include "shaders/fullscreen.vert.spv.h"
+#include "shaders/background_composite.frag.spv.h"
 
 #define VMA_IMPLEMENTATION
 #include "vk_mem_alloc.h"
@@ -21,8 +31,13 @@
 #include <thread>
 #include <chrono>
 #include <array>
+#include <algorithm>
+#include <cfloat>
+#include <format>
+#include <fstream>
 
 #define INIT_ERROR_STRING "Engine init failed with code: {}\n"
+#define PIPELINE_CACHE_PATH "pipeline_cache.bin"
 // TODO: Make a compiler flag
 #define USE_VALIDATION_LAYERS true
 
@@ -31,9 +46,22 @@ namespace {
         // TODO: platform-specfic code to get reasonable defaults.
         return {1700 , 900};
     }
+
+    // Grows each dimension that doesn't fit by 1.5x (same factor as the descriptor pools), so dragging the
+    // window edge only reallocates the render targets a handful of times.
+    VkExtent2D grow_extent(VkExtent2D current, VkExtent2D required) {
+        VkExtent2D grown = current;
+        if (required.width > current.width) {
+            grown.width = std::max(required.width, static_cast<uint32_t>(current.width * 1.5));
+        }
+        if (required.height > current.height) {
+            grown.height = std::max(required.height, static_cast<uint32_t>(current.height * 1.5));
+        }
+        return grown;
+    }
 };
 
-std::optional<EngineInitError> VkEngine::create_swapchain(uint32_t width, uint32_t height) {
+std::optional<EngineInitError> VkEngine::create_swapchain(uint32_t width, uint32_t height, VkSwapchainKHR old_swapchain) {
     vkb::SwapchainBuilder swapchain_builder{ _chosen_gpu, _device,_surface };
 
 	_swapchain_image_format = VK_FORMAT_B8G8R8A8_UNORM;
@@ -42,6 +70,7 @@ std::optional<EngineInitError> VkEngine::create_swapchain(uint32_t width, uint32
 		.set_desired_format(VkSurfaceFormatKHR{ .format = _swapchain_image_format, .colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR })
 		.set_desired_present_mode(VK_PRESENT_MODE_FIFO_KHR)
 		.set_desired_extent(width, height)
+		.set_old_swapchain(old_swapchain)
 		.add_image_usage_flags(VK_IMAGE_USAGE_TRANSFER_DST_BIT)
 		.build();
 
@@ -51,33 +80,76 @@ std::optional<EngineInitError> VkEngine::create_swapchain(uint32_t width, uint32
     }
     vkb::Swapchain vkb_swapchain = vkb_swapchain_result.value();
 
-	_swapchain_extent = vkb_swapchain.extent;
-	_swapchain = vkb_swapchain.swapchain;
-    if (!vkb_swapchain.get_images().has_value()) {
+	// NOTE: Nothing is stored until every step succeeded, so a failed resize leaves the current swapchain in place
+	vkb::Result<std::vector<VkImage>> images_result = vkb_swapchain.get_images();
+    if (!images_result.has_value()) {
         std::print(INIT_ERROR_STRING, "Could not get Swapchain Images with vk-bootstrap");
+        vkDestroySwapchainKHR(_device, vkb_swapchain.swapchain, nullptr);
         return EngineInitError::Vk_SwapchainImagesInitFailed;
     }
-	_swapchain_images = vkb_swapchain.get_images().value();
-    if (!vkb_swapchain.get_images().has_value()) {
+	vkb::Result<std::vector<VkImageView>> image_views_result = vkb_swapchain.get_image_views();
+    if (!image_views_result.has_value()) {
         std::print(INIT_ERROR_STRING, "Could not get Swapchain Images Views with vk-bootstrap");
+        vkDestroySwapchainKHR(_device, vkb_swapchain.swapchain, nullptr);
         return EngineInitError::Vk_SwapchainImageViewsInitFailed;
     }
-	_swapchain_image_views = vkb_swapchain.get_image_views().value();
+
+	_swapchain_extent = vkb_swapchain.extent;
+	_swapchain = vkb_swapchain.swapchain;
+	_swapchain_images = std::move(images_result.value());
+	_swapchain_image_views = std::move(image_views_result.value());
 
     return std::nullopt;
 }
 
 void VkEngine::resize_swapchain() {
-    vkDeviceWaitIdle(_device);
+	// The swapchain is sized in pixels, which differs from the window size on high density displays
+	int w, h;
+	if (!SDL_GetWindowSizeInPixels(_window, &w, &h)) {
+		std::print("Could not get the window size: {}\n", SDL_GetError());
+		return;
+	}
+	const VkExtent2D window_extent = { static_cast<uint32_t>(w), static_cast<uint32_t>(h) };
 
-	destroy_swapchain();
+	// NOTE: We hand the old swapchain to the new one so presentation can transition seamlessly, and retire it
+	// through the deletion queue of the last submitted frame instead of stalling the device with vkDeviceWaitIdle.
+	// On failure nothing changed and `_resize_requested` stays set, so the resize is retried next frame. The old
+	// swapchain is retired either way, presenting to it returns out of date until then.
+	const VkSwapchainKHR old_swapchain = _swapchain;
+	const std::vector<VkImageView> old_image_views = _swapchain_image_views;
 
-	int w, h;
-	SDL_GetWindowSize(_window, &w, &h);
-	_window_extent.width = w;
-	_window_extent.height = h;
+	if (create_swapchain(window_extent.width, window_extent.height, old_swapchain).has_value()) {
+		return;
+	}
+	_window_extent = window_extent;
+
+	get_last_frame()._deletion_queue.push_function([=, this]() {
+		for (VkImageView view : old_image_views) {
+			vkDestroyImageView(_device, view, nullptr);
+		}
+		vkDestroySwapchainKHR(_device, old_swapchain, nullptr);
+	});
+
+	// Render targets are only reallocated when the window outgrows them
+	const VkExtent2D required_extent = {
+		std::max(_window_extent.width, _swapchain_extent.width),
+		std::max(_window_extent.height, _swapchain_extent.height)
+	};
+	if (required_extent.width > _draw_image.image_extent.width || required_extent.height > _draw_image.image_extent.height) {
+		const AllocatedImage old_draw_image = _draw_image;
+		const AllocatedImage old_depth_image = _depth_image;
+
+		// The new swapchain is kept, it still fits into the old render targets when drawing is clamped to them
+		if (create_render_targets(grow_extent(
+			VkExtent2D{ _draw_image.image_extent.width, _draw_image.image_extent.height }, required_extent)).has_value()) {
+			return;
+		}
 
-	create_swapchain(_window_extent.width, _window_extent.height);
+		get_last_frame()._deletion_queue.push_function([=, this]() {
+			destroy_image(old_draw_image);
+			destroy_image(old_depth_image);
+		});
+	}
 
 	_resize_requested = false;
 }
@@ -141,7 +213,44 @@ std::optional<EngineInitError> VkEngine::init_vulkan() {
     }
     vkb::PhysicalDevice vkb_physical_device = vkb_physical_device_result.value();
 
+	// Optional: switching polygon mode at draw time, so wireframe does not need its own pipelines
+	VkPhysicalDeviceExtendedDynamicState3FeaturesEXT supported_eds3{ .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_3_FEATURES_EXT };
+	if (vkb_physical_device.enable_extension_if_present(VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME)) {
+		VkPhysicalDeviceFeatures2 supported_features{ .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+		supported_features.pNext = &supported_eds3;
+		vkGetPhysicalDeviceFeatures2(vkb_physical_device.physical_device, &supported_features);
+	}
+	_dynamic_polygon_mode = supported_eds3.extendedDynamicState3PolygonMode;
+
+	// Optional: block compressed textures baked by `td_texture_bake`
+	VkPhysicalDeviceFeatures bc_features{};
+	bc_features.textureCompressionBC = true;
+	_texture_compression_bc = vkb_physical_device.enable_features_if_present(bc_features);
+
+	// Optional: vertex and fragment invocation counts in the profiler overlay
+	VkPhysicalDeviceFeatures statistics_features{};
+	statistics_features.pipelineStatisticsQuery = true;
+	_pipeline_statistics = vkb_physical_device.enable_features_if_present(statistics_features);
+
+	// Optional: MIN reduction sampler that builds the occlusion depth pyramid
+	VkPhysicalDeviceVulkan12Features minmax_features{ .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES };
+	minmax_features.samplerFilterMinmax = true;
+	_sampler_filter_minmax = vkb_physical_device.enable_extension_features_if_present(minmax_features);
+	_occlusion_culling = _occlusion_culling && _sampler_filter_minmax;
+
+	// Optional: meshlet draws read their command count written by the cluster pass
+	VkPhysicalDeviceVulkan12Features indirect_count_features{ .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES };
+	indirect_count_features.drawIndirectCount = true;
+	_draw_indirect_count = vkb_physical_device.enable_extension_features_if_present(indirect_count_features);
+	_cluster_culling = _cluster_culling && _draw_indirect_count;
+
+	VkPhysicalDeviceExtendedDynamicState3FeaturesEXT eds3_features{ .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_3_FEATURES_EXT };
+	eds3_features.extendedDynamicState3PolygonMode = VK_TRUE;
+
 	vkb::DeviceBuilder device_builder{ vkb_physical_device };
+	if (_dynamic_polygon_mode) {
+		device_builder.add_pNext(&eds3_features);
+	}
 	vkb::Result<vkb::Device> vkb_device_result = device_builder.build();
 
     if (!vkb_device_result.has_value()) {
@@ -153,6 +262,16 @@ std::optional<EngineInitError> VkEngine::init_vulkan() {
 	_device = vkb_device.device;
 	_chosen_gpu = vkb_physical_device.physical_device;
 
+	if (_dynamic_polygon_mode) {
+		_cmd_set_polygon_mode = (PFN_vkCmdSetPolygonModeEXT) vkGetDeviceProcAddr(_device, "vkCmdSetPolygonModeEXT");
+		_dynamic_polygon_mode = _cmd_set_polygon_mode != nullptr;
+	}
+	std::print("Dynamic polygon mode: {}\n", _dynamic_polygon_mode ? "yes" : "no, wireframe pipelines are built on demand");
+	std::print("BC texture compression: {}\n", _texture_compression_bc ? "yes" : "no, glTF textures are decoded at load time");
+	std::print("Pipeline statistics: {}\n", _pipeline_statistics ? "yes" : "no, the profiler only shows timings");
+	std::print("Sampler min filter: {}\n", _sampler_filter_minmax ? "yes" : "no, occlusion culling is off");
+	std::print("Draw indirect count: {}\n", _draw_indirect_count ? "yes" : "no, cluster culling is off");
+
     // Create Allocator
     VmaAllocatorCreateInfo allocator_info = {};
     allocator_info.physicalDevice = _chosen_gpu;
@@ -183,22 +302,52 @@ std::optional<EngineInitError> VkEngine::init_vulkan() {
     return std::nullopt;
 }
 
+void VkEngine::init_pipeline_cache() {
+	_pipeline_cache = vkutil::load_pipeline_cache(_device, _chosen_gpu, PIPELINE_CACHE_PATH);
+
+	// NOTE: Runs at shutdown after every pipeline was created, so the whole session gets persisted
+	_main_deletion_queue.push_function([=, this]() {
+		vkutil::save_pipeline_cache(_device, _chosen_gpu, _pipeline_cache, PIPELINE_CACHE_PATH);
+		vkDestroyPipelineCache(_device, _pipeline_cache, nullptr);
+	});
+}
+
 std::optional<EngineInitError> VkEngine::init_swapchain() {
     const std::optional<EngineInitError> create_swapchain_result = create_swapchain(_window_extent.width, _window_extent.height);
     if (create_swapchain_result.has_value()) {
         return create_swapchain_result;
     }
 
+    const std::optional<EngineInitError> create_render_targets_result = create_render_targets(_window_extent);
+    if (create_render_targets_result.has_value()) {
+        return create_render_targets_result;
+    }
+
+    // Cleanup
+    // NOTE: The render targets may be reallocated on resize, so we destroy whichever ones are current at shutdown
+    _main_deletion_queue.push_function([this]() {
+		destroy_image(_draw_image);
+		destroy_image(_depth_image);
+	});
+
+    return std::nullopt;
+}
+
+std::optional<EngineInitError> VkEngine::create_render_targets(VkExtent2D extent) {
     // Create Draw Image
 	VkExtent3D draw_image_extent = {
-		_window_extent.width,
-		_window_extent.height,
+		extent.width,
+		extent.height,
 		1
 	};
 
+	// NOTE: Built in locals and only stored once both targets exist, a failed resize keeps the current ones
+	AllocatedImage draw_image {};
+	AllocatedImage depth_image {};
+
 	// NOTE: We use a hard-coded 64bit image format for the draw image for the extra precision
-	_draw_image.image_format = VK_FORMAT_R16G16B16A16_SFLOAT;
-	_draw_image.image_extent = draw_image_extent;
+	draw_image.image_format = VK_FORMAT_R16G16B16A16_SFLOAT;
+	draw_image.image_extent = draw_image_extent;
 
 	VkImageUsageFlags draw_image_usages{};
 	draw_image_usages |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
@@ -206,20 +355,21 @@ std::optional<EngineInitError> VkEngine::init_swapchain() {
 	draw_image_usages |= VK_IMAGE_USAGE_STORAGE_BIT;
 	draw_image_usages |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
 
-	const VkImageCreateInfo draw_img_info = vkinit::image_create_info(_draw_image.image_format, draw_image_usages, draw_image_extent);
+	const VkImageCreateInfo draw_img_info = vkinit::image_create_info(draw_image.image_format, draw_image_usages, draw_image_extent);
 
 	VmaAllocationCreateInfo draw_img_alloc_info = {};
 	draw_img_alloc_info.usage = VMA_MEMORY_USAGE_GPU_ONLY;
 	draw_img_alloc_info.requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
-	if(vmaCreateImage(_allocator, &draw_img_info, &draw_img_alloc_info, &_draw_image.image, &_draw_image.allocation, nullptr)) {
+	if(vmaCreateImage(_allocator, &draw_img_info, &draw_img_alloc_info, &draw_image.image, &draw_image.allocation, nullptr)) {
         std::print(INIT_ERROR_STRING, "Could not create draw Image");
         return EngineInitError::Vk_CreateDrawImageFailed;
     }
 
-	VkImageViewCreateInfo draw_img_view_info = vkinit::image_view_create_info(_draw_image.image_format, _draw_image.image, VK_IMAGE_ASPECT_COLOR_BIT);
-	if (vkCreateImageView(_device, &draw_img_view_info, nullptr, &_draw_image.image_view)) {
+	VkImageViewCreateInfo draw_img_view_info = vkinit::image_view_create_info(draw_image.image_format, draw_image.image, VK_IMAGE_ASPECT_COLOR_BIT);
+	if (vkCreateImageView(_device, &draw_img_view_info, nullptr, &draw_image.image_view)) {
         std::print(INIT_ERROR_STRING, "Could not create draw ImageView");
+        vmaDestroyImage(_allocator, draw_image.image, draw_image.allocation);
         return EngineInitError::Vk_CreateDrawImageViewFailed;
     }
 
@@ -227,29 +377,33 @@ std::optional<EngineInitError> VkEngine::init_swapchain() {
     // Create Depth Image
 	//
 	
-    _depth_image.image_format = VK_FORMAT_D32_SFLOAT;
-	_depth_image.image_extent = draw_image_extent;
+    depth_image.image_format = VK_FORMAT_D32_SFLOAT;
+	depth_image.image_extent = draw_image_extent;
 
 	VkImageUsageFlags depth_image_usages{};
 	depth_image_usages |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+	// Read by the occlusion culling depth pyramid
+	depth_image_usages |= VK_IMAGE_USAGE_SAMPLED_BIT;
 
 	const VkImageCreateInfo depth_img_info =
-        vkinit::image_create_info(_depth_image.image_format, depth_image_usages, draw_image_extent);
+        vkinit::image_create_info(depth_image.image_format, depth_image_usages, draw_image_extent);
 
-	vmaCreateImage(_allocator, &depth_img_info, &draw_img_alloc_info, &_depth_image.image, &_depth_image.allocation, nullptr);
-
-	const VkImageViewCreateInfo depth_view_info = vkinit::image_view_create_info(_depth_image.image_format, _depth_image.image, VK_IMAGE_ASPECT_DEPTH_BIT);
-
-	VK_CHECK(vkCreateImageView(_device, &depth_view_info, nullptr, &_depth_image.image_view));
+	if (vmaCreateImage(_allocator, &depth_img_info, &draw_img_alloc_info, &depth_image.image, &depth_image.allocation, nullptr)) {
+        std::print(INIT_ERROR_STRING, "Could not create depth Image");
+        destroy_image(draw_image);
+        return EngineInitError::Vk_CreateDepthImageFailed;
+    }
 
-    // Cleanup
-    _main_deletion_queue.push_function([=]() {
-		vkDestroyImageView(_device, _draw_image.image_view, nullptr);
-		vmaDestroyImage(_allocator, _draw_image.image, _draw_image.allocation);
+	const VkImageViewCreateInfo depth_view_info = vkinit::image_view_create_info(depth_image.image_format, depth_image.image, VK_IMAGE_ASPECT_DEPTH_BIT);
+	if (vkCreateImageView(_device, &depth_view_info, nullptr, &depth_image.image_view)) {
+        std::print(INIT_ERROR_STRING, "Could not create depth ImageView");
+        destroy_image(draw_image);
+        vmaDestroyImage(_allocator, depth_image.image, depth_image.allocation);
+        return EngineInitError::Vk_CreateDepthImageViewFailed;
+    }
 
-        vkDestroyImageView(_device, _depth_image.image_view, nullptr);
-		vmaDestroyImage(_allocator, _depth_image.image, _depth_image.allocation);
-	});
+	_draw_image = draw_image;
+	_depth_image = depth_image;
 
     return std::nullopt;
 }
@@ -273,6 +427,13 @@ std::optional<EngineInitError> VkEngine::init_commands() {
         }
 	}
 
+    // Profiling queries
+    _gpu_profiler.init(_device, _chosen_gpu, FRAME_OVERLAP, _pipeline_statistics);
+
+    _main_deletion_queue.push_function([=, this]() {
+        _gpu_profiler.destroy(_device);
+    });
+
     // Immediate structures
     VK_CHECK(vkCreateCommandPool(_device, &command_pool_info, nullptr, &_imm_command_pool));
 
@@ -333,7 +494,13 @@ void VkEngine::init_descriptors() {
     {
         DescriptorLayoutBuilder builder;
         builder.add_binding(0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
-        _draw_image_descriptor_layout = builder.build(_device, VK_SHADER_STAGE_COMPUTE_BIT);
+        _background_image_descriptor_layout = builder.build(_device, VK_SHADER_STAGE_COMPUTE_BIT);
+    }
+
+    {
+        DescriptorLayoutBuilder builder;
+        builder.add_binding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+        _background_sampler_descriptor_layout = builder.build(_device, VK_SHADER_STAGE_FRAGMENT_BIT);
     }
 
     {
@@ -343,17 +510,11 @@ void VkEngine::init_descriptors() {
     }
 
     _main_deletion_queue.push_function([&]() {
-        vkDestroyDescriptorSetLayout(_device, _draw_image_descriptor_layout, nullptr);
+        vkDestroyDescriptorSetLayout(_device, _background_image_descriptor_layout, nullptr);
+        vkDestroyDescriptorSetLayout(_device, _background_sampler_descriptor_layout, nullptr);
         vkDestroyDescriptorSetLayout(_device, _gpu_scene_data_descriptor_layout, nullptr);
     });
 
-    _draw_image_descriptors = _global_descriptor_allocator.allocate(_device, _draw_image_descriptor_layout);
-    {
-        DescriptorWriter writer;	
-		writer.write_image(0, _draw_image.image_view, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
-        writer.update_set(_device, _draw_image_descriptors);
-    }
-
 	for (int i = 0; i < FRAME_OVERLAP; i++) {
 		// create a descriptor pool
 		const std::vector<DescriptorAllocator::PoolSizeRatio> frame_sizes = {
@@ -377,7 +538,7 @@ void VkEngine::init_background_pipelines() {
     VkPipelineLayoutCreateInfo compute_layout{};
 	compute_layout.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
 	compute_layout.pNext = nullptr;
-	compute_layout.pSetLayouts = &_draw_image_descriptor_layout;
+	compute_layout.pSetLayouts = &_background_image_descriptor_layout;
 	compute_layout.setLayoutCount = 1;
 
     VkPushConstantRange push_constant{};
@@ -408,12 +569,12 @@ void VkEngine::init_background_pipelines() {
     VkShaderModule gradient_compute_shader;
     VkShaderModule sky_compute_shader;
 
-    if (!vkutil::load_shader_module("../shaders/gradient.comp.spv", _device, &gradient_compute_shader))
+    if (!vkutil::load_shader_module(shaders::gradient_comp, _device, &gradient_compute_shader))
     {
         std::print("Error when building the compute shader \n");
         abort();
     }
-    if (!vkutil::load_shader_module("../shaders/sky.comp.spv", _device, &sky_compute_shader))
+    if (!vkutil::load_shader_module(shaders::sky_comp, _device, &sky_compute_shader))
     {
         std::print("Error when building the compute shader \n");
         abort();
@@ -433,10 +594,10 @@ void VkEngine::init_background_pipelines() {
 	compute_pipeline_createInfo.stage = stage_info;
 
     // The ony difference between pipelines is the shader module
-	VK_CHECK(vkCreateComputePipelines(_device, VK_NULL_HANDLE, 1, &compute_pipeline_createInfo, nullptr, &gradient.pipeline));
+	VK_CHECK(vkCreateComputePipelines(_device, _pipeline_cache, 1, &compute_pipeline_createInfo, nullptr, &gradient.pipeline));
 
     compute_pipeline_createInfo.stage.module = sky_compute_shader;
-	VK_CHECK(vkCreateComputePipelines(_device, VK_NULL_HANDLE, 1, &compute_pipeline_createInfo, nullptr, &sky.pipeline));
+	VK_CHECK(vkCreateComputePipelines(_device, _pipeline_cache, 1, &compute_pipeline_createInfo, nullptr, &sky.pipeline));
 
     // Add the compute effects into the array
     _compute_effects.push_back(gradient);
@@ -452,13 +613,58 @@ void VkEngine::init_background_pipelines() {
 		vkDestroyPipeline(_device, gradient.pipeline, nullptr);
         vkDestroyPipeline(_device, sky.pipeline, nullptr);
 	});
-}
 
-void VkEngine::init_pipelines() {
-    init_background_pipelines();
+    //
+    // Create composite pipeline
+    //
+
+    VkShaderModule fullscreen_vertex_shader;
+    VkShaderModule composite_frag_shader;
+
+    if (!vkutil::load_shader_module(shaders::fullscreen_vert, _device, &fullscreen_vertex_shader))
+    {
+        std::print("Error when building the fullscreen vertex shader \n");
+        abort();
+    }
+    if (!vkutil::load_shader_module(shaders::background_composite_frag, _device, &composite_frag_shader))
+    {
+        std::print("Error when building the background composite fragment shader \n");
+        abort();
+    }
+
+	VkPipelineLayoutCreateInfo composite_layout_info = vkinit::pipeline_layout_create_info();
+	composite_layout_info.setLayoutCount = 1;
+	composite_layout_info.pSetLayouts = &_background_sampler_descriptor_layout;
+
+	VK_CHECK(vkCreatePipelineLayout(_device, &composite_layout_info, nullptr, &_background_composite_layout));
+
+	// NOTE: The fullscreen triangle sits on the far plane, so with reverse-Z and GREATER_OR_EQUAL it only
+	// passes the depth test (and runs the fragment shader) where no geometry has been drawn.
+	PipelineBuilder pipeline_builder;
+	pipeline_builder.set_shaders(fullscreen_vertex_shader, composite_frag_shader);
+	pipeline_builder.set_input_topology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+	pipeline_builder.set_polygon_mode(VK_POLYGON_MODE_FILL);
+	pipeline_builder.set_cull_mode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
+	pipeline_builder.set_multisampling_none();
+	pipeline_builder.disable_blending();
+	pipeline_builder.enable_depthtest(false, VK_COMPARE_OP_GREATER_OR_EQUAL);
+	pipeline_builder.set_color_attachment_format(_draw_image.image_format);
+	pipeline_builder.set_depth_format(_depth_image.image_format);
+	pipeline_builder._pipeline_layout = _background_composite_layout;
+
+	_background_composite_pipeline = pipeline_builder.build_pipeline(_device, _pipeline_cache);
 
-    metal_rough_material.build_pipelines(this);
-	flat_color_material.build_pipelines(this);
+    vkDestroyShaderModule(_device, fullscreen_vertex_shader, nullptr);
+    vkDestroyShaderModule(_device, composite_frag_shader, nullptr);
+
+	_main_deletion_queue.push_function([=, this]() {
+		vkDestroyPipelineLayout(_device, _background_composite_layout, nullptr);
+		vkDestroyPipeline(_device, _background_composite_pipeline, nullptr);
+
+		if (_background_image.image != VK_NULL_HANDLE) {
+			destroy_image(_background_image);
+		}
+	});
 }
 
 void VkEngine::init_imgui()
@@ -500,6 +706,7 @@ void VkEngine::init_imgui()
 	vulkan_init_info.Device = _device;
 	vulkan_init_info.Queue = _graphics_queue;
 	vulkan_init_info.DescriptorPool = imgui_pool;
+	vulkan_init_info.PipelineCache = _pipeline_cache;
 	vulkan_init_info.MinImageCount = 3;
 	vulkan_init_info.ImageCount = 3;
 	vulkan_init_info.UseDynamicRendering = true;
@@ -536,7 +743,18 @@ void VkEngine::init_camera() {
 	ortho_camera.yaw = 75.0;
 }
 
-std::optional<EngineInitError> VkEngine::init() {
+std::optional<EngineInitError> VkEngine::init(const std::filesystem::path& map_path) {
+    _map_path = map_path;
+    _init_start_ns = profiler::now_ns();
+
+    const auto to_ms = [](uint64_t ns) { return ns / 1000000.f; };
+    const auto timed_phase = [&](const char* name, auto&& phase) {
+        PROFILE_SCOPE(name);
+        const uint64_t start = profiler::now_ns();
+        phase();
+        const uint64_t end = profiler::now_ns();
+        _init_phases.push_back(InitPhase{ name, to_ms(start - _init_start_ns), to_ms(end - start), true });
+    };
 
     if (SDL_Init(SDL_INIT_VIDEO)) {
         std::print(INIT_ERROR_STRING, SDL_GetError());
@@ -551,15 +769,60 @@ std::optional<EngineInitError> VkEngine::init() {
         std::print(INIT_ERROR_STRING, SDL_GetError());
         return EngineInitError::SDL_CreateWindowFailed;
     }
+    _init_phases.push_back(InitPhase{ "sdl_window", 0.f, to_ms(profiler::now_ns() - _init_start_ns), true });
+
+    timed_phase("vulkan", [this]() { init_vulkan(); });
+    timed_phase("pipeline_cache", [this]() { init_pipeline_cache(); });
+    timed_phase("swapchain", [this]() { init_swapchain(); });
+    timed_phase("commands", [this]() { init_commands(); });
+    timed_phase("sync_structures", [this]() { init_sync_structures(); });
+    timed_phase("descriptors", [this]() { init_descriptors(); });
+
+    // Once the device and layouts exist, shader loading, pipeline compilation and map parsing are independent.
+    // Anything that records into the immediate submit command buffer or touches SDL/ImGui stays on this thread
+    {
+        std::optional<MapLayout> map_layout;
+
+        _workers.start(std::clamp(std::thread::hardware_concurrency(), 2u, 5u) - 1);
+
+        TaskGraph graph;
+        graph.add("background_pipelines", [this]() { init_background_pipelines(); });
+        if (_sampler_filter_minmax) {
+            graph.add("occlusion_pipelines", [this]() { _occlusion.init(this, FRAME_OVERLAP); });
+        }
+        if (_draw_indirect_count) {
+            graph.add("cluster_pipelines", [this]() { _clusters.init(this, FRAME_OVERLAP); });
+        }
+        const TaskGraph::TaskId gltf_pipelines = graph.add("gltf_pipelines", [this]() {
+            metal_rough_material.build_pipelines(this);
+        });
+        const TaskGraph::TaskId map_parse = graph.add("map_parse", [&]() {
+            map_layout = MapLayout::from_path(_map_path);
+        });
+
+        graph.add("imgui", [this]() { init_imgui(); }, {}, TaskGraph::Affinity::MainThread);
+        const TaskGraph::TaskId default_textures = graph.add("default_textures", [this]() {
+            init_default_textures();
+        }, {}, TaskGraph::Affinity::MainThread);
+        graph.add("default_material", [this]() {
+            init_default_material();
+        }, { default_textures, gltf_pipelines }, TaskGraph::Affinity::MainThread);
+        graph.add("map_build", [&]() {
+            init_default_meshes(*map_layout);
+        }, { map_parse, default_textures, gltf_pipelines }, TaskGraph::Affinity::MainThread);
+
+        graph.run(_workers);
+
+        for (const TaskGraph::Timing& timing : graph.timings()) {
+            _init_phases.push_back(InitPhase{
+                timing.name,
+                to_ms(timing.start_ns - _init_start_ns),
+                to_ms(timing.end_ns - timing.start_ns),
+                timing.main_thread
+            });
+        }
+    }
 
-    init_vulkan();
-    init_swapchain();
-    init_commands();
-    init_sync_structures();
-    init_descriptors();
-    init_pipelines();
-    init_imgui();
-    init_default_data();
 	init_camera();
 
 	scene_data.ambient_color = glm::vec4(.1f);
@@ -568,9 +831,20 @@ std::optional<EngineInitError> VkEngine::init() {
 
     _is_initialized = true;
 
+    print_init_phases();
+
     return std::nullopt;
 }
 
+void VkEngine::print_init_phases() const {
+    std::print("Startup phases:\n");
+    for (const InitPhase& phase : _init_phases) {
+        std::print("    {:<24} {:>8.2f} ms  (at {:>8.2f} ms, {})\n",
+            phase.name, phase.duration_ms, phase.start_ms, phase.main_thread ? "main" : "worker");
+    }
+    std::print("Init took {:.2f} ms\n", (profiler::now_ns() - _init_start_ns) / 1000000.f);
+}
+
 void VkEngine::cleanup() {
     if (_is_initialized) {
         vkDeviceWaitIdle(_device);
@@ -589,7 +863,6 @@ void VkEngine::cleanup() {
 		}
 
         metal_rough_material.clear_resources(_device);
-		flat_color_material.clear_resources(_device);
 
         _main_deletion_queue.flush();
 
@@ -602,6 +875,8 @@ void VkEngine::cleanup() {
 
         SDL_DestroyWindow(_window);
     }
+
+    _workers.stop();
 }
 
 void VkEngine::immediate_submit(std::function<void(VkCommandBuffer cmd)>&& function)
@@ -648,7 +923,9 @@ void VkEngine::destroy_buffer(const AllocatedBuffer& buffer)
     vmaDestroyBuffer(_allocator, buffer.buffer, buffer.allocation);
 }
 
-void VkEngine::init_default_meshes() {
+void VkEngine::init_default_meshes(const MapLayout& map_layout) {
+	PROFILE_SCOPE("init_default_meshes");
+
 	/*
     std::string structure_path = { "../assets/structure.glb" };
     auto structure_file = LoadedGLTF::load_gltf(this,structure_path);
@@ -656,12 +933,14 @@ void VkEngine::init_default_meshes() {
     loaded_scenes["structure"] = *structure_file;
 	*/
 
-	MapLayout map_layout = MapLayout::from_path("../maps/test_map.tdm");
     map_layout.print();
 	map = Map(this, map_layout);
+	map.register_renderables(_render_world, _tile_world);
 }
 
 void VkEngine::init_default_textures() {
+	PROFILE_SCOPE("init_default_textures");
+
 // Create flat-colored images
 	const uint32_t white = glm::packUnorm4x8(glm::vec4(1, 1, 1, 1));
 	_default_images._white_image = create_image((void*)&white, VkExtent3D{ 1, 1, 1 }, VK_FORMAT_R8G8B8A8_UNORM,
@@ -734,27 +1013,25 @@ void VkEngine::init_default_material() {
 	material_resources.data_buffer = material_constants.buffer;
 	material_resources.data_buffer_offset = 0;
 
+	// Not tied to any mesh winding, drawn from both sides
 	default_data = metal_rough_material.write_material(
-        _device, MaterialPass::MainColor, material_resources, _global_descriptor_allocator);
-}
-
-void VkEngine::init_default_data() {
-    init_default_textures();
-    init_default_material();
-	init_default_meshes();
+        _device, MATERIAL_FEATURE_LIT_BIT | MATERIAL_FEATURE_DOUBLE_SIDED_BIT, material_resources, _global_descriptor_allocator);
 }
 
-void VkEngine::update_scene()
+void VkEngine::update_scene(float dt)
 {
+	PROFILE_SCOPE("update_scene");
+	ALLOC_SCOPE(SceneUpdate);
+
 	glm::mat4 view;
 	glm::mat4 proj;
 
 	if (use_ortho_camera) {
-		ortho_camera.update(stats.frametime);
+		ortho_camera.update(dt);
 		view = ortho_camera.get_view_matrix();
 		proj = ortho_camera.get_proj_matrix((float)_window_extent.width / (float)_window_extent.height);
 	} else {
-		main_camera.update(stats.frametime);
+		main_camera.update(dt);
 		view = main_camera.get_view_matrix();
 		proj = main_camera.get_proj_matrix((float)_window_extent.width / (float)_window_extent.height);
 	}
@@ -764,64 +1041,129 @@ void VkEngine::update_scene()
 	scene_data.proj = proj;
 	scene_data.view_proj = proj * view;
 
-	//loaded_scenes["structure"]->draw(glm::mat4{ 1.f }, main_draw_context);
-	map.draw(glm::mat4{ 1.f }, main_draw_context);
+	// Only what moved since last frame is touched, the draw records are retained
+	_transforms.update();
+	_render_world.sync_transforms(_transforms);
+	_tile_world.sync_transforms(_transforms);
+	_render_world.update_bvh();
+	_tile_world.update_bvh();
 }
 
-GPUMeshBuffers VkEngine::upload_mesh(std::span<uint32_t> indices, std::span<Vertex> vertices)
+void VkEngine::pick(float x, float y)
 {
-    // Create Mesh buffers
-	const size_t vertex_buffer_size = vertices.size() * sizeof(Vertex);
-	const size_t index_buffer_size = indices.size() * sizeof(uint32_t);
+	// Unproject the cursor at both ends of the depth range, the ray runs from the end nearest the camera
+	const glm::mat4 inv_view_proj = glm::inverse(scene_data.view_proj);
+	const glm::vec2 ndc {
+		2.f * x / (float)_window_extent.width - 1.f,
+		2.f * y / (float)_window_extent.height - 1.f,
+	};
 
-	GPUMeshBuffers mesh_buffers;
+	glm::vec4 a = inv_view_proj * glm::vec4(ndc, 0.f, 1.f);
+	glm::vec4 b = inv_view_proj * glm::vec4(ndc, 1.f, 1.f);
+	glm::vec3 start = glm::vec3(a) / a.w;
+	glm::vec3 end = glm::vec3(b) / b.w;
 
-	mesh_buffers.vertex_buffer = create_buffer(
-        vertex_buffer_size, 
-        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-		VMA_MEMORY_USAGE_GPU_ONLY
-    );
+	const glm::vec3 eye = glm::vec3(glm::inverse(scene_data.view)[3]);
+	if (glm::length(end - eye) < glm::length(start - eye)) {
+		std::swap(start, end);
+	}
 
-	const VkBufferDeviceAddressInfo device_adress_info{ 
-        .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
-        .buffer = mesh_buffers.vertex_buffer.buffer
-    };
-	mesh_buffers.vertex_buffer_address = vkGetBufferDeviceAddress(_device, &device_adress_info);
+	// With the unnormalized direction t = 1 is the far end, so only what is inside the view can be picked
+	_picked = _render_world.raycast(Ray { start, end - start }, 1.f);
+}
+
+GPUMeshBuffers VkEngine::upload_mesh(std::span<const uint32_t> indices, std::span<const Vertex> vertices)
+{
+	const MeshUpload mesh = { 0, static_cast<uint32_t>(vertices.size()), 0, static_cast<uint32_t>(indices.size()) };
+	return upload_meshes(indices, vertices, std::span(&mesh, 1))[0];
+}
 
-	mesh_buffers.index_buffer = create_buffer(
-        index_buffer_size,
-        VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-		VMA_MEMORY_USAGE_GPU_ONLY
-    );
+std::vector<GPUMeshBuffers> VkEngine::upload_meshes(std::span<const uint32_t> indices, std::span<const Vertex> vertices,
+	std::span<const MeshUpload> meshes, std::span<const Meshlet> meshlets)
+{
+	const size_t vertex_data_size = vertices.size_bytes();
+	const size_t index_data_size = indices.size_bytes();
+	const size_t meshlet_data_size = meshlets.size_bytes();
+
+	std::vector<GPUMeshBuffers> mesh_buffers(meshes.size());
+	for (size_t i = 0; i < meshes.size(); i++) {
+		// Create Mesh buffers
+		mesh_buffers[i].vertex_buffer = create_buffer(
+			meshes[i].vertex_count * sizeof(Vertex),
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+			VMA_MEMORY_USAGE_GPU_ONLY
+		);
+
+		const VkBufferDeviceAddressInfo device_adress_info{
+			.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+			.buffer = mesh_buffers[i].vertex_buffer.buffer
+		};
+		mesh_buffers[i].vertex_buffer_address = vkGetBufferDeviceAddress(_device, &device_adress_info);
+
+		mesh_buffers[i].index_buffer = create_buffer(
+			meshes[i].index_count * sizeof(uint32_t),
+			VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VMA_MEMORY_USAGE_GPU_ONLY
+		);
+
+		// Read by the cluster culling pass through its device address
+		if (meshes[i].meshlet_count > 0) {
+			mesh_buffers[i].meshlet_buffer = create_buffer(
+				meshes[i].meshlet_count * sizeof(Meshlet),
+				VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+				VMA_MEMORY_USAGE_GPU_ONLY
+			);
+
+			const VkBufferDeviceAddressInfo meshlet_address_info{
+				.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+				.buffer = mesh_buffers[i].meshlet_buffer.buffer
+			};
+			mesh_buffers[i].meshlet_buffer_address = vkGetBufferDeviceAddress(_device, &meshlet_address_info);
+		}
+	}
 
-    // Copy data to mesh buffers
-    AllocatedBuffer staging = create_buffer(
-        vertex_buffer_size + index_buffer_size,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VMA_MEMORY_USAGE_CPU_ONLY
-    );
+	// Copy data to mesh buffers, all vertices first then all indices and all meshlets
+	AllocatedBuffer staging = create_buffer(
+		vertex_data_size + index_data_size + meshlet_data_size,
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VMA_MEMORY_USAGE_CPU_ONLY
+	);
 
 	void* data = staging.allocation->GetMappedData();
 
-	memcpy(data, vertices.data(), vertex_buffer_size);
-	memcpy((char*)data + vertex_buffer_size, indices.data(), index_buffer_size);
+	memcpy(data, vertices.data(), vertex_data_size);
+	memcpy((char*)data + vertex_data_size, indices.data(), index_data_size);
+	if (meshlet_data_size > 0) {
+		memcpy((char*)data + vertex_data_size + index_data_size, meshlets.data(), meshlet_data_size);
+	}
 
-    // NOTE: Not very efficient, we are waiting for the GPU command to fully execute before continuing with our CPU side logic.
-    //Should be put on a background thread, whose sole job is to execute uploads like this one, and deleting/reusing the staging buffers.
+	// NOTE: Not very efficient, we are waiting for the GPU command to fully execute before continuing with our CPU side logic.
+	//Should be put on a background thread, whose sole job is to execute uploads like this one, and deleting/reusing the staging buffers.
 	immediate_submit([&](VkCommandBuffer cmd) {
-		VkBufferCopy vertex_copy{ 0 };
-		vertex_copy.dstOffset = 0;
-		vertex_copy.srcOffset = 0;
-		vertex_copy.size = vertex_buffer_size;
+		for (size_t i = 0; i < meshes.size(); i++) {
+			VkBufferCopy vertex_copy{ 0 };
+			vertex_copy.dstOffset = 0;
+			vertex_copy.srcOffset = meshes[i].first_vertex * sizeof(Vertex);
+			vertex_copy.size = meshes[i].vertex_count * sizeof(Vertex);
+
+			vkCmdCopyBuffer(cmd, staging.buffer, mesh_buffers[i].vertex_buffer.buffer, 1, &vertex_copy);
+
+			VkBufferCopy index_copy{ 0 };
+			index_copy.dstOffset = 0;
+			index_copy.srcOffset = vertex_data_size + meshes[i].first_index * sizeof(uint32_t);
+			index_copy.size = meshes[i].index_count * sizeof(uint32_t);
 
-		vkCmdCopyBuffer(cmd, staging.buffer, mesh_buffers.vertex_buffer.buffer, 1, &vertex_copy);
+			vkCmdCopyBuffer(cmd, staging.buffer, mesh_buffers[i].index_buffer.buffer, 1, &index_copy);
 
-		VkBufferCopy index_copy{ 0 };
-		index_copy.dstOffset = 0;
-		index_copy.srcOffset = vertex_buffer_size;
-		index_copy.size = index_buffer_size;
+			if (meshes[i].meshlet_count > 0) {
+				VkBufferCopy meshlet_copy{ 0 };
+				meshlet_copy.dstOffset = 0;
+				meshlet_copy.srcOffset = vertex_data_size + index_data_size + meshes[i].first_meshlet * sizeof(Meshlet);
+				meshlet_copy.size = meshes[i].meshlet_count * sizeof(Meshlet);
 
-		vkCmdCopyBuffer(cmd, staging.buffer, mesh_buffers.index_buffer.buffer, 1, &index_copy);
+				vkCmdCopyBuffer(cmd, staging.buffer, mesh_buffers[i].meshlet_buffer.buffer, 1, &meshlet_copy);
+			}
+		}
 	});
 
 	destroy_buffer(staging);
@@ -899,6 +1241,80 @@ AllocatedImage VkEngine::create_image(void* data, VkExtent3D size, VkFormat form
 	return new_image;
 }
 
+std::vector<AllocatedImage> VkEngine::create_images(const AllocatedBuffer& staging, std::span<const ImageUpload> uploads)
+{
+	std::vector<AllocatedImage> new_images;
+	new_images.reserve(uploads.size());
+	for (const ImageUpload& upload : uploads) {
+		// Only generating mipmaps blits from the image itself
+		const bool generate_mips = upload.mip_mapped && upload.staged_mips == 1;
+		new_images.push_back(create_image(upload.size, upload.format,
+			upload.usage | VK_IMAGE_USAGE_TRANSFER_DST_BIT | (generate_mips ? VK_IMAGE_USAGE_TRANSFER_SRC_BIT : 0),
+			upload.mip_mapped));
+	}
+
+	if (uploads.empty()) {
+		return new_images;
+	}
+
+	immediate_submit([&](VkCommandBuffer cmd) {
+		for (size_t i = 0; i < uploads.size(); i++) {
+			const ImageUpload& upload = uploads[i];
+			const AllocatedImage& new_image = new_images[i];
+
+			vkutil::transition_image(cmd, new_image.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+			VkDeviceSize offset = upload.staging_offset;
+			for (uint32_t mip = 0; mip < upload.staged_mips; mip++) {
+				const uint32_t width = std::max(upload.size.width >> mip, 1u);
+				const uint32_t height = std::max(upload.size.height >> mip, 1u);
+
+				VkBufferImageCopy copy_region = {};
+				copy_region.bufferOffset = offset;
+				copy_region.bufferRowLength = 0;
+				copy_region.bufferImageHeight = 0;
+
+				copy_region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+				copy_region.imageSubresource.mipLevel = mip;
+				copy_region.imageSubresource.baseArrayLayer = 0;
+				copy_region.imageSubresource.layerCount = 1;
+				copy_region.imageExtent = VkExtent3D{ width, height, 1 };
+
+				vkCmdCopyBufferToImage(cmd, staging.buffer, new_image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
+					&copy_region);
+
+				offset += texture_level_size(upload.format, width, height);
+			}
+
+			if (upload.mip_mapped && upload.staged_mips == 1) {
+				vkutil::generate_mipmaps(
+					cmd, new_image.image, VkExtent2D{new_image.image_extent.width, new_image.image_extent.height});
+			} else {
+				vkutil::transition_image(cmd, new_image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+					VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+			}
+		}
+	});
+
+	return new_images;
+}
+
+bool VkEngine::supports_sampled_format(VkFormat format) const
+{
+	// NOTE: Drivers may report BC formats even when the feature was not enabled on the device
+	if (format >= VK_FORMAT_BC1_RGB_UNORM_BLOCK && format <= VK_FORMAT_BC7_SRGB_BLOCK && !_texture_compression_bc) {
+		return false;
+	}
+
+	VkFormatProperties properties;
+	vkGetPhysicalDeviceFormatProperties(_chosen_gpu, format, &properties);
+
+	const VkFormatFeatureFlags required = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT
+		| VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT
+		| VK_FORMAT_FEATURE_TRANSFER_DST_BIT;
+	return (properties.optimalTilingFeatures & required) == required;
+}
+
 void VkEngine::destroy_image(const AllocatedImage& img)
 {
     vkDestroyImageView(_device, img.image_view, nullptr);
@@ -930,6 +1346,12 @@ void VkEngine::run() {
                     }
                     break;
                 }
+                case SDL_EVENT_MOUSE_BUTTON_DOWN: {
+                    if (sdl_event.button.button == SDL_BUTTON_LEFT && !ImGui::GetIO().WantCaptureMouse) {
+                        pick(sdl_event.button.x, sdl_event.button.y);
+                    }
+                    break;
+                }
                 case SDL_EVENT_WINDOW_MINIMIZED: {
                     _stop_rendering = true;
                     break;
@@ -938,6 +1360,10 @@ void VkEngine::run() {
                     _stop_rendering = false;
                     break;
                 }
+                case SDL_EVENT_WINDOW_PIXEL_SIZE_CHANGED: {
+                    _resize_requested = true;
+                    break;
+                }
                 default: {
                     break;
                 }
@@ -958,6 +1384,9 @@ void VkEngine::run() {
 			resize_swapchain();
 		}
 
+		// Everything from here to the end of the iteration is the steady-state frame
+		alloc_tracker::begin_frame();
+
 		//
 		// Setup Imgui rendering
 		//
@@ -968,6 +1397,14 @@ void VkEngine::run() {
 		ImGui::Begin("Debug Data");
 
 		ImGui::Checkbox("Wireframe", &draw_wireframe);
+		if (_sampler_filter_minmax) {
+			ImGui::Checkbox("Occlusion culling", &_occlusion_culling);
+		}
+		ImGui::Checkbox("Levels of detail", &_lods.enabled);
+		if (_draw_indirect_count) {
+			ImGui::Checkbox("Cluster culling", &_cluster_culling);
+		}
+		ImGui::SliderFloat("Lod error (px)", &_lods.error_pixels, 0.25f, 8.f);
 		ImGui::Checkbox("Orthographic camera", &use_ortho_camera);
 		ImGui::SliderFloat("Render Scale", &_render_scale, 0.3f, 1.f);
 
@@ -977,6 +1414,7 @@ void VkEngine::run() {
 			ImGui::Text("Selected effect: %s", selected.name);
 
 			ImGui::SliderInt("Effect Index", &_current_compute_effect, 0, _compute_effects.size() - 1);
+			ImGui::SliderFloat("Background Scale", &_background_scale, 0.25f, 1.f);
 
 			ImGui::InputFloat4("data1", (float*)&selected.data.data1);
 			ImGui::InputFloat4("data2", (float*)&selected.data.data2);
@@ -992,6 +1430,154 @@ void VkEngine::run() {
 			ImGui::Text("update time %f ms", stats.scene_update_time);
 			ImGui::Text("triangles %i", stats.triangle_count);
 			ImGui::Text("draws %i", stats.drawcall_count);
+			ImGui::Text("background redrawn %s", stats.background_redrawn ? "yes" : "no");
+			ImGui::Text("bvh nodes %u depth %u", _render_world.bvh().node_count(), _render_world.bvh().depth());
+			ImGui::Text("visibility %s (%u re-tested)", visibility_update_name(_visibility.last_update), _visibility.last_retested);
+			ImGui::Text("occluded %u, drawn late %u", _occlusion.occluded_count, _occlusion.late_drawn_count);
+			static_assert(max_lod_count == 4);
+			ImGui::Text("lod draws %u / %u / %u / %u (%u switched)", _lods.level_counts[0], _lods.level_counts[1],
+				_lods.level_counts[2], _lods.level_counts[3], _lods.switched);
+			ImGui::Text("meshlets drawn %u, frustum culled %u, backface culled %u", _clusters.drawn_count,
+				_clusters.frustum_culled_count, _clusters.backface_culled_count);
+			if (_picked) {
+				ImGui::Text("picked surface %u at t %f", _picked->id, _picked->t);
+			} else {
+				ImGui::Text("picked surface none");
+			}
+
+			ImGui::SeparatorText("GPU");
+			ImGui::Text("gpu frame %f ms (last %f ms)", _gpu_profiler.average_frame_ms(), _gpu_profiler.last_frame_ms());
+			for (uint32_t pass = 0; pass < GpuProfiler::pass_count; pass++) {
+				ImGui::Text("gpu %s %f ms", gpu_pass_name(GpuPass(pass)), _gpu_profiler.average_ms(GpuPass(pass)));
+			}
+			if (_gpu_profiler.has_statistics()) {
+				ImGui::Text("vertex invocations %llu", (unsigned long long) _gpu_profiler.vertex_invocations);
+				ImGui::Text("fragment invocations %llu", (unsigned long long) _gpu_profiler.fragment_invocations);
+			}
+
+			ImGui::TreePop();
+		}
+
+		if (ImGui::TreeNode("Frame Histogram")) {
+			ImGui::SliderInt("Window", &_stats_window, 60, FrameStatsHistory::capacity);
+
+			if (ImGui::BeginTable("Percentiles", 6)) {
+				ImGui::TableSetupColumn("ms");
+				ImGui::TableSetupColumn("p50");
+				ImGui::TableSetupColumn("p95");
+				ImGui::TableSetupColumn("p99");
+				ImGui::TableSetupColumn("max");
+				ImGui::TableSetupColumn("mean");
+				ImGui::TableHeadersRow();
+
+				for (uint32_t m = 0; m < FrameStatsHistory::metric_count; m++) {
+					const FrameStatsHistory::Summary summary = _frame_stats.summarize(FrameMetric(m), _stats_window);
+
+					ImGui::TableNextRow();
+					ImGui::TableNextColumn(); ImGui::Text("%s", frame_metric_name(FrameMetric(m)));
+					ImGui::TableNextColumn(); ImGui::Text("%.3f", summary.p50);
+					ImGui::TableNextColumn(); ImGui::Text("%.3f", summary.p95);
+					ImGui::TableNextColumn(); ImGui::Text("%.3f", summary.p99);
+					ImGui::TableNextColumn(); ImGui::Text("%.3f", summary.max);
+					ImGui::TableNextColumn(); ImGui::Text("%.3f", summary.mean);
+				}
+				ImGui::EndTable();
+			}
+
+			for (uint32_t m = 0; m < FrameStatsHistory::metric_count; m++) {
+				_frame_stats.window_samples(FrameMetric(m), _stats_window, _stats_plot_samples);
+				ImGui::PlotLines(frame_metric_name(FrameMetric(m)), _stats_plot_samples.data(), (int) _stats_plot_samples.size(),
+					0, nullptr, 0.f, FLT_MAX, ImVec2(0, 60));
+			}
+
+			// Distribution of frametimes over the window, in 1ms buckets
+			_frame_stats.window_samples(FrameMetric::FrameTime, _stats_window, _stats_plot_samples);
+			std::array<float, 50> buckets{};
+			for (float sample : _stats_plot_samples) {
+				buckets[std::min<size_t>(static_cast<size_t>(sample), buckets.size() - 1)] += 1.f;
+			}
+			ImGui::PlotHistogram("frametime histogram", buckets.data(), (int) buckets.size(),
+				0, "1ms buckets", 0.f, FLT_MAX, ImVec2(0, 80));
+
+			if (ImGui::Button("Dump CSV")) {
+				_frame_stats.dump_csv("frame_stats.csv");
+			}
+
+			ImGui::TreePop();
+		}
+
+		if (ImGui::TreeNode("Allocations")) {
+			int guard = static_cast<int>(alloc_tracker::frame_guard());
+			if (ImGui::Combo("Frame guard", &guard, "Off\0Report\0Assert\0")) {
+				alloc_tracker::set_frame_guard(static_cast<alloc_tracker::FrameGuard>(guard));
+			}
+
+			if (ImGui::BeginTable("Allocations", 4)) {
+				ImGui::TableSetupColumn("subsystem");
+				ImGui::TableSetupColumn("allocs");
+				ImGui::TableSetupColumn("bytes");
+				ImGui::TableSetupColumn("frees");
+				ImGui::TableHeadersRow();
+
+				for (uint32_t s = 0; s < static_cast<uint32_t>(alloc_tracker::Subsystem::Count); s++) {
+					const alloc_tracker::Subsystem subsystem = static_cast<alloc_tracker::Subsystem>(s);
+					const alloc_tracker::Counters counters = alloc_tracker::last_frame(subsystem);
+
+					ImGui::TableNextRow();
+					ImGui::TableNextColumn(); ImGui::Text("%s", alloc_tracker::subsystem_name(subsystem));
+					ImGui::TableNextColumn(); ImGui::Text("%llu", (unsigned long long) counters.allocations);
+					ImGui::TableNextColumn(); ImGui::Text("%llu", (unsigned long long) counters.bytes);
+					ImGui::TableNextColumn(); ImGui::Text("%llu", (unsigned long long) counters.frees);
+				}
+
+				const alloc_tracker::Counters total = alloc_tracker::last_frame_total();
+				ImGui::TableNextRow();
+				ImGui::TableNextColumn(); ImGui::Text("total");
+				ImGui::TableNextColumn(); ImGui::Text("%llu", (unsigned long long) total.allocations);
+				ImGui::TableNextColumn(); ImGui::Text("%llu", (unsigned long long) total.bytes);
+				ImGui::TableNextColumn(); ImGui::Text("%llu", (unsigned long long) total.frees);
+
+				ImGui::EndTable();
+			}
+
+			if (alloc_tracker::last_frame_violations() > 0) {
+				ImGui::TextColored(ImVec4(1.f, 0.3f, 0.3f, 1.f), "%llu allocations inside the frame, first: %llu bytes in %s",
+					(unsigned long long) alloc_tracker::last_frame_violations(),
+					(unsigned long long) alloc_tracker::last_violation_size(),
+					alloc_tracker::subsystem_name(alloc_tracker::last_violation_subsystem()));
+			}
+
+			ImGui::TreePop();
+		}
+
+		if (ImGui::TreeNode("Startup")) {
+			ImGui::Text("cold start to first frame %.2f ms", _first_frame_ms);
+
+			if (ImGui::BeginTable("Init phases", 4)) {
+				ImGui::TableSetupColumn("phase");
+				ImGui::TableSetupColumn("start ms");
+				ImGui::TableSetupColumn("duration ms");
+				ImGui::TableSetupColumn("thread");
+				ImGui::TableHeadersRow();
+
+				for (const InitPhase& phase : _init_phases) {
+					ImGui::TableNextRow();
+					ImGui::TableNextColumn(); ImGui::Text("%s", phase.name);
+					ImGui::TableNextColumn(); ImGui::Text("%.2f", phase.start_ms);
+					ImGui::TableNextColumn(); ImGui::Text("%.2f", phase.duration_ms);
+					ImGui::TableNextColumn(); ImGui::Text("%s", phase.main_thread ? "main" : "worker");
+				}
+				ImGui::EndTable();
+			}
+
+			ImGui::TreePop();
+		}
+
+		if (ImGui::TreeNode("CPU Profiler")) {
+			if (ImGui::Button("Export Chrome trace")) {
+				profiler::export_chrome_trace("td_trace.json");
+			}
+			profiler::draw_flame_graph();
 			
 			ImGui::TreePop();
 		}
@@ -1013,7 +1599,13 @@ void VkEngine::run() {
 		ImGui::End();
 		ImGui::Render();
 
-		update_scene();
+		{
+			const auto update_start = std::chrono::steady_clock::now();
+			update_scene(stats.frametime);
+			const auto update_end = std::chrono::steady_clock::now();
+			stats.scene_update_time =
+				std::chrono::duration_cast<std::chrono::microseconds>(update_end - update_start).count() / 1000.f;
+		}
 
 		draw();
 
@@ -1021,7 +1613,129 @@ void VkEngine::run() {
 		const auto end = std::chrono::system_clock::now();
 		const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
 		stats.frametime = elapsed.count() / 1000.f;
+		stats.gpu_frame_time = _gpu_profiler.last_frame_ms();
+
+		_frame_stats.push(FrameStatsHistory::Sample{
+			stats.frametime,
+			stats.scene_update_time,
+			stats.mesh_draw_time,
+			stats.fence_wait_time,
+			stats.gpu_frame_time,
+		});
+
+		alloc_tracker::end_frame();
+		profiler::end_frame();
     }
+
+	// Dump the whole history on exit so perf gates can look at tail latency
+	_frame_stats.dump_csv("frame_stats.csv");
+	for (uint32_t m = 0; m < FrameStatsHistory::metric_count; m++) {
+		const FrameStatsHistory::Summary summary = _frame_stats.summarize(FrameMetric(m), FrameStatsHistory::capacity);
+		std::print("{}: p50 {:.3f} ms, p95 {:.3f} ms, p99 {:.3f} ms, max {:.3f} ms\n",
+			frame_metric_name(FrameMetric(m)), summary.p50, summary.p95, summary.p99, summary.max);
+	}
+}
+
+void VkEngine::run_scenario(const Scenario& scenario) {
+	std::ofstream csv(scenario.output_path, std::ios::out | std::ios::trunc);
+	if (!csv) {
+		std::print("Could not open scenario output at: {}\n", scenario.output_path.string());
+		return;
+	}
+	// NOTE: GPU time comes from timestamp queries that are read back FRAME_OVERLAP frames later,
+	// so the gpu column lags behind the rest of the row
+	csv << "frame,time,frametime_ms,scene_update_ms,draw_record_ms,fence_wait_ms,gpu_ms,drawcalls,triangles\n";
+
+	use_ortho_camera = scenario.ortho_camera;
+	_render_scale = scenario.render_scale;
+	draw_wireframe = scenario.wireframe;
+
+	main_camera.velocity = glm::vec3(0.f);
+	ortho_camera.velocity = glm::vec3(0.f);
+
+	SDL_Event sdl_event;
+	bool should_quit = false;
+
+	for (uint32_t frame = 0; frame < scenario.frame_count && !should_quit; frame++) {
+		const auto start = std::chrono::steady_clock::now();
+
+		// Only window events, input must not influence the run
+		while (SDL_PollEvent(&sdl_event) != 0) {
+			if (sdl_event.type == SDL_EVENT_QUIT) {
+				should_quit = true;
+			}
+			if (sdl_event.type == SDL_EVENT_KEY_DOWN && sdl_event.key.key == SDLK_ESCAPE) {
+				should_quit = true;
+			}
+			if (sdl_event.type == SDL_EVENT_WINDOW_PIXEL_SIZE_CHANGED) {
+				_resize_requested = true;
+			}
+		}
+
+		if (_resize_requested) {
+			resize_swapchain();
+		}
+
+		// Everything from here to the end of the iteration is the steady-state frame
+		alloc_tracker::begin_frame();
+
+		// Simulated time only depends on the frame index, so every run sees the same camera path
+		const float time = frame * scenario.timestep;
+		const CameraKeyframe key = scenario.sample(time);
+		if (use_ortho_camera) {
+			ortho_camera.position = key.position;
+			ortho_camera.pitch = key.pitch;
+			ortho_camera.yaw = key.yaw;
+			ortho_camera.scale = key.zoom;
+		} else {
+			main_camera.position = key.position;
+			main_camera.pitch = key.pitch;
+			main_camera.yaw = key.yaw;
+			main_camera.fov = key.zoom;
+		}
+
+		// Imgui still has to produce (empty) draw data for the overlay pass
+		ImGui_ImplVulkan_NewFrame();
+		ImGui_ImplSDL3_NewFrame();
+		ImGui::NewFrame();
+		ImGui::Render();
+
+		{
+			const auto update_start = std::chrono::steady_clock::now();
+			update_scene(scenario.timestep);
+			const auto update_end = std::chrono::steady_clock::now();
+			stats.scene_update_time =
+				std::chrono::duration_cast<std::chrono::microseconds>(update_end - update_start).count() / 1000.f;
+		}
+
+		draw();
+
+		const auto end = std::chrono::steady_clock::now();
+		stats.frametime = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.f;
+		stats.gpu_frame_time = _gpu_profiler.last_frame_ms();
+
+		_frame_stats.push(FrameStatsHistory::Sample{
+			stats.frametime,
+			stats.scene_update_time,
+			stats.mesh_draw_time,
+			stats.fence_wait_time,
+			stats.gpu_frame_time,
+		});
+
+		csv << std::format("{},{:.4f},{:.3f},{:.3f},{:.3f},{:.3f},{:.3f},{},{}\n",
+			frame, time, stats.frametime, stats.scene_update_time, stats.mesh_draw_time,
+			stats.fence_wait_time, stats.gpu_frame_time, stats.drawcall_count, stats.triangle_count);
+
+		alloc_tracker::end_frame();
+		profiler::end_frame();
+	}
+
+	std::print("Scenario finished, per-frame timings written to: {}\n", scenario.output_path.string());
+	for (uint32_t m = 0; m < FrameStatsHistory::metric_count; m++) {
+		const FrameStatsHistory::Summary summary = _frame_stats.summarize(FrameMetric(m), FrameStatsHistory::capacity);
+		std::print("{}: p50 {:.3f} ms, p95 {:.3f} ms, p99 {:.3f} ms, max {:.3f} ms\n",
+			frame_metric_name(FrameMetric(m)), summary.p50, summary.p95, summary.p99, summary.max);
+	}
 }
 
 void VkEngine::draw_imgui(VkCommandBuffer cmd, VkImageView target_image_view) {
@@ -1036,41 +1750,50 @@ void VkEngine::draw_imgui(VkCommandBuffer cmd, VkImageView target_image_view) {
 }
 
 void VkEngine::draw_geometry(VkCommandBuffer cmd) {
-	// sort the opaque surfaces by material and mesh
-    std::vector<uint32_t> opaque_draws;
-    opaque_draws.reserve(main_draw_context.opaque_surfaces.size());
-
-    for (int i = 0; i < main_draw_context.opaque_surfaces.size(); i++) {
-       if (is_visible(main_draw_context.opaque_surfaces[i], scene_data.view_proj)) {
-            opaque_draws.push_back(i);
-       }
-    }
+	PROFILE_SCOPE("draw_geometry");
+	ALLOC_SCOPE(DrawGeometry);
 
-    std::sort(opaque_draws.begin(), opaque_draws.end(), [&](const auto& iA, const auto& iB) {
-		const RenderObject& A = main_draw_context.opaque_surfaces[iA];
-		const RenderObject& B = main_draw_context.opaque_surfaces[iB];
-        if (A.material == B.material) {
-            return A.index_buffer < B.index_buffer;
+    // The map grid is always opaque. With the orthographic camera the visible tiles are the rectangle `ortho_tiles`,
+    // otherwise they are `_tile_visibility.opaque`
+    TileRange ortho_tiles {};
+
+    {
+        PROFILE_SCOPE("cull");
+
+        if (use_ortho_camera) {
+            // Looking straight at the grid, the visible tiles are a rectangle we can compute directly
+            ortho_tiles = map.visible_tiles(scene_data.view_proj);
         } else {
-            return A.material < B.material;
+            _tile_visibility.update(_tile_world, scene_data.view_proj, main_camera);
         }
-    });
 
-	// sort the transparent surfaces by distance to camera
-    std::vector<uint32_t> transparent_draws;
-    transparent_draws.reserve(main_draw_context.transparent_surfaces.size());
+        // NOTE: Culling and sorting are only redone when the camera moves or records are added/removed,
+        // while it is still just the records that moved are re-tested
+        _visibility.update(_render_world, scene_data.view_proj, main_camera);
+    }
+
+    // NOTE: Only changes index ranges, the culled and sorted order stays valid
+    _lods.select(_render_world, _visibility, scene_data.view, scene_data.proj, (float)_draw_extent.height);
+
+    const std::vector<uint32_t>& opaque_draws = _visibility.opaque;
+    const std::vector<uint32_t>& transparent_draws = _visibility.transparent;
 
-    for (int i = 0; i < main_draw_context.transparent_surfaces.size(); i++) {
-       if (is_visible(main_draw_context.transparent_surfaces[i], scene_data.view_proj)) {
-            transparent_draws.push_back(i);
-       }
+    // NOTE: The occlusion test relies on the reverse-Z depth of the perspective camera
+    const bool occlusion_culling = _occlusion_culling && !use_ortho_camera;
+    const uint32_t frame_index = _frame_number % FRAME_OVERLAP;
+    if (occlusion_culling) {
+        _occlusion.prepare(this, frame_index, _render_world, opaque_draws, transparent_draws);
+        _occlusion.record_early(this, cmd, frame_index, _depth_image, scene_data.view_proj);
+    }
+    // NOTE: The backface cone test takes the camera as a point, so it is left out for the orthographic camera
+    const bool cluster_culling = _cluster_culling && !use_ortho_camera;
+    if (cluster_culling) {
+        _clusters.prepare(this, frame_index, _render_world, opaque_draws);
+        _clusters.record(this, cmd, frame_index, 0, scene_data.view, scene_data.view_proj,
+            occlusion_culling ? _occlusion.early_commands(frame_index) : VK_NULL_HANDLE);
     }
 
-    std::sort(transparent_draws.begin(), transparent_draws.end(), [&](const auto& iA, const auto& iB) {
-		const RenderObject& A = main_draw_context.transparent_surfaces[iA];
-		const RenderObject& B = main_draw_context.transparent_surfaces[iB];
-		return distance_to_camera(A, main_camera) < distance_to_camera(B, main_camera);
-    });
+    PROFILE_SCOPE("record");
 
     //allocate a new uniform buffer for the scene data
     AllocatedBuffer gpu_scene_data_buffer =  create_buffer(sizeof(GPUSceneData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
@@ -1095,26 +1818,31 @@ void VkEngine::draw_geometry(VkCommandBuffer cmd) {
     MaterialInstance* last_material = nullptr;
     VkBuffer last_index_buffer = VK_NULL_HANDLE;
 
-    auto draw = [&](const RenderObject& r) {
-        if (r.material != last_material) {
-            last_material = r.material;
-            if (r.material->pipeline != last_pipeline) {
+    auto bind = [&](const RenderWorld& world, uint32_t i) {
+        MaterialInstance* material = world.materials[i];
+        const VkBuffer index_buffer = world.index_buffers[i];
+
+        if (material != last_material) {
+            last_material = material;
+            if (material->pipeline != last_pipeline) {
 
-                last_pipeline = r.material->pipeline;
-				if (draw_wireframe) {
-					vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, r.material->pipeline->wireframe_pipeline);
-				} else {
-					vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, r.material->pipeline->pipeline);
+                last_pipeline = material->pipeline;
+				vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+					material->pipeline->get(_device, _pipeline_cache, draw_wireframe));
+
+				material->pipeline->set_dynamic_state(cmd);
+				if (_dynamic_polygon_mode) {
+					_cmd_set_polygon_mode(cmd, draw_wireframe ? VK_POLYGON_MODE_LINE : VK_POLYGON_MODE_FILL);
 				}
                 
-                vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,r.material->pipeline->layout, 0, 1,
+                vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,material->pipeline->layout, 0, 1,
                     &global_descriptor, 0, nullptr);
 
 				VkViewport viewport = {};
 				viewport.x = 0;
 				viewport.y = 0;
-				viewport.width = (float)_window_extent.width;
-				viewport.height = (float)_window_extent.height;
+				viewport.width = (float)_draw_extent.width;
+				viewport.height = (float)_draw_extent.height;
 				viewport.minDepth = 0.f;
 				viewport.maxDepth = 1.f;
 
@@ -1123,72 +1851,242 @@ void VkEngine::draw_geometry(VkCommandBuffer cmd) {
 				VkRect2D scissor = {};
 				scissor.offset.x = 0;
 				scissor.offset.y = 0;
-				scissor.extent.width = _window_extent.width;
-				scissor.extent.height = _window_extent.height;
+				scissor.extent.width = _draw_extent.width;
+				scissor.extent.height = _draw_extent.height;
 
 				vkCmdSetScissor(cmd, 0, 1, &scissor);
             }
 
-            vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, r.material->pipeline->layout, 1, 1,
-                &r.material->material_set, 0, nullptr);
+            vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, material->pipeline->layout, 1, 1,
+                &material->material_set, 0, nullptr);
         }
-        if (r.index_buffer != last_index_buffer) {
-            vkCmdBindIndexBuffer(cmd, r.index_buffer, 0, VK_INDEX_TYPE_UINT32);
-			last_index_buffer = r.index_buffer;
+        if (index_buffer != last_index_buffer) {
+            vkCmdBindIndexBuffer(cmd, index_buffer, 0, VK_INDEX_TYPE_UINT32);
+			last_index_buffer = index_buffer;
         }
         // calculate final mesh matrix
         GPUDrawPushConstants push_constants;
-        push_constants.world_matrix = r.transform;
-        push_constants.vertex_buffer = r.vertex_buffer_address;
+        push_constants.world_matrix = world.transforms[i];
+        push_constants.vertex_buffer = world.vertex_buffer_addresses[i];
+
+        vkCmdPushConstants(cmd, material->pipeline->layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(GPUDrawPushConstants), &push_constants);
+    };
+
+    // With an indirect buffer the GPU decides whether the draw happens, from the command at `command`
+    auto draw = [&](const RenderWorld& world, uint32_t i, VkBuffer indirect_buffer = VK_NULL_HANDLE, uint32_t command = 0) {
+        const uint32_t index_count = world.index_counts[i];
+        bind(world, i);
+
+        stats.drawcall_count++;
+        stats.triangle_count += index_count / 3;
+        if (indirect_buffer != VK_NULL_HANDLE) {
+            vkCmdDrawIndexedIndirect(cmd, indirect_buffer, OcclusionCuller::command_offset(command), 1,
+                sizeof(VkDrawIndexedIndirectCommand));
+        } else {
+            vkCmdDrawIndexed(cmd, index_count, 1, world.first_indices[i], 0, 0);
+        }
+    };
+
+    // `opaque_draws[k]` in the given phase, as the meshlets the cluster pass left when it was split into them
+    auto draw_opaque = [&](uint32_t k, VkBuffer indirect_buffer, uint32_t phase) {
+        const uint32_t cluster_draw = cluster_culling ? _clusters.cluster_draw(k) : ClusterCuller::no_cluster_draw;
+        if (cluster_draw == ClusterCuller::no_cluster_draw) {
+            draw(_render_world, opaque_draws[k], indirect_buffer, k);
+            return;
+        }
 
-        vkCmdPushConstants(cmd, r.material->pipeline->layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(GPUDrawPushConstants), &push_constants);
+        const uint32_t i = opaque_draws[k];
+        bind(_render_world, i);
 
+        // NOTE: Counts the whole surface, the meshlets actually drawn are in the cluster stats
         stats.drawcall_count++;
-        stats.triangle_count += r.index_count / 3;
-        vkCmdDrawIndexed(cmd, r.index_count, 1, r.first_index, 0, 0);
+        stats.triangle_count += _render_world.index_counts[i] / 3;
+        _clusters.draw(cmd, frame_index, phase, cluster_draw);
     };
 
     stats.drawcall_count = 0;
     stats.triangle_count = 0;
 
-    for (auto& r : opaque_draws) {
-        draw(main_draw_context.opaque_surfaces[r]);
+	VkRenderingAttachmentInfo color_attachment = vkinit::attachment_info(
+		_draw_image.image_view, nullptr, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+	VkRenderingAttachmentInfo depth_attachment = vkinit::depth_attachment_info(
+		_depth_image.image_view, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+	VkRenderingInfo render_info = vkinit::rendering_info(_draw_extent, &color_attachment, &depth_attachment);
+
+	vkCmdBeginRendering(cmd, &render_info);
+
+    // With occlusion culling this is the early phase, only what was visible last frame is drawn
+    const VkBuffer early_commands = occlusion_culling ? _occlusion.early_commands(frame_index) : VK_NULL_HANDLE;
+    for (uint32_t k = 0; k < opaque_draws.size(); k++) {
+        draw_opaque(k, early_commands, 0);
+    }
+    // The map grid is always drawn, it is the biggest occluder
+    if (use_ortho_camera) {
+        for (int r = ortho_tiles.row_begin; r < ortho_tiles.row_end; r++) {
+            for (int c = ortho_tiles.col_begin; c < ortho_tiles.col_end; c++) {
+                draw(_tile_world, _tile_world.index(map.tile_handle(r, c)));
+            }
+        }
+    } else {
+        for (uint32_t i : _tile_visibility.opaque) {
+            draw(_tile_world, i);
+        }
     }
 
-    for (auto& r : transparent_draws) {
-        draw(main_draw_context.transparent_surfaces[r]);
+    const VkBuffer late_commands = occlusion_culling ? _occlusion.late_commands(frame_index) : VK_NULL_HANDLE;
+    if (occlusion_culling) {
+        vkCmdEndRendering(cmd);
+
+        vkutil::transition_image(cmd, _depth_image.image, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL);
+        _occlusion.record_late(this, cmd, frame_index, _depth_image, _draw_extent);
+        if (cluster_culling) {
+            _clusters.record(this, cmd, frame_index, 1, scene_data.view, scene_data.view_proj, late_commands);
+        }
+        vkutil::transition_image(cmd, _depth_image.image, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+
+        // Late phase, on top of what the early phase drew
+        depth_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+        vkCmdBeginRendering(cmd, &render_info);
+        last_pipeline = nullptr;
+        last_material = nullptr;
+        last_index_buffer = VK_NULL_HANDLE;
+
+        for (uint32_t k = 0; k < opaque_draws.size(); k++) {
+            draw_opaque(k, late_commands, 1);
+        }
     }
 
-    // We delete the draw commands now that we processed them
-    main_draw_context.opaque_surfaces.clear();
-    main_draw_context.transparent_surfaces.clear();
+    // The background goes after the opaque surfaces so it only fills the pixels they left empty,
+    // and before the transparent ones so they blend on top of it
+    draw_background_composite(cmd);
+    last_pipeline = nullptr;
+    last_material = nullptr;
+
+    // Transparent draws don't occlude anything, they are only tested in the late phase
+    const uint32_t first_transparent = static_cast<uint32_t>(opaque_draws.size());
+    for (uint32_t k = 0; k < transparent_draws.size(); k++) {
+        draw(_render_world, transparent_draws[k], late_commands, first_transparent + k);
+    }
+
+    vkCmdEndRendering(cmd);
 }
 
 void VkEngine::draw_background(VkCommandBuffer cmd) {
     ComputeEffect& effect = _compute_effects[_current_compute_effect];
 
+    const VkExtent2D background_extent = {
+        std::max(1u, static_cast<uint32_t>(_draw_extent.width * _background_scale)),
+        std::max(1u, static_cast<uint32_t>(_draw_extent.height * _background_scale))
+    };
+
+    // The background is cached across frames, we only run the compute effect again when something it depends on changed
+    const bool cache_valid = _background_cache.valid
+        && _background_cache.effect_index == _current_compute_effect
+        && memcmp(&_background_cache.data, &effect.data, sizeof(ComputePushConstants)) == 0
+        && _background_cache.view_proj == scene_data.view_proj
+        && _background_cache.extent.width == background_extent.width
+        && _background_cache.extent.height == background_extent.height;
+    stats.background_redrawn = !cache_valid;
+    if (cache_valid) {
+        return;
+    }
+
+    if (_background_image.image == VK_NULL_HANDLE ||
+        _background_image.image_extent.width != background_extent.width ||
+        _background_image.image_extent.height != background_extent.height) {
+        if (_background_image.image != VK_NULL_HANDLE) {
+            // The previous frame may still be sampling it
+            const AllocatedImage old_background_image = _background_image;
+            get_current_frame()._deletion_queue.push_function([=, this]() {
+                destroy_image(old_background_image);
+            });
+        }
+
+        // NOTE: Only happens on resize or when changing the scale, and the image is a fraction of the window size
+        _background_image = create_image(
+            VkExtent3D{ background_extent.width, background_extent.height, 1 },
+            VK_FORMAT_R16G16B16A16_SFLOAT,
+            VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT
+        );
+    }
+
+    VkDescriptorSet background_descriptors =
+        get_current_frame()._frame_descriptors.allocate(_device, _background_image_descriptor_layout);
+    {
+        DescriptorWriter writer;
+        writer.write_image(0, _background_image.image_view, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+        writer.update_set(_device, background_descriptors);
+    }
+
+    vkutil::transition_image(cmd, _background_image.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+
     vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, effect.pipeline);
-    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, effect.layout, 0, 1, &_draw_image_descriptors, 0, nullptr);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, effect.layout, 0, 1, &background_descriptors, 0, nullptr);
 
     vkCmdPushConstants(cmd, effect.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ComputePushConstants), &effect.data);
 
     // Divide image extent by compute shader block size
-    vkCmdDispatch(cmd, std::ceil(_draw_extent.width / 16.0), std::ceil(_draw_extent.height / 16.0), 1);
+    vkCmdDispatch(cmd, std::ceil(background_extent.width / 16.0), std::ceil(background_extent.height / 16.0), 1);
+
+    vkutil::transition_image(cmd, _background_image.image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+    _background_cache.valid = true;
+    _background_cache.effect_index = _current_compute_effect;
+    _background_cache.data = effect.data;
+    _background_cache.view_proj = scene_data.view_proj;
+    _background_cache.extent = background_extent;
+}
+
+void VkEngine::draw_background_composite(VkCommandBuffer cmd) {
+    VkDescriptorSet background_descriptors =
+        get_current_frame()._frame_descriptors.allocate(_device, _background_sampler_descriptor_layout);
+    {
+        DescriptorWriter writer;
+        writer.write_image(0, _background_image.image_view, _default_images._sampler_linear,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+        writer.update_set(_device, background_descriptors);
+    }
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _background_composite_pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _background_composite_layout, 0, 1,
+        &background_descriptors, 0, nullptr);
+
+	VkViewport viewport = {};
+	viewport.x = 0;
+	viewport.y = 0;
+	viewport.width = (float)_draw_extent.width;
+	viewport.height = (float)_draw_extent.height;
+	viewport.minDepth = 0.f;
+	viewport.maxDepth = 1.f;
+
+	vkCmdSetViewport(cmd, 0, 1, &viewport);
+
+	VkRect2D scissor = {};
+	scissor.offset.x = 0;
+	scissor.offset.y = 0;
+	scissor.extent.width = _draw_extent.width;
+	scissor.extent.height = _draw_extent.height;
+
+	vkCmdSetScissor(cmd, 0, 1, &scissor);
+
+    vkCmdDraw(cmd, 3, 1, 0, 0);
 }
 
 void VkEngine::draw_main(VkCommandBuffer cmd) {
-	draw_background(cmd);
+	const uint32_t frame_index = _frame_number % FRAME_OVERLAP;
 
-    vkutil::transition_image(cmd, _draw_image.image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+	_gpu_profiler.begin_pass(cmd, frame_index, GpuPass::Background);
+	draw_background(cmd);
+	_gpu_profiler.end_pass(cmd, frame_index, GpuPass::Background);
 
-	VkRenderingAttachmentInfo color_attachment = vkinit::attachment_info(
-		_draw_image.image_view, nullptr, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-	VkRenderingAttachmentInfo depth_attachment = vkinit::depth_attachment_info(
-		_depth_image.image_view, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
-	VkRenderingInfo renderInfo = vkinit::rendering_info(_window_extent, &color_attachment, &depth_attachment);
+    // NOTE: Every pixel of the draw extent is written either by geometry or by the background composite,
+    // so the previous contents can be discarded
+    vkutil::transition_image(cmd, _draw_image.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
 
-	vkCmdBeginRendering(cmd, &renderInfo);
+	_gpu_profiler.begin_pass(cmd, frame_index, GpuPass::Geometry);
+	_gpu_profiler.begin_statistics(cmd, frame_index);
 
+	// NOTE: Begins and ends its own rendering, occlusion culling splits it around compute passes
 	auto start = std::chrono::system_clock::now();
 	draw_geometry(cmd);
 	auto end = std::chrono::system_clock::now();
@@ -1197,19 +2095,44 @@ void VkEngine::draw_main(VkCommandBuffer cmd) {
 
 	stats.mesh_draw_time = elapsed.count() / 1000.f;
 
-	vkCmdEndRendering(cmd);
+	_gpu_profiler.end_statistics(cmd, frame_index);
+	_gpu_profiler.end_pass(cmd, frame_index, GpuPass::Geometry);
 }
 
 void VkEngine::draw() {
+	PROFILE_SCOPE("draw");
+
     // Wait until the gpu has finished rendering the last frame on the current index
-	VK_CHECK(
-		vkWaitForFences(_device, 1, &get_current_frame()._render_fence, true, seconds_to_nanoseconds(1)));
+	{
+		PROFILE_SCOPE("wait_fence");
+		const auto wait_start = std::chrono::steady_clock::now();
+		VK_CHECK(
+			vkWaitForFences(_device, 1, &get_current_frame()._render_fence, true, seconds_to_nanoseconds(1)));
+		const auto wait_end = std::chrono::steady_clock::now();
+		stats.fence_wait_time =
+			std::chrono::duration_cast<std::chrono::microseconds>(wait_end - wait_start).count() / 1000.f;
+	}
+
+    const uint32_t frame_index = _frame_number % FRAME_OVERLAP;
 
     get_current_frame()._deletion_queue.flush();
     get_current_frame()._frame_descriptors.clear_pools(_device);
 
+    // The GPU is done with this frame slot, so its queries can be read back
+    _gpu_profiler.collect(_device, frame_index);
+    if (_sampler_filter_minmax) {
+        _occlusion.collect(this, frame_index);
+    }
+    if (_draw_indirect_count) {
+        _clusters.collect(this, frame_index);
+    }
+
 	uint32_t swapchain_image_index;
-    const VkResult e = vkAcquireNextImageKHR(_device, _swapchain, seconds_to_nanoseconds(1), get_current_frame()._swapchain_ready_semaphore, nullptr, &swapchain_image_index);
+    VkResult e;
+	{
+		PROFILE_SCOPE("acquire");
+		e = vkAcquireNextImageKHR(_device, _swapchain, seconds_to_nanoseconds(1), get_current_frame()._swapchain_ready_semaphore, nullptr, &swapchain_image_index);
+	}
 	if (e == VK_ERROR_OUT_OF_DATE_KHR) {
         _resize_requested = true;
 		return;
@@ -1225,42 +2148,47 @@ void VkEngine::draw() {
 
     // Reset and start command buffer
 	VkCommandBuffer cmd = get_current_frame()._main_command_buffer;
-	VK_CHECK(vkResetCommandBuffer(cmd, 0));
+	{
+		PROFILE_SCOPE("record_commands");
 
-	VkCommandBufferBeginInfo cmd_begin_info = vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
-	VK_CHECK(vkBeginCommandBuffer(cmd, &cmd_begin_info));
+		VK_CHECK(vkResetCommandBuffer(cmd, 0));
 
-    // Make draw and depth image ready to be used as attachments
-    vkutil::transition_image(cmd, _draw_image.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
-    vkutil::transition_image(cmd, _depth_image.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+		VkCommandBufferBeginInfo cmd_begin_info = vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+		VK_CHECK(vkBeginCommandBuffer(cmd, &cmd_begin_info));
 
-    draw_main(cmd);
+	    _gpu_profiler.reset(cmd, frame_index);
 
-	// Transtion the draw image and the swapchain image into their correct transfer layouts
-	vkutil::transition_image(cmd, _draw_image.image, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
-	vkutil::transition_image(cmd, _swapchain_images[swapchain_image_index], VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+	    // Make depth image ready to be used as an attachment
+	    vkutil::transition_image(cmd, _depth_image.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
 
-	VkExtent2D extent;
-	extent.height = _window_extent.height;
-	extent.width = _window_extent.width;
+	    draw_main(cmd);
 
-	// Execute a copy from the draw image into the swapchain
-    vkutil::copy_image_to_image(
-		cmd, _draw_image.image, _swapchain_images[swapchain_image_index], _draw_extent, _swapchain_extent);
+		// Transtion the draw image and the swapchain image into their correct transfer layouts
+		vkutil::transition_image(cmd, _draw_image.image, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+		vkutil::transition_image(cmd, _swapchain_images[swapchain_image_index], VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
 
-	// Set swapchain image layout to Attachment Optimal so we can draw it
-	vkutil::transition_image(
-		cmd, _swapchain_images[swapchain_image_index], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+		// Execute a copy from the draw image into the swapchain
+		_gpu_profiler.begin_pass(cmd, frame_index, GpuPass::Blit);
+	    vkutil::copy_image_to_image(
+			cmd, _draw_image.image, _swapchain_images[swapchain_image_index], _draw_extent, _swapchain_extent);
+		_gpu_profiler.end_pass(cmd, frame_index, GpuPass::Blit);
 
-	// Draw imgui into the swapchain image
-	draw_imgui(cmd, _swapchain_image_views[swapchain_image_index]);
+		// Set swapchain image layout to Attachment Optimal so we can draw it
+		vkutil::transition_image(
+			cmd, _swapchain_images[swapchain_image_index], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
 
-	// Set swapchain image layout to Present so we can draw it
-	vkutil::transition_image(
-		cmd, _swapchain_images[swapchain_image_index], VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+		// Draw imgui into the swapchain image
+		_gpu_profiler.begin_pass(cmd, frame_index, GpuPass::Imgui);
+		draw_imgui(cmd, _swapchain_image_views[swapchain_image_index]);
+		_gpu_profiler.end_pass(cmd, frame_index, GpuPass::Imgui);
 
-	//finalize the command buffer (we can no longer add commands, but it can now be executed)
-	VK_CHECK(vkEndCommandBuffer(cmd));
+		// Set swapchain image layout to Present so we can draw it
+		vkutil::transition_image(
+			cmd, _swapchain_images[swapchain_image_index], VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+
+		//finalize the command buffer (we can no longer add commands, but it can now be executed)
+		VK_CHECK(vkEndCommandBuffer(cmd));
+	}
 
 	//prepare the submission to the queue. 
 	//we want to wait on the _presentSemaphore, as that semaphore is signaled when the swapchain is ready
@@ -1274,7 +2202,10 @@ void VkEngine::draw() {
 
 	// Submit command buffer to the queue and execute it.
 	// _render_fence will now block until the graphic commands finish execution
-	VK_CHECK(vkQueueSubmit2(_graphics_queue, 1, &submit, get_current_frame()._render_fence));
+	{
+		PROFILE_SCOPE("submit");
+		VK_CHECK(vkQueueSubmit2(_graphics_queue, 1, &submit, get_current_frame()._render_fence));
+	}
 
 	// Prepare present
 	// this will put the image we just rendered to into the visible window.
@@ -1287,11 +2218,20 @@ void VkEngine::draw() {
 	present_info.waitSemaphoreCount = 1;
 	present_info.pImageIndices = &swapchain_image_index;
 
-	VkResult present_result = vkQueuePresentKHR(_graphics_queue, &present_info);
-	if (e == VK_ERROR_OUT_OF_DATE_KHR) {
-        _resize_requested = true;
-        return;
+	VkResult present_result;
+	{
+		PROFILE_SCOPE("present");
+		present_result = vkQueuePresentKHR(_graphics_queue, &present_info);
 	}
 
 	_frame_number++;
+
+	if (_first_frame_ms == 0.f) {
+		_first_frame_ms = (profiler::now_ns() - _init_start_ns) / 1000000.f;
+		std::print("Cold start to first frame: {:.2f} ms\n", _first_frame_ms);
+	}
+
+	if (present_result == VK_ERROR_OUT_OF_DATE_KHR || present_result == VK_SUBOPTIMAL_KHR) {
+        _resize_requested = true;
+	}
 }
\ No newline at end of file
@@ -5,14 +5,25 @@
 #include <deque>
 #include <functional>
 #include <span>
+#include <mutex>
 
 #include "vk_types.h"
 #include "vk_descriptors.h"
 #include "vk_material.h"
 #include "vk_gltf_material.h"
 #include "vk_renderable.h"
+#include "vk_visibility_cache.h"
+#include "vk_occlusion.h"
+#include "vk_lod.h"
+#include "vk_cluster_cull.h"
+#include "vk_gpu_profiler.h"
 #include "camera.h"
 
+#include "../profiler/frame_stats.h"
+#include "../profiler/alloc_tracker.h"
+#include "../core/worker_pool.h"
+#include "../scenario/scenario.h"
+
 #include "../geometry/cube.h"
 #include "../map_editor/map.h"
 
@@ -39,6 +50,8 @@ enum class EngineInitError {
     Vk_CreateSemaphoreFailed,
     Vk_CreateDrawImageFailed,
     Vk_CreateDrawImageViewFailed,
+    Vk_CreateDepthImageFailed,
+    Vk_CreateDepthImageViewFailed,
 };
 
 enum class EngineRunError {
@@ -76,16 +89,30 @@ struct ComputeEffect {
 	ComputePushConstants data;
 };
 
+// Everything the background compute effect depends on, it is only re-rendered when one of these changes
+struct BackgroundCache {
+    bool valid = false;
+    int effect_index = -1;
+    ComputePushConstants data;
+    glm::mat4 view_proj;
+    VkExtent2D extent;
+};
+
 struct DeletionQueue
 {
     // TODO: Better implementation would store arrays of vulkan handles of various types such as VkImage/VkBuffer/etc
 	std::deque<std::function<void()>> deletors;
+	// NOTE: Init tasks run on worker threads and push to the main deletion queue concurrently
+	std::mutex mutex;
 
 	void push_function(std::function<void()>&& function) {
+		ALLOC_SCOPE(DeletionQueue);
+		std::lock_guard<std::mutex> lock(mutex);
 		deletors.push_back(function);
 	}
 
 	void flush() {
+		std::lock_guard<std::mutex> lock(mutex);
 		// Delete in FILO order
 		for (auto it = deletors.rbegin(); it != deletors.rend(); it++) {
 			(*it)();
@@ -117,46 +144,93 @@ struct DefaultImages {
 	VkSampler _sampler_nearest;
 };
 
+// One step of `VkEngine::init`, times are relative to the start of init
+struct InitPhase {
+    const char* name;
+    float start_ms;
+    float duration_ms;
+    bool main_thread;
+};
+
 struct EngineStats {
     float frametime;
     int triangle_count;
     int drawcall_count;
     float scene_update_time;
     float mesh_draw_time;
+    float fence_wait_time;
+    float gpu_frame_time;
+    bool background_redrawn;
+};
+
+// One mesh of a batched upload, its vertices, indices and meshlets are ranges of the arrays given to `upload_meshes`.
+// Indices are relative to the mesh's first vertex
+struct MeshUpload {
+    uint32_t first_vertex;
+    uint32_t vertex_count;
+    uint32_t first_index;
+    uint32_t index_count;
+    uint32_t first_meshlet = 0;
+    uint32_t meshlet_count = 0;
+};
+
+// One image of a batched upload, its pixels are already in the staging buffer at `staging_offset`
+struct ImageUpload {
+    VkExtent3D size;
+    VkFormat format;
+    VkImageUsageFlags usage;
+    bool mip_mapped;
+    VkDeviceSize staging_offset;
+    // Levels in the staging buffer, tightly packed level 0 first. With more than one the full chain must be there
+    // and mipmaps are not generated, which is also the only way to get mips for block compressed formats
+    uint32_t staged_mips = 1;
 };
 
 struct VkEngine {
 
-    std::optional<EngineInitError> init();
+    std::optional<EngineInitError> init(const std::filesystem::path& map_path = "../maps/test_map.tdm");
     void run();
+    // Plays a scenario at a fixed timestep without user input, writing per-frame timings to its output CSV
+    void run_scenario(const Scenario& scenario);
     void cleanup();
 
     VkDevice vk_device() { return _device; }
     
-    GPUMeshBuffers upload_mesh(std::span<uint32_t> indices, std::span<Vertex> vertices);
+    GPUMeshBuffers upload_mesh(std::span<const uint32_t> indices, std::span<const Vertex> vertices);
+    // Uploads every mesh through one staging buffer and a single immediate submit
+    std::vector<GPUMeshBuffers> upload_meshes(std::span<const uint32_t> indices, std::span<const Vertex> vertices,
+        std::span<const MeshUpload> meshes, std::span<const Meshlet> meshlets = {});
 
     AllocatedImage create_image(VkExtent3D size, VkFormat format, VkImageUsageFlags usage, bool mip_mapped = false);
     AllocatedImage create_image(void* data, VkExtent3D size, VkFormat format, VkImageUsageFlags usage, bool mip_mapped = false);
+    // Creates every image and fills it from `staging` with a single immediate submit
+    std::vector<AllocatedImage> create_images(const AllocatedBuffer& staging, std::span<const ImageUpload> uploads);
     void destroy_image(const AllocatedImage& img);
+    // Optimal tiling images of `format` can be sampled with linear filtering and filled by copies
+    bool supports_sampled_format(VkFormat format) const;
 
     void destroy_buffer(const AllocatedBuffer& buffer);
 
 private:
-    std::optional<EngineInitError> create_swapchain(uint32_t width, uint32_t height);
+    std::optional<EngineInitError> create_swapchain(uint32_t width, uint32_t height, VkSwapchainKHR old_swapchain = VK_NULL_HANDLE);
     void resize_swapchain();
     void destroy_swapchain();
 
+    std::optional<EngineInitError> create_render_targets(VkExtent2D extent);
+
     std::optional<EngineInitError> init_vulkan();
+    void init_pipeline_cache();
 	std::optional<EngineInitError> init_swapchain();
 	std::optional<EngineInitError> init_commands();
 	std::optional<EngineInitError> init_sync_structures();
     void init_descriptors();
-    void init_pipelines();
 	void init_background_pipelines();
     void init_imgui();
+    void print_init_phases() const;
 
     void draw_imgui(VkCommandBuffer cmd, VkImageView target_image_view);
     void draw_background(VkCommandBuffer cmd);
+    void draw_background_composite(VkCommandBuffer cmd);
     void draw_geometry(VkCommandBuffer cmd);
 
     void draw_main(VkCommandBuffer cmd);
@@ -166,20 +240,31 @@ private:
         return _frames[_frame_number % FRAME_OVERLAP];
     };
 
+    // The last frame that was submitted, its deletion queue is only flushed once the GPU is done with it
+    FrameData& get_last_frame() {
+        return _frames[(_frame_number + FRAME_OVERLAP - 1) % FRAME_OVERLAP];
+    };
+
     void immediate_submit(std::function<void(VkCommandBuffer cmd)>&& function);
     AllocatedBuffer create_buffer(size_t alloc_size, VkBufferUsageFlags usage, VmaMemoryUsage memory_usage);
 
-    void init_default_data();
-    void init_default_meshes();
+    void init_default_meshes(const MapLayout& map_layout);
     void init_default_textures();
     void init_default_material();
     void init_camera();
 
-    void update_scene();
+    void update_scene(float dt);
+    // Casts a ray through the window pixel into `_render_world`
+    void pick(float x, float y);
 
 private:
     // Engine Data
     bool _is_initialized = false;
+    uint64_t _init_start_ns = 0;
+    std::vector<InitPhase> _init_phases;
+    // Runs the init task graph and the parallel parts of glTF loading
+    WorkerPool _workers;
+    float _first_frame_ms = 0.f;
     uint64_t _frame_number = 0;
     bool _stop_rendering = false;
 
@@ -194,7 +279,7 @@ private:
     VmaAllocator _allocator;
 
     // Vulkan Swapchain Data
-    bool _resize_requested;
+    bool _resize_requested = false;
     VkSwapchainKHR _swapchain;
 	VkFormat _swapchain_image_format;
 	std::vector<VkImage> _swapchain_images;
@@ -209,21 +294,56 @@ private:
     // Descriptor data
     DescriptorAllocator _global_descriptor_allocator;
 
-	VkDescriptorSet _draw_image_descriptors;
-	VkDescriptorSetLayout _draw_image_descriptor_layout;
+	VkDescriptorSetLayout _background_image_descriptor_layout;
+	VkDescriptorSetLayout _background_sampler_descriptor_layout;
 
     GPUSceneData scene_data;
     VkDescriptorSetLayout _gpu_scene_data_descriptor_layout;
 
     // Pipeline data
+    bool _dynamic_polygon_mode = false;
+    PFN_vkCmdSetPolygonModeEXT _cmd_set_polygon_mode = nullptr;
+    // BC1-BC7 images, glTF textures fall back to uncompressed RGBA8 without it
+    bool _texture_compression_bc = false;
+    // Pipeline statistics queries, the GPU profiler only records timestamps without them
+    bool _pipeline_statistics = false;
+    // MIN reduction sampling, the occlusion culler is never created without it
+    bool _sampler_filter_minmax = false;
+    // Indirect draws with a GPU written count, meshes are drawn per surface without it
+    bool _draw_indirect_count = false;
+    // NOTE: Used for every pipeline we create, persisted to disk so warm starts skip shader compilation
+    VkPipelineCache _pipeline_cache = VK_NULL_HANDLE;
     std::vector<ComputeEffect> _compute_effects;
     int _current_compute_effect{0};
 
+    // Background data
+    AllocatedImage _background_image{};
+    float _background_scale = 0.5f;
+    BackgroundCache _background_cache;
+    VkPipeline _background_composite_pipeline;
+    VkPipelineLayout _background_composite_layout;
+
     // Mesh data
+    // NOTE: Declared before anything holding nodes, so it is destroyed after them
+    TransformHierarchy _transforms;
+    RenderWorld _render_world;
+    // The map grid, culled by tile range with the orthographic camera
+    RenderWorld _tile_world;
+    VisibilityCache _visibility;
+    VisibilityCache _tile_visibility;
+    // Hi-Z culling of `_render_world` with the perspective camera
+    OcclusionCuller _occlusion;
+    bool _occlusion_culling = true;
+    // Levels of detail of the visible `_render_world` records
+    LodSelector _lods;
+    // Per meshlet culling of the full detail opaque `_render_world` records
+    ClusterCuller _clusters;
+    bool _cluster_culling = true;
+    std::filesystem::path _map_path;
     std::unordered_map<std::string, std::shared_ptr<LoadedGLTF>> loaded_scenes;
     Map map;
-
-    DrawContext main_draw_context;
+    // Handle id of the surface last clicked on, see `pick`
+    std::optional<RayHit> _picked;
 
     // Immediate submit data
     VkFence _imm_fence;
@@ -236,9 +356,9 @@ private:
     // Material data
     MaterialInstance default_data;
     GLTFMetallic_Roughness metal_rough_material;
-    FlatColorMaterial flat_color_material;
 
     // Draw data
+    // NOTE: The draw and depth images may be larger than the window, `_draw_extent` is the region we render to
 	AllocatedImage _draw_image;
     AllocatedImage _depth_image;
 	VkExtent2D _draw_extent;
@@ -252,6 +372,10 @@ private:
     DeletionQueue _main_deletion_queue;
 
     EngineStats stats;
+    GpuProfiler _gpu_profiler;
+    FrameStatsHistory _frame_stats;
+    int _stats_window = 600;
+    std::vector<float> _stats_plot_samples;
 
     bool use_ortho_camera = true;
     PerspectiveCamera main_camera;
@@ -259,9 +383,10 @@ private:
 
     // TODO: Too many friend classes
     friend class GLTFMetallic_Roughness;
-    friend class FlatColorMaterial;
     friend class LoadedGLTF;
     friend class Cube;
+    friend struct OcclusionCuller;
+    friend struct ClusterCuller;
 };
 
 // TODO: Instead of all the optional stuff that is vbloating the code, just print an error and abort,
@@ -3,18 +3,21 @@
 #include "vk_initializers.h"
 #include "vk_engine.h"
 
+#include "shaders/mesh_gltf.frag.spv.h"
+#include "shaders/mesh_gltf.vert.spv.h"
+
 #include <print>
+#include <array>
 
 void GLTFMetallic_Roughness::build_pipelines(VkEngine* engine)
 {
     // Load shaders
-	VkShaderModule mesh_frag_shader;
-	if (!vkutil::load_shader_module("../shaders/mesh_gltf.frag.spv", engine->_device, &mesh_frag_shader)) {
+	// NOTE: Kept alive until `clear_resources`, variants are compiled on demand
+	if (!vkutil::load_shader_module(shaders::mesh_gltf_frag, engine->_device, &fragment_shader)) {
 		std::println("Error when building the triangle fragment shader module");
 	}
 
-	VkShaderModule mesh_vertex_shader;
-	if (!vkutil::load_shader_module("../shaders/mesh_gltf.vert.spv", engine->_device, &mesh_vertex_shader)) {
+	if (!vkutil::load_shader_module(shaders::mesh_gltf_vert, engine->_device, &vertex_shader)) {
 		std::println("Error when building the triangle vertex shader module");
 	}
 
@@ -36,163 +39,99 @@ void GLTFMetallic_Roughness::build_pipelines(VkEngine* engine)
         material_layout
     };
 
-    // Create pipeline and pipeline layout
+    // Create pipeline layout, shared by every variant
 	VkPipelineLayoutCreateInfo mesh_layout_info = vkinit::pipeline_layout_create_info();
 	mesh_layout_info.setLayoutCount = 2;
 	mesh_layout_info.pSetLayouts = layouts;
 	mesh_layout_info.pPushConstantRanges = &matrix_range;
 	mesh_layout_info.pushConstantRangeCount = 1;
 
-	VkPipelineLayout new_layout;
-	VK_CHECK(vkCreatePipelineLayout(engine->_device, &mesh_layout_info, nullptr, &new_layout));
-
-    opaque_pipeline.layout = new_layout;
-    transparent_pipeline.layout = new_layout;
-
-	PipelineBuilder pipeline_builder;
-	pipeline_builder.set_shaders(mesh_vertex_shader, mesh_frag_shader);
-	pipeline_builder.set_input_topology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
-	pipeline_builder.set_polygon_mode(VK_POLYGON_MODE_FILL);
-	pipeline_builder.set_cull_mode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
-	pipeline_builder.set_multisampling_none();
-	pipeline_builder.disable_blending();
-	pipeline_builder.enable_depthtest(true, VK_COMPARE_OP_GREATER_OR_EQUAL);
-	pipeline_builder.set_color_attachment_format(engine->_draw_image.image_format);
-	pipeline_builder.set_depth_format(engine->_depth_image.image_format);
+	VK_CHECK(vkCreatePipelineLayout(engine->_device, &mesh_layout_info, nullptr, &layout));
+
+	base_builder.set_shaders(vertex_shader, fragment_shader);
+	base_builder.set_input_topology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+	base_builder.set_polygon_mode(VK_POLYGON_MODE_FILL);
+	base_builder.set_cull_mode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
+	base_builder.set_multisampling_none();
+	base_builder.disable_blending();
+	base_builder.enable_depthtest(true, VK_COMPARE_OP_GREATER_OR_EQUAL);
+	base_builder.set_color_attachment_format(engine->_draw_image.image_format);
+	base_builder.set_depth_format(engine->_depth_image.image_format);
 	
-	pipeline_builder._pipeline_layout = new_layout;
-
-    opaque_pipeline.pipeline = pipeline_builder.build_pipeline(engine->_device);
-	// TODO: cleanup wireframe stuff
-	pipeline_builder.set_polygon_mode(VK_POLYGON_MODE_LINE);
-	opaque_pipeline.wireframe_pipeline = pipeline_builder.build_pipeline(engine->_device);
-	pipeline_builder.set_polygon_mode(VK_POLYGON_MODE_FILL);
-
-	// transparent pipeline variant
-	pipeline_builder.enable_blending_additive();
-	pipeline_builder.enable_depthtest(false, VK_COMPARE_OP_GREATER_OR_EQUAL);
-    
-	transparent_pipeline.pipeline = pipeline_builder.build_pipeline(engine->_device);
-	// TODO: cleanup wireframe stuff
-	pipeline_builder.set_polygon_mode(VK_POLYGON_MODE_LINE);
-	transparent_pipeline.wireframe_pipeline = pipeline_builder.build_pipeline(engine->_device);
-
-    // Cleanup
-	vkDestroyShaderModule(engine->_device, mesh_frag_shader, nullptr);
-	vkDestroyShaderModule(engine->_device, mesh_vertex_shader, nullptr);
-}
-
-MaterialInstance GLTFMetallic_Roughness::write_material(VkDevice device, MaterialPass pass, const MaterialResources& resources, DescriptorAllocator& descriptor_allocator)
-{
-	MaterialInstance mat_data;
-	mat_data.pass_type = pass;
-	if (pass == MaterialPass::Transparent) {
-		mat_data.pipeline = &transparent_pipeline;
-	}
-	else {
-		mat_data.pipeline = &opaque_pipeline;
-	}
-
-	mat_data.material_set = descriptor_allocator.allocate(device, material_layout);
-
-
-	writer.clear();
-	writer.write_buffer(0, resources.data_buffer, sizeof(MaterialConstants), resources.data_buffer_offset, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-	writer.write_image(1, resources.color_image.image_view, resources.color_sampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-	writer.write_image(2, resources.metal_rough_image.image_view, resources.metal_rough_sampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-
-	writer.update_set(device, mat_data.material_set);
+	base_builder._pipeline_layout = layout;
+	pipeline_cache = engine->_pipeline_cache;
+	base_builder.enable_dynamic_raster_state(engine->_dynamic_polygon_mode);
 
-	return mat_data;
+	// The variants nearly everything uses, so the first frame does not stall on them
+	get_variant(engine->_device, MATERIAL_FEATURE_TEXTURED_BIT | MATERIAL_FEATURE_LIT_BIT);
+	get_variant(engine->_device, MATERIAL_FEATURE_DOUBLE_SIDED_BIT);
 }
 
-void GLTFMetallic_Roughness::clear_resources(VkDevice device)
+MaterialPipeline* GLTFMetallic_Roughness::get_variant(VkDevice device, MaterialFeatures features)
 {
-	vkDestroyDescriptorSetLayout(device, material_layout,nullptr);
-	transparent_pipeline.destroy(device);
-	opaque_pipeline.destroy(device, false);
-}
+	std::lock_guard<std::mutex> lock(variants_mutex);
 
-void FlatColorMaterial::build_pipelines(VkEngine* engine) {
-	    // Load shaders
-	VkShaderModule mesh_frag_shader;
-	if (!vkutil::load_shader_module("../shaders/flat_color.frag.spv", engine->_device, &mesh_frag_shader)) {
-		std::println("Error when building the triangle fragment shader module");
+	std::unique_ptr<MaterialPipeline>& variant = variants[features];
+	if (variant) {
+		return variant.get();
 	}
 
-	VkShaderModule mesh_vertex_shader;
-	if (!vkutil::load_shader_module("../shaders/flat_color.vert.spv", engine->_device, &mesh_vertex_shader)) {
-		std::println("Error when building the triangle vertex shader module");
+	std::array<uint32_t, MATERIAL_FEATURE_COUNT> constants;
+	for (uint32_t i = 0; i < MATERIAL_FEATURE_COUNT; i++) {
+		constants[i] = (features >> i) & 1;
 	}
 
-    // Create descriptor set layout
-	VkPushConstantRange matrix_range{};
-	matrix_range.offset = 0;
-	matrix_range.size = sizeof(GPUDrawPushConstants);
-	matrix_range.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-
-    DescriptorLayoutBuilder layout_builder;
-    layout_builder.add_binding(0,VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-
-    material_layout = layout_builder.build(engine->_device, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
-
-	const VkDescriptorSetLayout layouts[] = { 
-        engine->_gpu_scene_data_descriptor_layout,
-        material_layout
-    };
-
-    // Create pipeline and pipeline layout
-	VkPipelineLayoutCreateInfo mesh_layout_info = vkinit::pipeline_layout_create_info();
-	mesh_layout_info.setLayoutCount = 2;
-	mesh_layout_info.pSetLayouts = layouts;
-	mesh_layout_info.pPushConstantRanges = &matrix_range;
-	mesh_layout_info.pushConstantRangeCount = 1;
-
-	VkPipelineLayout new_layout;
-	VK_CHECK(vkCreatePipelineLayout(engine->_device, &mesh_layout_info, nullptr, &new_layout));
-
-    pipeline.layout = new_layout;
-
-	PipelineBuilder pipeline_builder;
-	pipeline_builder.set_shaders(mesh_vertex_shader, mesh_frag_shader);
-	pipeline_builder.set_input_topology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
-	pipeline_builder.set_polygon_mode(VK_POLYGON_MODE_FILL);
-	pipeline_builder.set_cull_mode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
-	pipeline_builder.set_multisampling_none();
-	pipeline_builder.disable_blending();
-	pipeline_builder.enable_depthtest(true, VK_COMPARE_OP_GREATER_OR_EQUAL);
-	pipeline_builder.set_color_attachment_format(engine->_draw_image.image_format);
-	pipeline_builder.set_depth_format(engine->_depth_image.image_format);
-	
-	pipeline_builder._pipeline_layout = new_layout;
+	PipelineBuilder pipeline_builder = base_builder;
+	pipeline_builder.set_fragment_constants(constants);
+	// Front faces are clockwise on screen, the projection flips Y
+	if (!(features & MATERIAL_FEATURE_DOUBLE_SIDED_BIT)) {
+		pipeline_builder.set_cull_mode(VK_CULL_MODE_BACK_BIT, VK_FRONT_FACE_CLOCKWISE);
+	}
+	// NOTE: Order dependent, relies on the transparent draws being sorted back-to-front
+	if (features & MATERIAL_FEATURE_ALPHA_BLEND_BIT) {
+		pipeline_builder.enable_blending_alphablend();
+		pipeline_builder.enable_depthtest(false, VK_COMPARE_OP_GREATER_OR_EQUAL);
+	}
 
-    pipeline.pipeline = pipeline_builder.build_pipeline(engine->_device);
-	// TODO: cleanup wireframe stuff
-	pipeline_builder.set_polygon_mode(VK_POLYGON_MODE_LINE);
-	pipeline.wireframe_pipeline = pipeline_builder.build_pipeline(engine->_device);
+	variant = std::make_unique<MaterialPipeline>();
+	variant->build(device, pipeline_cache, pipeline_builder);
 
-    // Cleanup
-	vkDestroyShaderModule(engine->_device, mesh_frag_shader, nullptr);
-	vkDestroyShaderModule(engine->_device, mesh_vertex_shader, nullptr);
+	return variant.get();
 }
 
-MaterialInstance FlatColorMaterial::write_material(VkDevice device, const MaterialResources& resources, DescriptorAllocator& descriptor_allocator)
+MaterialInstance GLTFMetallic_Roughness::write_material(VkDevice device, MaterialFeatures features, const MaterialResources& resources, DescriptorAllocator& descriptor_allocator)
 {
 	MaterialInstance mat_data;
-	mat_data.pass_type = MaterialPass::MainColor;
-	mat_data.pipeline = &pipeline;
+	if (features & MATERIAL_FEATURE_ALPHA_BLEND_BIT) {
+		mat_data.pass_type = MaterialPass::Transparent;
+	}
+	else {
+		mat_data.pass_type = MaterialPass::MainColor;
+	}
+	mat_data.pipeline = get_variant(device, features);
+
 	mat_data.material_set = descriptor_allocator.allocate(device, material_layout);
 
+
 	writer.clear();
 	writer.write_buffer(0, resources.data_buffer, sizeof(MaterialConstants), resources.data_buffer_offset, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+	writer.write_image(1, resources.color_image.image_view, resources.color_sampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+	writer.write_image(2, resources.metal_rough_image.image_view, resources.metal_rough_sampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
 
 	writer.update_set(device, mat_data.material_set);
 
 	return mat_data;
 }
 
-void FlatColorMaterial::clear_resources(VkDevice device)
+void GLTFMetallic_Roughness::clear_resources(VkDevice device)
 {
-	vkDestroyDescriptorSetLayout(device, material_layout, nullptr);
-	pipeline.destroy(device);
+	for (auto& [features, variant] : variants) {
+		variant->destroy(device, false);
+	}
+	variants.clear();
+
+	vkDestroyPipelineLayout(device, layout, nullptr);
+	vkDestroyShaderModule(device, fragment_shader, nullptr);
+	vkDestroyShaderModule(device, vertex_shader, nullptr);
+	vkDestroyDescriptorSetLayout(device, material_layout,nullptr);
 }
\ No newline at end of file
@@ -3,12 +3,25 @@
 #include "vk_material.h"
 #include "vk_descriptors.h"
 
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+
 struct VkEngine;
+// Every mesh material goes through here, flat colored tiles are just the untextured and unlit variant
 struct GLTFMetallic_Roughness {
-	MaterialPipeline opaque_pipeline;
-	MaterialPipeline transparent_pipeline;
-
+	VkPipelineLayout layout;
 	VkDescriptorSetLayout material_layout;
+	VkShaderModule vertex_shader;
+	VkShaderModule fragment_shader;
+	// Everything but the specialization constants and blend state, shared by all variants
+	PipelineBuilder base_builder;
+	VkPipelineCache pipeline_cache;
+
+	// NOTE: Variants are compiled the first time a material asks for them, `MaterialInstance` keeps a pointer
+	// into this map so the pipelines are heap allocated to stay put
+	std::unordered_map<MaterialFeatures, std::unique_ptr<MaterialPipeline>> variants;
+	std::mutex variants_mutex;
 
 	struct MaterialConstants {
 		glm::vec4 color_factors;
@@ -33,30 +46,7 @@ struct GLTFMetallic_Roughness {
 	void build_pipelines(VkEngine* engine);
 	void clear_resources(VkDevice device);
 
-	MaterialInstance write_material(VkDevice device, MaterialPass pass, const MaterialResources& resources, DescriptorAllocator& descriptor_allocator);
-};
-
-// TODO: This needs to be better later
-struct FlatColorMaterial {
-	MaterialPipeline pipeline;
-	VkDescriptorSetLayout material_layout;
-
-	struct MaterialConstants {
-		glm::vec4 color_factors;
-		glm::vec4 metal_rough_factors;
-		// Pad to 256 bytes
-		glm::vec4 padding[14];
-	};
-
-	struct MaterialResources {
-		VkBuffer data_buffer;
-		uint32_t data_buffer_offset;
-	};
-
-	DescriptorWriter writer;
-
-	void build_pipelines(VkEngine* engine);
-	void clear_resources(VkDevice device);
+	MaterialPipeline* get_variant(VkDevice device, MaterialFeatures features);
 
-	MaterialInstance write_material(VkDevice device, const MaterialResources& resources, DescriptorAllocator& descriptor_allocator);
+	MaterialInstance write_material(VkDevice device, MaterialFeatures features, const MaterialResources& resources, DescriptorAllocator& descriptor_allocator);
 };
\ No newline at end of file
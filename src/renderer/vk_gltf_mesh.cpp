@@ -0,0 +1,90 @@
+#include "vk_gltf_mesh.h"
+
+#include <fastgltf/glm_element_traits.hpp>
+#include <fastgltf/tools.hpp>
+
+#include <glm/glm.hpp>
+
+namespace gltf_mesh {
+
+Bounds append_primitive(const fastgltf::Asset& gltf, const fastgltf::Primitive& p,
+    std::vector<uint32_t>& indices, std::vector<Vertex>& vertices)
+{
+    const size_t initial_vtx = vertices.size();
+
+    // load indexes
+    {
+        const fastgltf::Accessor& index_accessor = gltf.accessors[p.indicesAccessor.value()];
+        indices.reserve(indices.size() + index_accessor.count);
+
+        fastgltf::iterateAccessor<std::uint32_t>(gltf, index_accessor,
+            [&](std::uint32_t idx) {
+                indices.push_back(idx + initial_vtx);
+            });
+    }
+
+    // load vertex positions
+    {
+        const fastgltf::Accessor& pos_accessor = gltf.accessors[p.findAttribute("POSITION")->accessorIndex];
+        vertices.resize(vertices.size() + pos_accessor.count);
+
+        fastgltf::iterateAccessorWithIndex<glm::vec3>(gltf, pos_accessor,
+            [&](glm::vec3 v, size_t index) {
+                Vertex newvtx;
+                newvtx.position = v;
+                newvtx.normal = { 1, 0, 0 };
+                newvtx.color = glm::vec4 { 1.f };
+                newvtx.uv_x = 0;
+                newvtx.uv_y = 0;
+                vertices[initial_vtx + index] = newvtx;
+            });
+    }
+
+    // load vertex normals
+    const auto normals = p.findAttribute("NORMAL");
+    if (normals != p.attributes.end()) {
+
+        fastgltf::iterateAccessorWithIndex<glm::vec3>(gltf, gltf.accessors[(*normals).accessorIndex],
+            [&](glm::vec3 v, size_t index) {
+                vertices[initial_vtx + index].normal = v;
+            });
+    }
+
+    // load UVs
+    const auto uv = p.findAttribute("TEXCOORD_0");
+    if (uv != p.attributes.end()) {
+
+        fastgltf::iterateAccessorWithIndex<glm::vec2>(gltf, gltf.accessors[(*uv).accessorIndex],
+            [&](glm::vec2 v, size_t index) {
+                vertices[initial_vtx + index].uv_x = v.x;
+                vertices[initial_vtx + index].uv_y = v.y;
+            });
+    }
+
+    // load vertex colors
+    const auto colors = p.findAttribute("COLOR_0");
+    if (colors != p.attributes.end()) {
+
+        fastgltf::iterateAccessorWithIndex<glm::vec4>(gltf, gltf.accessors[(*colors).accessorIndex],
+            [&](glm::vec4 v, size_t index) {
+                vertices[initial_vtx + index].color = v;
+            });
+    }
+
+    // Calculate bounds
+    // TODO: Duplicated code in Cube
+    Bounds bounds;
+    glm::vec3 min_pos = vertices[initial_vtx].position;
+    glm::vec3 max_pos = vertices[initial_vtx].position;
+    for (size_t i = initial_vtx; i < vertices.size(); i++) {
+        min_pos = glm::min(min_pos, vertices[i].position);
+        max_pos = glm::max(max_pos, vertices[i].position);
+    }
+    bounds.origin = (max_pos + min_pos) / 2.f;
+    bounds.extents = (max_pos - min_pos) / 2.f;
+    bounds.sphere_radius = glm::length(bounds.extents);
+
+    return bounds;
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_renderable.h"
+
+#include <fastgltf/core.hpp>
+
+#include <vector>
+
+namespace gltf_mesh {
+    // Converts a glTF primitive into our `Vertex` layout, appending to `indices` and `vertices`.
+    // Indices are rebased so they point into the shared vertex array. Returns the bounds of the primitive.
+    Bounds append_primitive(const fastgltf::Asset& gltf, const fastgltf::Primitive& p,
+        std::vector<uint32_t>& indices, std::vector<Vertex>& vertices);
+}
\ No newline at end of file
@@ -0,0 +1,129 @@
+#include "vk_gpu_profiler.h"
+
+#include <algorithm>
+#include <numeric>
+
+void GpuProfiler::init(VkDevice device, VkPhysicalDevice gpu, uint32_t frame_count, bool pipeline_statistics)
+{
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(gpu, &properties);
+    timestamp_period_ns = properties.limits.timestampPeriod;
+
+    pending.assign(frame_count, false);
+
+    // Two timestamps (begin/end) per pass, per frame
+    VkQueryPoolCreateInfo timestamp_info = { .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+    timestamp_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    timestamp_info.queryCount = frame_count * pass_count * 2;
+    VK_CHECK(vkCreateQueryPool(device, &timestamp_info, nullptr, &timestamp_pool));
+
+    if (!pipeline_statistics) {
+        return;
+    }
+
+    // One statistics query per frame
+    VkQueryPoolCreateInfo statistics_info = { .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+    statistics_info.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+    statistics_info.queryCount = frame_count;
+    statistics_info.pipelineStatistics =
+        VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+        VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+    VK_CHECK(vkCreateQueryPool(device, &statistics_info, nullptr, &statistics_pool));
+}
+
+void GpuProfiler::destroy(VkDevice device)
+{
+    vkDestroyQueryPool(device, timestamp_pool, nullptr);
+    vkDestroyQueryPool(device, statistics_pool, nullptr);
+}
+
+void GpuProfiler::collect(VkDevice device, uint32_t frame_index)
+{
+    if (!pending[frame_index]) {
+        return;
+    }
+    pending[frame_index] = false;
+
+    std::array<uint64_t, pass_count * 2> timestamps;
+    const VkResult timestamp_result = vkGetQueryPoolResults(device, timestamp_pool, timestamp_index(frame_index, GpuPass(0), false),
+        pass_count * 2, sizeof(timestamps), timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    if (timestamp_result != VK_SUCCESS) {
+        return;
+    }
+
+    float frame_time = 0.f;
+    for (uint32_t pass = 0; pass < pass_count; pass++) {
+        const uint64_t ticks = timestamps[pass * 2 + 1] - timestamps[pass * 2];
+        const float ms = (ticks * timestamp_period_ns) / 1000000.f;
+        pass_history[pass][history_head] = ms;
+        frame_time += ms;
+    }
+    frame_history[history_head] = frame_time;
+    last_frame_time = frame_time;
+
+    history_head = (history_head + 1) % history_size;
+    history_count = std::min(history_count + 1, history_size);
+
+    if (!has_statistics()) {
+        return;
+    }
+
+    std::array<uint64_t, 2> statistics;
+    const VkResult statistics_result = vkGetQueryPoolResults(device, statistics_pool, frame_index, 1,
+        sizeof(statistics), statistics.data(), sizeof(statistics), VK_QUERY_RESULT_64_BIT);
+    if (statistics_result == VK_SUCCESS) {
+        // NOTE: Results are written in the order of the statistic bits
+        vertex_invocations = statistics[0];
+        fragment_invocations = statistics[1];
+    }
+}
+
+void GpuProfiler::reset(VkCommandBuffer cmd, uint32_t frame_index)
+{
+    vkCmdResetQueryPool(cmd, timestamp_pool, timestamp_index(frame_index, GpuPass(0), false), pass_count * 2);
+    if (has_statistics()) {
+        vkCmdResetQueryPool(cmd, statistics_pool, frame_index, 1);
+    }
+    pending[frame_index] = true;
+}
+
+void GpuProfiler::begin_pass(VkCommandBuffer cmd, uint32_t frame_index, GpuPass pass)
+{
+    vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, timestamp_pool, timestamp_index(frame_index, pass, false));
+}
+
+void GpuProfiler::end_pass(VkCommandBuffer cmd, uint32_t frame_index, GpuPass pass)
+{
+    vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, timestamp_pool, timestamp_index(frame_index, pass, true));
+}
+
+void GpuProfiler::begin_statistics(VkCommandBuffer cmd, uint32_t frame_index)
+{
+    if (has_statistics()) {
+        vkCmdBeginQuery(cmd, statistics_pool, frame_index, 0);
+    }
+}
+
+void GpuProfiler::end_statistics(VkCommandBuffer cmd, uint32_t frame_index)
+{
+    if (has_statistics()) {
+        vkCmdEndQuery(cmd, statistics_pool, frame_index);
+    }
+}
+
+float GpuProfiler::average_ms(GpuPass pass) const
+{
+    if (history_count == 0) {
+        return 0.f;
+    }
+    const auto& history = pass_history[static_cast<uint32_t>(pass)];
+    return std::accumulate(history.begin(), history.begin() + history_count, 0.f) / history_count;
+}
+
+float GpuProfiler::average_frame_ms() const
+{
+    if (history_count == 0) {
+        return 0.f;
+    }
+    return std::accumulate(frame_history.begin(), frame_history.begin() + history_count, 0.f) / history_count;
+}
\ No newline at end of file
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <array>
+#include <vector>
+
+#include "vk_types.h"
+
+enum class GpuPass : uint32_t {
+    Background,
+    Geometry,
+    Blit,
+    Imgui,
+    Count
+};
+
+static const char* gpu_pass_name(GpuPass pass) {
+    switch (pass) {
+        case GpuPass::Background: { return "background"; }
+        case GpuPass::Geometry: { return "geometry"; }
+        case GpuPass::Blit: { return "blit"; }
+        case GpuPass::Imgui: { return "imgui"; }
+        default: { return "unknown"; }
+    }
+}
+
+// Per-frame timestamp and pipeline-statistics queries.
+// Queries for a frame are read back once its fence has signalled, so results lag FRAME_OVERLAP frames behind.
+// Pipeline statistics are an optional device feature, without it only timestamps are recorded.
+struct GpuProfiler {
+    static constexpr uint32_t pass_count = static_cast<uint32_t>(GpuPass::Count);
+    static constexpr uint32_t history_size = 64;
+
+    void init(VkDevice device, VkPhysicalDevice gpu, uint32_t frame_count, bool pipeline_statistics);
+    void destroy(VkDevice device);
+
+    // Must be called after waiting on the frame's fence, and before `reset` is recorded for it again
+    void collect(VkDevice device, uint32_t frame_index);
+    // Must be recorded outside of a render pass, before any other query of the frame
+    void reset(VkCommandBuffer cmd, uint32_t frame_index);
+
+    void begin_pass(VkCommandBuffer cmd, uint32_t frame_index, GpuPass pass);
+    void end_pass(VkCommandBuffer cmd, uint32_t frame_index, GpuPass pass);
+
+    // Begin and end must be either both inside or both outside of the same render pass
+    void begin_statistics(VkCommandBuffer cmd, uint32_t frame_index);
+    void end_statistics(VkCommandBuffer cmd, uint32_t frame_index);
+
+    float average_ms(GpuPass pass) const;
+    float average_frame_ms() const;
+    float last_frame_ms() const { return last_frame_time; }
+
+    bool has_statistics() const { return statistics_pool != VK_NULL_HANDLE; }
+    uint64_t vertex_invocations = 0;
+    uint64_t fragment_invocations = 0;
+
+private:
+    uint32_t timestamp_index(uint32_t frame_index, GpuPass pass, bool end) const {
+        return (frame_index * pass_count + static_cast<uint32_t>(pass)) * 2 + (end ? 1 : 0);
+    }
+
+    VkQueryPool timestamp_pool = VK_NULL_HANDLE;
+    VkQueryPool statistics_pool = VK_NULL_HANDLE;
+    float timestamp_period_ns = 1.f;
+
+    // Whether the queries of a frame slot have been recorded and not read back yet
+    std::vector<bool> pending;
+
+    std::array<std::array<float, history_size>, pass_count> pass_history{};
+    std::array<float, history_size> frame_history{};
+    uint32_t history_head = 0;
+    uint32_t history_count = 0;
+    float last_frame_time = 0.f;
+};
\ No newline at end of file
@@ -7,4 +7,7 @@ void transition_image(VkCommandBuffer cmd, VkImage image, VkImageLayout current_
 void copy_image_to_image(VkCommandBuffer cmd, VkImage source, VkImage destination, VkExtent2D src_size, VkExtent2D dst_size);
 // TODO: generate them in a compute shader that generates multiple levels at once.
 void generate_mipmaps(VkCommandBuffer cmd, VkImage image, VkExtent2D image_size);
+// Global memory barrier, for buffers written and read by compute passes
+void memory_barrier(VkCommandBuffer cmd, VkPipelineStageFlags2 src_stage, VkAccessFlags2 src_access,
+    VkPipelineStageFlags2 dst_stage, VkAccessFlags2 dst_access);
 };
\ No newline at end of file
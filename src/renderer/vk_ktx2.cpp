@@ -0,0 +1,201 @@
+#include "vk_ktx2.h"
+
+#include "../core/hash.h"
+
+#include <algorithm>
+#include <cstring>
+#include <format>
+
+namespace {
+    constexpr uint8_t ktx2_identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+    struct Ktx2Header {
+        uint8_t identifier[12];
+        uint32_t vk_format;
+        uint32_t type_size;
+        uint32_t pixel_width;
+        uint32_t pixel_height;
+        uint32_t pixel_depth;
+        uint32_t layer_count;
+        uint32_t face_count;
+        uint32_t level_count;
+        uint32_t supercompression_scheme;
+
+        uint32_t dfd_byte_offset;
+        uint32_t dfd_byte_length;
+        uint32_t kvd_byte_offset;
+        uint32_t kvd_byte_length;
+        uint64_t sgd_byte_offset;
+        uint64_t sgd_byte_length;
+    };
+    static_assert(sizeof(Ktx2Header) == 80);
+
+    struct Ktx2LevelIndex {
+        uint64_t byte_offset;
+        uint64_t byte_length;
+        uint64_t uncompressed_byte_length;
+    };
+
+    // Khronos Data Format color models and channels of the formats we write
+    constexpr uint32_t khr_df_model_bc5 = 132;
+    constexpr uint32_t khr_df_model_bc7 = 134;
+    constexpr uint32_t khr_df_primaries_bt709 = 1;
+    constexpr uint32_t khr_df_transfer_linear = 1;
+    constexpr uint32_t khr_df_transfer_srgb = 2;
+
+    bool is_block_compressed(VkFormat format)
+    {
+        return format == VK_FORMAT_BC5_UNORM_BLOCK || format == VK_FORMAT_BC7_UNORM_BLOCK || format == VK_FORMAT_BC7_SRGB_BLOCK;
+    }
+
+    // Basic descriptor block, the samples tell which bits of a 128 bit block hold which channel
+    std::vector<uint32_t> data_format_descriptor(VkFormat format)
+    {
+        struct Sample {
+            uint32_t bit_offset;
+            uint32_t bit_length;
+            uint32_t channel;
+        };
+        std::vector<Sample> samples;
+        uint32_t model;
+        if (format == VK_FORMAT_BC5_UNORM_BLOCK) {
+            model = khr_df_model_bc5;
+            samples = { { 0, 64, 0 }, { 64, 64, 1 } };
+        } else {
+            model = khr_df_model_bc7;
+            samples = { { 0, 128, 0 } };
+        }
+        const uint32_t transfer = format == VK_FORMAT_BC7_SRGB_BLOCK ? khr_df_transfer_srgb : khr_df_transfer_linear;
+        const uint32_t block_size = 24 + 16 * static_cast<uint32_t>(samples.size());
+
+        std::vector<uint32_t> words;
+        words.push_back(4 + block_size);
+        words.push_back(0);
+        words.push_back(2 | (block_size << 16));
+        words.push_back(model | (khr_df_primaries_bt709 << 8) | (transfer << 16));
+        // 4x4 texels, stored as dimension - 1
+        words.push_back(3 | (3 << 8));
+        words.push_back(16);
+        words.push_back(0);
+        for (const Sample& sample : samples) {
+            words.push_back(sample.bit_offset | ((sample.bit_length - 1) << 16) | (sample.channel << 24));
+            words.push_back(0);
+            words.push_back(0);
+            words.push_back(UINT32_MAX);
+        }
+        return words;
+    }
+
+    uint64_t align_up(uint64_t value, uint64_t alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+}
+
+std::optional<Ktx2Texture> parse_ktx2(std::span<const uint8_t> file)
+{
+    if (file.size() < sizeof(Ktx2Header)) {
+        return {};
+    }
+
+    Ktx2Header header;
+    memcpy(&header, file.data(), sizeof(header));
+
+    if (memcmp(header.identifier, ktx2_identifier, sizeof(ktx2_identifier)) != 0) {
+        return {};
+    }
+
+    const VkFormat format = static_cast<VkFormat>(header.vk_format);
+    if (!is_block_compressed(format) || header.supercompression_scheme != 0 || header.pixel_depth != 0 ||
+        header.layer_count > 1 || header.face_count != 1 || header.level_count == 0 ||
+        header.pixel_width == 0 || header.pixel_height == 0) {
+        return {};
+    }
+
+    const uint64_t index_size = uint64_t(header.level_count) * sizeof(Ktx2LevelIndex);
+    if (file.size() < sizeof(Ktx2Header) + index_size) {
+        return {};
+    }
+
+    Ktx2Texture texture { format, header.pixel_width, header.pixel_height, {} };
+    texture.levels.reserve(header.level_count);
+    for (uint32_t level = 0; level < header.level_count; level++) {
+        Ktx2LevelIndex index;
+        memcpy(&index, file.data() + sizeof(Ktx2Header) + level * sizeof(Ktx2LevelIndex), sizeof(index));
+
+        const uint64_t expected = texture_level_size(format,
+            std::max(header.pixel_width >> level, 1u), std::max(header.pixel_height >> level, 1u));
+        if (index.byte_length != expected || index.byte_offset > file.size() || file.size() - index.byte_offset < index.byte_length) {
+            return {};
+        }
+
+        texture.levels.push_back(file.subspan(index.byte_offset, index.byte_length));
+    }
+
+    return texture;
+}
+
+std::vector<uint8_t> write_ktx2(VkFormat format, uint32_t width, uint32_t height, std::span<const std::vector<uint8_t>> levels)
+{
+    const std::vector<uint32_t> dfd = data_format_descriptor(format);
+
+    Ktx2Header header {};
+    memcpy(header.identifier, ktx2_identifier, sizeof(ktx2_identifier));
+    header.vk_format = format;
+    header.type_size = 1;
+    header.pixel_width = width;
+    header.pixel_height = height;
+    header.face_count = 1;
+    header.level_count = static_cast<uint32_t>(levels.size());
+    header.dfd_byte_offset = static_cast<uint32_t>(sizeof(Ktx2Header) + levels.size() * sizeof(Ktx2LevelIndex));
+    header.dfd_byte_length = static_cast<uint32_t>(dfd.size() * sizeof(uint32_t));
+
+    // NOTE: The spec stores the smallest level first, every level aligned to the 16 byte block size
+    std::vector<Ktx2LevelIndex> level_index(levels.size());
+    uint64_t offset = header.dfd_byte_offset + header.dfd_byte_length;
+    for (size_t level = levels.size(); level-- > 0;) {
+        offset = align_up(offset, 16);
+        level_index[level] = { offset, levels[level].size(), levels[level].size() };
+        offset += levels[level].size();
+    }
+
+    std::vector<uint8_t> file(offset, 0);
+    memcpy(file.data(), &header, sizeof(header));
+    memcpy(file.data() + sizeof(header), level_index.data(), level_index.size() * sizeof(Ktx2LevelIndex));
+    memcpy(file.data() + header.dfd_byte_offset, dfd.data(), header.dfd_byte_length);
+    for (size_t level = 0; level < levels.size(); level++) {
+        memcpy(file.data() + level_index[level].byte_offset, levels[level].data(), levels[level].size());
+    }
+
+    return file;
+}
+
+uint64_t texture_level_size(VkFormat format, uint32_t width, uint32_t height)
+{
+    if (is_block_compressed(format)) {
+        return uint64_t((width + 3) / 4) * ((height + 3) / 4) * 16;
+    }
+    return uint64_t(width) * height * 4;
+}
+
+uint32_t full_mip_count(uint32_t width, uint32_t height)
+{
+    uint32_t count = 1;
+    for (uint32_t size = std::max(width, height); size > 1; size >>= 1) {
+        count++;
+    }
+    return count;
+}
+
+std::filesystem::path baked_texture_path(const std::filesystem::path& source_dir, std::span<const uint8_t> encoded)
+{
+    return source_dir / "baked" / std::format("{:016x}.ktx2", hash_bytes(encoded));
+}
+
+std::filesystem::path gltf_image_path(const std::filesystem::path& gltf_dir, std::string_view uri)
+{
+    const std::filesystem::path path = std::filesystem::absolute(gltf_dir / uri);
+    std::error_code error;
+    const std::filesystem::path canonical = std::filesystem::weakly_canonical(path, error);
+    return error ? path.lexically_normal() : canonical;
+}
\ No newline at end of file
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+// Minimal KTX2 container support for the block compressed textures written by `td_texture_bake`.
+// Only single layer, single face 2D textures without supercompression, so levels can be copied to the GPU as is.
+struct Ktx2Texture {
+    VkFormat format;
+    uint32_t width;
+    uint32_t height;
+    // Level 0 first, each one points into the parsed file
+    std::vector<std::span<const uint8_t>> levels;
+};
+
+// Returns nothing for files this loader cannot upload directly
+std::optional<Ktx2Texture> parse_ktx2(std::span<const uint8_t> file);
+// `levels` are level 0 first, the format is assumed to be BC5 or BC7
+std::vector<uint8_t> write_ktx2(VkFormat format, uint32_t width, uint32_t height, std::span<const std::vector<uint8_t>> levels);
+
+// Bytes of one mip level, for R8G8B8A8 and the 4x4 block formats we bake to
+uint64_t texture_level_size(VkFormat format, uint32_t width, uint32_t height);
+// Levels of a full mip chain down to 1x1
+uint32_t full_mip_count(uint32_t width, uint32_t height);
+
+// Baked textures are named after the hash of the encoded source image, in a `baked` directory next to the
+// file that references it. Editing a source image therefore never picks up a stale bake.
+std::filesystem::path baked_texture_path(const std::filesystem::path& source_dir, std::span<const uint8_t> encoded);
+// Absolute path of an image a glTF file references by URI, which is relative to the glTF file's directory.
+// The baker and the engine both resolve through here, so they agree on which file an image is
+std::filesystem::path gltf_image_path(const std::filesystem::path& gltf_dir, std::string_view uri);
\ No newline at end of file
@@ -0,0 +1,71 @@
+#include "vk_lod.h"
+
+#include "../profiler/profiler.h"
+
+#include <glm/geometric.hpp>
+#include <glm/matrix.hpp>
+
+#include <algorithm>
+
+namespace {
+    uint32_t select_level(std::span<const SurfaceLod> lods, uint32_t current, const glm::mat4& transform,
+        const Bounds& bounds, const glm::vec3& camera_position, float pixels_per_unit, bool orthographic,
+        float coarser_limit, float kept_limit)
+    {
+        const float scale = std::max({ glm::length(glm::vec3(transform[0])), glm::length(glm::vec3(transform[1])),
+            glm::length(glm::vec3(transform[2])) });
+        const glm::vec3 center = glm::vec3(transform * glm::vec4(bounds.origin, 1.f));
+
+        // Distance to the nearest point of the bounding sphere, the full surface while the camera is inside it
+        const float distance = orthographic ? 1.f : glm::length(center - camera_position) - bounds.sphere_radius * scale;
+        if (distance <= 0.f) {
+            return 0;
+        }
+
+        const float pixels_per_error = scale * pixels_per_unit / distance;
+        for (uint32_t level = static_cast<uint32_t>(lods.size()) - 1; level > 0; level--) {
+            const float limit = level > current ? coarser_limit : kept_limit;
+            if (lods[level].error * pixels_per_error <= limit) {
+                return level;
+            }
+        }
+        return 0;
+    }
+}
+
+void LodSelector::select(RenderWorld& world, const VisibilityCache& visible, const glm::mat4& view, const glm::mat4& proj,
+    float viewport_height)
+{
+    PROFILE_SCOPE("LodSelector::select");
+
+    level_counts.fill(0);
+    switched = 0;
+
+    // Pixels an object space distance of 1 covers at a view distance of 1, or anywhere for an orthographic projection
+    const float pixels_per_unit = proj[1][1] * viewport_height * 0.5f;
+    const bool orthographic = proj[3][3] == 1.f;
+    const float coarser_limit = error_pixels * (1.f - hysteresis);
+    const float kept_limit = error_pixels * (1.f + hysteresis);
+
+    const glm::vec3 camera_position = glm::vec3(glm::inverse(view)[3]);
+
+    for (const std::vector<uint32_t>* draws : { &visible.opaque, &visible.transparent }) {
+        for (uint32_t i : *draws) {
+            const std::span<const SurfaceLod> lods = world.lods[i];
+            if (lods.size() <= 1) {
+                level_counts[0]++;
+                continue;
+            }
+
+            const uint32_t current = world.lod_levels[i];
+            const uint32_t level = enabled ? select_level(lods, current, world.transforms[i], world.bounds[i],
+                camera_position, pixels_per_unit, orthographic, coarser_limit, kept_limit) : 0;
+
+            if (level != current) {
+                world.set_lod_level(i, level);
+                switched++;
+            }
+            level_counts[level]++;
+        }
+    }
+}
\ No newline at end of file
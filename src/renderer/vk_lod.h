@@ -0,0 +1,28 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_render_world.h"
+#include "vk_visibility_cache.h"
+
+#include <array>
+
+// Picks the level of detail of every visible record from its projected size on screen.
+// A level's simplification error is projected to pixels at the record's distance, the coarsest level under
+// `error_pixels` is used. Records without levels of detail are left alone.
+//
+// NOTE: To stop records at the boundary from popping back and forth, a coarser level has to project under
+// `error_pixels * (1 - hysteresis)` before it is switched to, the current one is kept until it exceeds
+// `error_pixels * (1 + hysteresis)`
+struct LodSelector {
+    bool enabled = true;
+    float error_pixels = 1.f;
+    float hysteresis = 0.25f;
+
+    // Updates the records in `visible`, with the view and projection they are rendered with. `viewport_height` in pixels
+    void select(RenderWorld& world, const VisibilityCache& visible, const glm::mat4& view, const glm::mat4& proj,
+        float viewport_height);
+
+    // Of the last `select`, draws per level and how many changed level
+    std::array<uint32_t, max_lod_count> level_counts {};
+    uint32_t switched = 0;
+};
\ No newline at end of file
@@ -1,9 +1,45 @@
 #include "vk_material.h"
 
+void MaterialPipeline::build(VkDevice device, VkPipelineCache cache, const PipelineBuilder& pipeline_builder) {
+    builder = pipeline_builder;
+    layout = builder._pipeline_layout;
+
+    cull_mode = builder._rasterization.cullMode;
+    depth_write = builder._depth_stencil.depthWriteEnable;
+    depth_compare = builder._depth_stencil.depthCompareOp;
+
+    pipeline = builder.build_pipeline(device, cache);
+    wireframe_pipeline = VK_NULL_HANDLE;
+}
+
+VkPipeline MaterialPipeline::get(VkDevice device, VkPipelineCache cache, bool wireframe) {
+    if (!wireframe || builder._dynamic_polygon_mode) {
+        return pipeline;
+    }
+
+    if (wireframe_pipeline == VK_NULL_HANDLE) {
+        PipelineBuilder wireframe_builder = builder;
+        wireframe_builder.set_polygon_mode(VK_POLYGON_MODE_LINE);
+        wireframe_pipeline = wireframe_builder.build_pipeline(device, cache);
+    }
+    return wireframe_pipeline;
+}
+
+void MaterialPipeline::set_dynamic_state(VkCommandBuffer cmd) const {
+    if (!builder._dynamic_raster_state) {
+        return;
+    }
+    vkCmdSetCullMode(cmd, cull_mode);
+    vkCmdSetDepthWriteEnable(cmd, depth_write);
+    vkCmdSetDepthCompareOp(cmd, depth_compare);
+}
+
 void MaterialPipeline::destroy(VkDevice device, bool destroy_layout) {
     if (destroy_layout) {
         vkDestroyPipelineLayout(device, layout, nullptr);
     }
 	vkDestroyPipeline(device, pipeline, nullptr);
-	vkDestroyPipeline(device, wireframe_pipeline, nullptr);
+	if (wireframe_pipeline != VK_NULL_HANDLE) {
+		vkDestroyPipeline(device, wireframe_pipeline, nullptr);
+	}
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "vk_types.h"
+#include "vk_pipelines.h"
 
 enum class MaterialPass :uint8_t {
     MainColor,
@@ -8,12 +9,36 @@ enum class MaterialPass :uint8_t {
     Other
 };
 
+// Fragment shader features, each bit maps to the specialization constant with the same index in `mesh_gltf.frag`
+enum MaterialFeatureBits : uint32_t {
+    MATERIAL_FEATURE_TEXTURED_BIT = 1 << 0,
+    MATERIAL_FEATURE_LIT_BIT = 1 << 1,
+    MATERIAL_FEATURE_ALPHA_BLEND_BIT = 1 << 2,
+    // Back faces are rasterized and lit with the flipped normal, single sided materials cull them
+    MATERIAL_FEATURE_DOUBLE_SIDED_BIT = 1 << 3,
+};
+constexpr uint32_t MATERIAL_FEATURE_COUNT = 4;
+using MaterialFeatures = uint32_t;
+
 struct MaterialPipeline {
     // TODO: Create function, with a layout optional param
 	VkPipeline pipeline;
-    VkPipeline wireframe_pipeline;
 	VkPipelineLayout layout;
 
+    // Raster state that is set at bind time instead of being baked into the pipeline
+    VkCullModeFlags cull_mode;
+    VkBool32 depth_write;
+    VkCompareOp depth_compare;
+
+    // NOTE: Without VK_EXT_extended_dynamic_state3 the polygon mode is baked into the pipeline, so the
+    // wireframe variant is built from `builder` the first time it is asked for
+    PipelineBuilder builder;
+    VkPipeline wireframe_pipeline = VK_NULL_HANDLE;
+
+    void build(VkDevice device, VkPipelineCache cache, const PipelineBuilder& pipeline_builder);
+    VkPipeline get(VkDevice device, VkPipelineCache cache, bool wireframe);
+    void set_dynamic_state(VkCommandBuffer cmd) const;
+
     void destroy(VkDevice device, bool destroy_layout = true);
 };
 
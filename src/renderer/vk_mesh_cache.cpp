@@ -0,0 +1,155 @@
+#include "vk_mesh_cache.h"
+
+#include <cstring>
+#include <fstream>
+
+namespace {
+    constexpr uint32_t mesh_cache_magic = 0x434D4454; // "TDMC"
+    // Bump when anything cached, or the way it is derived from the glTF, changes
+    constexpr uint32_t mesh_cache_version = 5;
+
+    constexpr uint32_t section_count = 12;
+    constexpr uint64_t section_alignment = 16;
+
+    struct Section {
+        uint64_t offset;
+        uint32_t count;
+        // Rejects caches written by a build with a different struct layout
+        uint32_t element_size;
+    };
+
+    struct MeshCacheHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t source_hash;
+        // In the order of the members of `MeshCache`
+        Section sections[section_count];
+    };
+
+    template<typename T>
+    bool map_section(std::span<const uint8_t> file, const Section& section, std::span<const T>& out)
+    {
+        if (section.element_size != sizeof(T) || section.offset % alignof(T) != 0 || section.offset > file.size() ||
+            (file.size() - section.offset) / sizeof(T) < section.count) {
+            return false;
+        }
+
+        out = std::span(reinterpret_cast<const T*>(file.data() + section.offset), section.count);
+        return true;
+    }
+
+    template<typename T>
+    void append_section(std::vector<uint8_t>& file, Section& section, std::span<const T> data)
+    {
+        file.resize((file.size() + section_alignment - 1) / section_alignment * section_alignment, 0);
+        section = { file.size(), static_cast<uint32_t>(data.size()), sizeof(T) };
+
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data.data());
+        file.insert(file.end(), bytes, bytes + data.size_bytes());
+    }
+}
+
+CachedString MeshCacheData::add_string(std::string_view s)
+{
+    const CachedString result = { static_cast<uint32_t>(strings.size()), static_cast<uint32_t>(s.size()) };
+    strings.insert(strings.end(), s.begin(), s.end());
+    return result;
+}
+
+MeshCache MeshCacheData::view() const
+{
+    return MeshCache {
+        .samplers = samplers,
+        .images = images,
+        .materials = materials,
+        .meshes = meshes,
+        .surfaces = surfaces,
+        .lods = lods,
+        .meshlets = meshlets,
+        .nodes = nodes,
+        .vertices = vertices,
+        .indices = indices,
+        .image_data = image_data,
+        .strings = strings,
+    };
+}
+
+std::filesystem::path mesh_cache_path(const std::filesystem::path& source_path)
+{
+    return source_path.parent_path() / "baked" / (source_path.filename().string() + ".tdmesh");
+}
+
+std::optional<MeshCache> parse_mesh_cache(std::span<const uint8_t> file, uint64_t source_hash)
+{
+    if (file.size() < sizeof(MeshCacheHeader)) {
+        return {};
+    }
+
+    MeshCacheHeader header;
+    memcpy(&header, file.data(), sizeof(header));
+    if (header.magic != mesh_cache_magic || header.version != mesh_cache_version || header.source_hash != source_hash) {
+        return {};
+    }
+
+    // NOTE: Only the sections are bounds checked, the contents were written by us for this exact source file
+    MeshCache cache;
+    const Section* s = header.sections;
+    const bool valid = map_section(file, s[0], cache.samplers)
+        && map_section(file, s[1], cache.images)
+        && map_section(file, s[2], cache.materials)
+        && map_section(file, s[3], cache.meshes)
+        && map_section(file, s[4], cache.surfaces)
+        && map_section(file, s[5], cache.lods)
+        && map_section(file, s[6], cache.meshlets)
+        && map_section(file, s[7], cache.nodes)
+        && map_section(file, s[8], cache.vertices)
+        && map_section(file, s[9], cache.indices)
+        && map_section(file, s[10], cache.image_data)
+        && map_section(file, s[11], cache.strings);
+    if (!valid) {
+        return {};
+    }
+
+    return cache;
+}
+
+bool save_mesh_cache(const MeshCache& cache, uint64_t source_hash, const std::filesystem::path& path)
+{
+    MeshCacheHeader header {};
+    header.magic = mesh_cache_magic;
+    header.version = mesh_cache_version;
+    header.source_hash = source_hash;
+
+    std::vector<uint8_t> file(sizeof(header));
+    Section* s = header.sections;
+    append_section(file, s[0], cache.samplers);
+    append_section(file, s[1], cache.images);
+    append_section(file, s[2], cache.materials);
+    append_section(file, s[3], cache.meshes);
+    append_section(file, s[4], cache.surfaces);
+    append_section(file, s[5], cache.lods);
+    append_section(file, s[6], cache.meshlets);
+    append_section(file, s[7], cache.nodes);
+    append_section(file, s[8], cache.vertices);
+    append_section(file, s[9], cache.indices);
+    append_section(file, s[10], cache.image_data);
+    append_section(file, s[11], cache.strings);
+    memcpy(file.data(), &header, sizeof(header));
+
+    std::error_code error;
+    std::filesystem::create_directories(path.parent_path(), error);
+
+    // Write next to the real file and swap it in, so a crash mid-write never leaves a truncated cache behind
+    std::filesystem::path tmp_path = path;
+    tmp_path += ".tmp";
+    {
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(file.data()), static_cast<std::streamsize>(file.size()));
+        if (!out.good()) {
+            return false;
+        }
+    }
+
+    std::filesystem::rename(tmp_path, path, error);
+    return !error;
+}
\ No newline at end of file
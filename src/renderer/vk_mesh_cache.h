@@ -0,0 +1,128 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_render_world.h"
+
+#include <glm/vec4.hpp>
+
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+// Cooked form of a glTF file: everything `LoadedGLTF::load_gltf` needs, in flat arrays that are used straight from
+// the memory mapped cache file. Vertices are already in our `Vertex` layout, so loading is a copy into staging.
+// Written after the glTF was parsed once, rejected when the source file hash or the format version changes.
+
+// Range of `MeshCache::strings`
+struct CachedString {
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct CachedSampler {
+    VkFilter mag_filter;
+    VkFilter min_filter;
+    VkSamplerMipmapMode mipmap_mode;
+};
+
+// External images only keep their uri, so editing them invalidates their baked texture but not the cache.
+// Embedded ones are copied to the range [data_offset, data_offset + data_size) of `MeshCache::image_data`
+struct CachedImage {
+    CachedString name;
+    CachedString uri;
+    uint64_t data_offset;
+    uint64_t data_size;
+};
+
+struct CachedMaterial {
+    glm::vec4 color_factors;
+    glm::vec4 metal_rough_factors;
+    CachedString name;
+    // -1 without a color texture
+    int32_t color_image;
+    int32_t color_sampler;
+    uint32_t alpha_blend;
+    uint32_t double_sided;
+};
+
+struct CachedSurface {
+    Bounds bounds;
+    // Into the indices of its mesh
+    uint32_t start_index;
+    uint32_t count;
+    uint32_t material;
+    // Range of `MeshCache::lods`, empty if the surface has no simplified levels
+    uint32_t first_lod;
+    uint32_t lod_count;
+    // Range of its mesh's meshlets, empty if the surface is not split
+    uint32_t first_meshlet;
+    uint32_t meshlet_count;
+};
+
+// Vertices, indices and meshlets are ranges of the shared arrays, indices are relative to the mesh's first vertex
+struct CachedMesh {
+    CachedString name;
+    uint32_t first_surface;
+    uint32_t surface_count;
+    uint32_t first_vertex;
+    uint32_t vertex_count;
+    uint32_t first_index;
+    uint32_t index_count;
+    uint32_t first_meshlet;
+    uint32_t meshlet_count;
+};
+
+struct CachedNode {
+    glm::mat4 local_transform;
+    CachedString name;
+    // -1 for nodes without a mesh / roots
+    int32_t mesh;
+    int32_t parent;
+};
+
+// Views into a mapped cache file or a `MeshCacheData`
+struct MeshCache {
+    std::span<const CachedSampler> samplers;
+    std::span<const CachedImage> images;
+    std::span<const CachedMaterial> materials;
+    std::span<const CachedMesh> meshes;
+    std::span<const CachedSurface> surfaces;
+    // Index ranges are into the indices of the surface's mesh, like `CachedSurface::start_index`
+    std::span<const SurfaceLod> lods;
+    // Index ranges are into the indices of the meshlet's mesh
+    std::span<const Meshlet> meshlets;
+    std::span<const CachedNode> nodes;
+    std::span<const Vertex> vertices;
+    std::span<const uint32_t> indices;
+    std::span<const uint8_t> image_data;
+    std::span<const char> strings;
+
+    std::string_view string(CachedString s) const { return { strings.data() + s.offset, s.length }; }
+};
+
+// Filled from a parsed glTF, the same data a cache file maps
+struct MeshCacheData {
+    std::vector<CachedSampler> samplers;
+    std::vector<CachedImage> images;
+    std::vector<CachedMaterial> materials;
+    std::vector<CachedMesh> meshes;
+    std::vector<CachedSurface> surfaces;
+    std::vector<SurfaceLod> lods;
+    std::vector<Meshlet> meshlets;
+    std::vector<CachedNode> nodes;
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+    std::vector<uint8_t> image_data;
+    std::vector<char> strings;
+
+    CachedString add_string(std::string_view s);
+    MeshCache view() const;
+};
+
+// `baked/<file name>.tdmesh` next to the glTF file
+std::filesystem::path mesh_cache_path(const std::filesystem::path& source_path);
+// Returns nothing if `file` is not a cache of this version for a source with `source_hash`
+std::optional<MeshCache> parse_mesh_cache(std::span<const uint8_t> file, uint64_t source_hash);
+bool save_mesh_cache(const MeshCache& cache, uint64_t source_hash, const std::filesystem::path& path);
\ No newline at end of file
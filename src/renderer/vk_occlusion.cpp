@@ -0,0 +1,366 @@
+#include "vk_occlusion.h"
+
+#include "vk_engine.h"
+#include "vk_descriptors.h"
+#include "vk_initializers.h"
+#include "vk_pipelines.h"
+#include "vk_image.h"
+
+#include "../defs.h"
+#include "../profiler/profiler.h"
+
+#include <shaders/depth_reduce.comp.spv.h>
+#include <shaders/occlusion_cull.comp.spv.h>
+
+#include <cmath>
+
+namespace {
+
+uint32_t previous_pow2(uint32_t v) {
+    uint32_t result = 1;
+    while (result * 2 <= v) {
+        result *= 2;
+    }
+    return result;
+}
+
+} // namespace
+
+void OcclusionCuller::init(VkEngine* engine, uint32_t frame_count) {
+    const VkDevice device = engine->_device;
+
+    frames.resize(frame_count);
+
+    {
+        DescriptorLayoutBuilder builder;
+        builder.add_binding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+        builder.add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+        builder.add_binding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+        builder.add_binding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+        builder.add_binding(4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+        builder.add_binding(5, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+        cull_set_layout = builder.build(device, VK_SHADER_STAGE_COMPUTE_BIT);
+    }
+
+    {
+        DescriptorLayoutBuilder builder;
+        builder.add_binding(0, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+        builder.add_binding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+        reduce_set_layout = builder.build(device, VK_SHADER_STAGE_COMPUTE_BIT);
+    }
+
+    cull_layout = vkutil::create_compute_layout(device, cull_set_layout, sizeof(OcclusionCullPushConstants));
+    reduce_layout = vkutil::create_compute_layout(device, reduce_set_layout, sizeof(DepthReducePushConstants));
+
+    cull_pipeline = vkutil::create_compute_pipeline(device, engine->_pipeline_cache, cull_layout, shaders::occlusion_cull_comp);
+    reduce_pipeline = vkutil::create_compute_pipeline(device, engine->_pipeline_cache, reduce_layout, shaders::depth_reduce_comp);
+
+    // Linear filtering with a MIN reduction returns the smallest of the 4 texels instead of their average
+    VkSamplerReductionModeCreateInfo reduction_info { .sType = VK_STRUCTURE_TYPE_SAMPLER_REDUCTION_MODE_CREATE_INFO };
+    reduction_info.reductionMode = VK_SAMPLER_REDUCTION_MODE_MIN;
+
+    VkSamplerCreateInfo sampler_info { .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+    sampler_info.pNext = &reduction_info;
+    sampler_info.magFilter = VK_FILTER_LINEAR;
+    sampler_info.minFilter = VK_FILTER_LINEAR;
+    sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    sampler_info.minLod = 0.f;
+    sampler_info.maxLod = VK_LOD_CLAMP_NONE;
+    VK_CHECK(vkCreateSampler(device, &sampler_info, nullptr, &reduction_sampler));
+
+    engine->_main_deletion_queue.push_function([=, this]() {
+        for (FrameResources& frame : frames) {
+            if (frame.capacity > 0) {
+                engine->destroy_buffer(frame.draws);
+                engine->destroy_buffer(frame.early_commands);
+                engine->destroy_buffer(frame.late_commands);
+            }
+            engine->destroy_buffer(frame.stats);
+        }
+        if (visibility_capacity > 0) {
+            engine->destroy_buffer(visibility);
+        }
+        destroy_pyramid(engine);
+
+        vkDestroySampler(device, reduction_sampler, nullptr);
+        vkDestroyPipeline(device, cull_pipeline, nullptr);
+        vkDestroyPipeline(device, reduce_pipeline, nullptr);
+        vkDestroyPipelineLayout(device, cull_layout, nullptr);
+        vkDestroyPipelineLayout(device, reduce_layout, nullptr);
+        vkDestroyDescriptorSetLayout(device, cull_set_layout, nullptr);
+        vkDestroyDescriptorSetLayout(device, reduce_set_layout, nullptr);
+    });
+
+    for (FrameResources& frame : frames) {
+        frame.stats = engine->create_buffer(2 * sizeof(uint32_t),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU);
+    }
+}
+
+void OcclusionCuller::prepare(VkEngine* engine, uint32_t frame_index, const RenderWorld& world,
+    std::span<const uint32_t> opaque, std::span<const uint32_t> transparent) {
+    PROFILE_SCOPE("OcclusionCuller::prepare");
+
+    FrameResources& frame = frames[frame_index];
+    frame.draw_count = static_cast<uint32_t>(opaque.size() + transparent.size());
+
+    // The frame slot's fence was waited on, its old buffers are not in use anymore
+    if (frame.draw_count > frame.capacity) {
+        if (frame.capacity > 0) {
+            engine->destroy_buffer(frame.draws);
+            engine->destroy_buffer(frame.early_commands);
+            engine->destroy_buffer(frame.late_commands);
+        }
+
+        frame.capacity = std::max(frame.draw_count, frame.capacity * 2);
+        frame.draws = engine->create_buffer(frame.capacity * sizeof(OcclusionDraw),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+        frame.early_commands = engine->create_buffer(frame.capacity * sizeof(VkDrawIndexedIndirectCommand),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+        frame.late_commands = engine->create_buffer(frame.capacity * sizeof(VkDrawIndexedIndirectCommand),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+    }
+
+    OcclusionDraw* draws = (OcclusionDraw*)frame.draws.allocation->GetMappedData();
+    auto write = [&](uint32_t i, bool is_transparent) {
+        OcclusionDraw& draw = *draws++;
+        draw.transform = world.transforms[i];
+        draw.origin = glm::vec4(world.bounds[i].origin, 0.f);
+        draw.extents = glm::vec4(world.bounds[i].extents, 0.f);
+        draw.visibility_id = world.handle_id(i);
+        draw.index_count = world.index_counts[i];
+        draw.first_index = world.first_indices[i];
+        draw.transparent = is_transparent ? 1 : 0;
+    };
+    for (uint32_t i : opaque) {
+        write(i, false);
+    }
+    for (uint32_t i : transparent) {
+        write(i, true);
+    }
+
+    // New handles start out invisible, the late phase picks them up
+    const uint32_t required = world.handle_capacity();
+    if (required > visibility_capacity) {
+        M_Assert(old_visibility_capacity == 0, "Visibility buffer grown twice without recording");
+
+        old_visibility = visibility;
+        old_visibility_capacity = visibility_capacity;
+
+        visibility_capacity = std::max(required, visibility_capacity * 2);
+        visibility = engine->create_buffer(visibility_capacity * sizeof(uint32_t),
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VMA_MEMORY_USAGE_GPU_ONLY);
+    }
+}
+
+void OcclusionCuller::record_early(VkEngine* engine, VkCommandBuffer cmd, uint32_t frame_index,
+    const AllocatedImage& depth_image, const glm::mat4& view_proj) {
+    FrameResources& frame = frames[frame_index];
+    frame.view_proj = view_proj;
+
+    // The pyramid follows the depth image, which is reallocated when the window outgrows it.
+    // NOTE: The previous frame may still read the old one, it is retired through this frame's deletion queue
+    if (pyramid_source != depth_image.image) {
+        if (pyramid.image != VK_NULL_HANDLE) {
+            const VkDevice device = engine->_device;
+            const AllocatedImage old_pyramid = pyramid;
+            const std::vector<VkImageView> old_mips = pyramid_mips;
+            engine->get_current_frame()._deletion_queue.push_function([=]() {
+                for (VkImageView view : old_mips) {
+                    vkDestroyImageView(device, view, nullptr);
+                }
+                engine->destroy_image(old_pyramid);
+            });
+            pyramid = {};
+            pyramid_mips.clear();
+        }
+        create_pyramid(engine, depth_image);
+    }
+
+    if (old_visibility_capacity != visibility_capacity) {
+        // Grown in `prepare`, carry the history over and zero the rest
+        vkCmdFillBuffer(cmd, visibility.buffer, 0, VK_WHOLE_SIZE, 0);
+        vkutil::memory_barrier(cmd, VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+            VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+
+        if (old_visibility_capacity > 0) {
+            const VkBufferCopy region { 0, 0, old_visibility_capacity * sizeof(uint32_t) };
+            vkCmdCopyBuffer(cmd, old_visibility.buffer, visibility.buffer, 1, &region);
+
+            const AllocatedBuffer retired = old_visibility;
+            engine->get_current_frame()._deletion_queue.push_function([=]() {
+                engine->destroy_buffer(retired);
+            });
+        }
+        old_visibility = {};
+        old_visibility_capacity = visibility_capacity;
+    }
+
+    if (!pyramid_initialized) {
+        vkutil::transition_image(cmd, pyramid.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+        pyramid_initialized = true;
+    }
+
+    vkCmdFillBuffer(cmd, frame.stats.buffer, 0, VK_WHOLE_SIZE, 0);
+
+    // Covers the stats reset and the previous frame's late phase, which wrote the visibility we read now
+    vkutil::memory_barrier(cmd,
+        VK_PIPELINE_STAGE_2_TRANSFER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+        VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+        VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT);
+
+    if (frame.draw_count == 0) {
+        return;
+    }
+
+    frame.cull_set = engine->get_current_frame()._frame_descriptors.allocate(engine->_device, cull_set_layout);
+    {
+        DescriptorWriter writer;
+        writer.write_buffer(0, frame.draws.buffer, frame.draw_count * sizeof(OcclusionDraw), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+        writer.write_buffer(1, frame.early_commands.buffer, frame.draw_count * sizeof(VkDrawIndexedIndirectCommand), 0,
+            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+        writer.write_buffer(2, frame.late_commands.buffer, frame.draw_count * sizeof(VkDrawIndexedIndirectCommand), 0,
+            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+        writer.write_buffer(3, visibility.buffer, visibility_capacity * sizeof(uint32_t), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+        writer.write_buffer(4, frame.stats.buffer, 2 * sizeof(uint32_t), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+        writer.write_image(5, pyramid.image_view, reduction_sampler, VK_IMAGE_LAYOUT_GENERAL,
+            VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+        writer.update_set(engine->_device, frame.cull_set);
+    }
+
+    OcclusionCullPushConstants push_constants;
+    push_constants.view_proj = view_proj;
+    push_constants.pyramid_size = glm::vec2(pyramid_width, pyramid_height);
+    push_constants.draw_count = frame.draw_count;
+    push_constants.late = 0;
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, cull_pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, cull_layout, 0, 1, &frame.cull_set, 0, nullptr);
+    vkCmdPushConstants(cmd, cull_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(OcclusionCullPushConstants), &push_constants);
+    vkCmdDispatch(cmd, (frame.draw_count + 63) / 64, 1, 1);
+
+    vkutil::memory_barrier(cmd, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT);
+}
+
+void OcclusionCuller::record_late(VkEngine* engine, VkCommandBuffer cmd, uint32_t frame_index,
+    const AllocatedImage& depth_image, VkExtent2D draw_extent) {
+    FrameResources& frame = frames[frame_index];
+    const VkDevice device = engine->_device;
+
+    //
+    // Depth pyramid
+    //
+
+    for (uint32_t mip = 0; mip < pyramid_mips.size(); mip++) {
+        const uint32_t width = std::max(1u, pyramid_width >> mip);
+        const uint32_t height = std::max(1u, pyramid_height >> mip);
+
+        VkDescriptorSet set = engine->get_current_frame()._frame_descriptors.allocate(device, reduce_set_layout);
+        {
+            DescriptorWriter writer;
+            writer.write_image(0, pyramid_mips[mip], VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+            if (mip == 0) {
+                writer.write_image(1, depth_image.image_view, reduction_sampler, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL,
+                    VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+            } else {
+                writer.write_image(1, pyramid_mips[mip - 1], reduction_sampler, VK_IMAGE_LAYOUT_GENERAL,
+                    VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+            }
+            writer.update_set(device, set);
+        }
+
+        DepthReducePushConstants push_constants;
+        push_constants.dst_size = glm::vec2(width, height);
+        // Only the draw extent of the depth image holds this frame's depth
+        push_constants.src_scale = mip == 0
+            ? glm::vec2(
+                (float)draw_extent.width / depth_image.image_extent.width,
+                (float)draw_extent.height / depth_image.image_extent.height)
+            : glm::vec2(1.f);
+
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, reduce_pipeline);
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, reduce_layout, 0, 1, &set, 0, nullptr);
+        vkCmdPushConstants(cmd, reduce_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(DepthReducePushConstants), &push_constants);
+        vkCmdDispatch(cmd, (width + 15) / 16, (height + 15) / 16, 1);
+
+        vkutil::memory_barrier(cmd, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT,
+            VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT);
+    }
+
+    //
+    // Late test
+    //
+
+    if (frame.draw_count > 0 && frame.cull_set != VK_NULL_HANDLE) {
+        OcclusionCullPushConstants push_constants;
+        push_constants.view_proj = frame.view_proj;
+        push_constants.pyramid_size = glm::vec2(pyramid_width, pyramid_height);
+        push_constants.draw_count = frame.draw_count;
+        push_constants.late = 1;
+
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, cull_pipeline);
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, cull_layout, 0, 1, &frame.cull_set, 0, nullptr);
+        vkCmdPushConstants(cmd, cull_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(OcclusionCullPushConstants), &push_constants);
+        vkCmdDispatch(cmd, (frame.draw_count + 63) / 64, 1, 1);
+
+        vkutil::memory_barrier(cmd, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT,
+            VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_HOST_BIT,
+            VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_2_HOST_READ_BIT);
+
+        frame.pending = true;
+    }
+    frame.cull_set = VK_NULL_HANDLE;
+}
+
+void OcclusionCuller::collect(VkEngine* engine, uint32_t frame_index) {
+    FrameResources& frame = frames[frame_index];
+    if (!frame.pending) {
+        return;
+    }
+
+    vmaInvalidateAllocation(engine->_allocator, frame.stats.allocation, 0, VK_WHOLE_SIZE);
+    const uint32_t* stats = (const uint32_t*)frame.stats.allocation->GetMappedData();
+    late_drawn_count = stats[0];
+    occluded_count = stats[1];
+
+    frame.pending = false;
+}
+
+void OcclusionCuller::create_pyramid(VkEngine* engine, const AllocatedImage& depth_image) {
+    // Power of two so every level halves exactly and a texel always covers whole texels of the level above
+    pyramid_width = previous_pow2(depth_image.image_extent.width);
+    pyramid_height = previous_pow2(depth_image.image_extent.height);
+
+    pyramid = engine->create_image(VkExtent3D { pyramid_width, pyramid_height, 1 }, VK_FORMAT_R32_SFLOAT,
+        VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT, true);
+
+    const uint32_t mip_count = static_cast<uint32_t>(std::floor(std::log2(std::max(pyramid_width, pyramid_height)))) + 1;
+    pyramid_mips.resize(mip_count);
+    for (uint32_t mip = 0; mip < mip_count; mip++) {
+        VkImageViewCreateInfo view_info = vkinit::image_view_create_info(VK_FORMAT_R32_SFLOAT, pyramid.image, VK_IMAGE_ASPECT_COLOR_BIT);
+        view_info.subresourceRange.baseMipLevel = mip;
+        view_info.subresourceRange.levelCount = 1;
+        VK_CHECK(vkCreateImageView(engine->_device, &view_info, nullptr, &pyramid_mips[mip]));
+    }
+
+    pyramid_source = depth_image.image;
+    pyramid_initialized = false;
+}
+
+void OcclusionCuller::destroy_pyramid(VkEngine* engine) {
+    for (VkImageView view : pyramid_mips) {
+        vkDestroyImageView(engine->_device, view, nullptr);
+    }
+    pyramid_mips.clear();
+
+    if (pyramid.image != VK_NULL_HANDLE) {
+        engine->destroy_image(pyramid);
+        pyramid = {};
+    }
+}
\ No newline at end of file
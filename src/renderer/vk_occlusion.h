@@ -0,0 +1,110 @@
+#pragma once
+
+#include <span>
+#include <vector>
+
+#include "vk_types.h"
+#include "vk_render_world.h"
+
+struct VkEngine;
+
+// Per draw input of `occlusion_cull.comp`, matches `DrawData` there (std430)
+struct OcclusionDraw {
+    glm::mat4 transform;
+    glm::vec4 origin;
+    glm::vec4 extents;
+    uint32_t visibility_id;
+    uint32_t index_count;
+    uint32_t first_index;
+    uint32_t transparent;
+};
+
+struct OcclusionCullPushConstants {
+    glm::mat4 view_proj;
+    glm::vec2 pyramid_size;
+    uint32_t draw_count;
+    uint32_t late;
+};
+
+struct DepthReducePushConstants {
+    glm::vec2 dst_size;
+    glm::vec2 src_scale;
+};
+
+// Two-phase hierarchical-Z occlusion culling of the draws that survived the frustum cull.
+// The GPU decides which draws are rasterized by writing their indirect commands:
+//  1. `record_early`: opaque draws that were visible last frame, they are drawn first as the occluders
+//  2. `record_late`: builds a depth pyramid from that depth buffer, tests every draw's bounds against it and
+//     writes commands for the opaque draws that became visible and for every unoccluded transparent draw
+// The result of the late test is kept per render handle id for the next frame's early phase, so moving
+// the camera or objects only costs a few extra late draws and never leaves holes.
+//
+// NOTE: Reverse-Z, each pyramid texel holds the farthest (smallest) depth under it
+struct OcclusionCuller {
+    void init(VkEngine* engine, uint32_t frame_count);
+
+    // Uploads this frame's draws, `opaque` and `transparent` are dense indices into `world`.
+    // The command of `opaque[i]` is at `command_offset(i)`, the one of `transparent[i]` at `command_offset(opaque.size() + i)`
+    void prepare(VkEngine* engine, uint32_t frame_index, const RenderWorld& world, std::span<const uint32_t> opaque,
+        std::span<const uint32_t> transparent);
+
+    // Both outside of a render pass. Between them the early commands are drawn into `depth_image`,
+    // which `record_late` expects in VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL
+    void record_early(VkEngine* engine, VkCommandBuffer cmd, uint32_t frame_index, const AllocatedImage& depth_image,
+        const glm::mat4& view_proj);
+    void record_late(VkEngine* engine, VkCommandBuffer cmd, uint32_t frame_index, const AllocatedImage& depth_image,
+        VkExtent2D draw_extent);
+
+    VkBuffer early_commands(uint32_t frame_index) const { return frames[frame_index].early_commands.buffer; }
+    VkBuffer late_commands(uint32_t frame_index) const { return frames[frame_index].late_commands.buffer; }
+    static VkDeviceSize command_offset(uint32_t draw) { return draw * sizeof(VkDrawIndexedIndirectCommand); }
+
+    // Must be called after waiting on the frame's fence
+    void collect(VkEngine* engine, uint32_t frame_index);
+
+    // Of the last collected frame
+    uint32_t occluded_count = 0;
+    uint32_t late_drawn_count = 0;
+
+private:
+    struct FrameResources {
+        AllocatedBuffer draws {};
+        AllocatedBuffer early_commands {};
+        AllocatedBuffer late_commands {};
+        AllocatedBuffer stats {};
+        uint32_t capacity = 0;
+        uint32_t draw_count = 0;
+        glm::mat4 view_proj;
+        VkDescriptorSet cull_set = VK_NULL_HANDLE;
+        bool pending = false;
+    };
+
+    void create_pyramid(VkEngine* engine, const AllocatedImage& depth_image);
+    void destroy_pyramid(VkEngine* engine);
+
+    std::vector<FrameResources> frames;
+
+    // Indexed by render handle id, shared by all frames since they execute in order on the queue
+    AllocatedBuffer visibility {};
+    uint32_t visibility_capacity = 0;
+    // Grown buffer whose contents still have to be copied over in the next `record_early`
+    AllocatedBuffer old_visibility {};
+    uint32_t old_visibility_capacity = 0;
+
+    AllocatedImage pyramid {};
+    std::vector<VkImageView> pyramid_mips;
+    uint32_t pyramid_width = 0;
+    uint32_t pyramid_height = 0;
+    // Depth image the pyramid was sized for
+    VkImage pyramid_source = VK_NULL_HANDLE;
+    bool pyramid_initialized = false;
+
+    VkSampler reduction_sampler = VK_NULL_HANDLE;
+
+    VkDescriptorSetLayout cull_set_layout = VK_NULL_HANDLE;
+    VkDescriptorSetLayout reduce_set_layout = VK_NULL_HANDLE;
+    VkPipelineLayout cull_layout = VK_NULL_HANDLE;
+    VkPipelineLayout reduce_layout = VK_NULL_HANDLE;
+    VkPipeline cull_pipeline = VK_NULL_HANDLE;
+    VkPipeline reduce_pipeline = VK_NULL_HANDLE;
+};
\ No newline at end of file
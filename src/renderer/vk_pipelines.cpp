@@ -4,32 +4,63 @@
 #include <vector>
 #include <fstream>
 #include <print>
+#include <cstring>
+#include <cstddef>
+
+namespace {
+    constexpr uint32_t pipeline_cache_magic = 0x43505454; // "TTPC"
+    // Bump when the layout of `PipelineCacheHeader` changes
+    constexpr uint32_t pipeline_cache_version = 2;
+
+    // Prepended to the driver's own cache data. Drivers validate their header too, but some are known to
+    // crash on stale data instead of rejecting it, so we never hand them a blob from another device or driver
+    struct PipelineCacheHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t vendor_id;
+        uint32_t device_id;
+        uint32_t driver_version;
+        uint8_t device_uuid[VK_UUID_SIZE];
+        uint8_t cache_uuid[VK_UUID_SIZE];
+        // Always 0, fills what would be padding before `data_size` so the header compares as plain bytes
+        uint32_t reserved;
+        uint64_t data_size;
+    };
+    static_assert(sizeof(PipelineCacheHeader) == 64, "PipelineCacheHeader must not have implicit padding");
+
+    PipelineCacheHeader make_pipeline_cache_header(VkPhysicalDevice gpu) {
+        VkPhysicalDeviceIDProperties id_properties{ .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES };
+        VkPhysicalDeviceProperties2 properties{ .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2 };
+        properties.pNext = &id_properties;
+        vkGetPhysicalDeviceProperties2(gpu, &properties);
+
+        PipelineCacheHeader header{};
+        header.magic = pipeline_cache_magic;
+        header.version = pipeline_cache_version;
+        header.vendor_id = properties.properties.vendorID;
+        header.device_id = properties.properties.deviceID;
+        header.driver_version = properties.properties.driverVersion;
+        header.reserved = 0;
+        std::memcpy(header.device_uuid, id_properties.deviceUUID, VK_UUID_SIZE);
+        std::memcpy(header.cache_uuid, properties.properties.pipelineCacheUUID, VK_UUID_SIZE);
+        return header;
+    }
+};
 
-bool vkutil::load_shader_module(const char* file_path,
+bool vkutil::load_shader_module(std::span<const uint32_t> code,
     VkDevice device,
     VkShaderModule* out_shader_module)
 {
-    // Open the file with cursor at the end
-    std::ifstream file(file_path, std::ios::ate | std::ios::binary);
-    if (!file.is_open()) {
+    if (code.empty()) {
         return false;
     }
 
-    size_t file_size_bytes = (size_t) file.tellg();
-
-    std::vector<uint32_t> buffer(file_size_bytes / sizeof(uint32_t));
-
-    // Read file into buffer
-    file.seekg(0);
-    file.read((char*) buffer.data(), file_size_bytes);
-    file.close();
-
     VkShaderModuleCreateInfo create_info = {};
     create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
     create_info.pNext = nullptr;
 
-    create_info.codeSize = buffer.size() * sizeof(uint32_t);
-    create_info.pCode = buffer.data();
+    create_info.codeSize = code.size_bytes();
+    create_info.pCode = code.data();
 
     VkShaderModule shader_module;
     if (vkCreateShaderModule(device, &create_info, nullptr, &shader_module) != VK_SUCCESS) {
@@ -41,6 +72,140 @@ bool vkutil::load_shader_module(const char* file_path,
     return true;
 }
 
+VkPipelineCache vkutil::load_pipeline_cache(VkDevice device, VkPhysicalDevice gpu, const std::filesystem::path& path)
+{
+    std::vector<char> data;
+
+    std::ifstream file(path, std::ios::binary);
+    if (file.is_open()) {
+        const PipelineCacheHeader expected = make_pipeline_cache_header(gpu);
+
+        PipelineCacheHeader header{};
+        file.read((char*) &header, sizeof(header));
+
+        // Compare everything but the data size
+        const bool matches = file.gcount() == sizeof(header) &&
+            std::memcmp(&header, &expected, offsetof(PipelineCacheHeader, data_size)) == 0;
+
+        if (matches) {
+            // The size comes from disk, never allocate more than the file actually holds
+            const std::streampos data_start = file.tellg();
+            file.seekg(0, std::ios::end);
+            const uint64_t remaining = (uint64_t) (file.tellg() - data_start);
+            file.seekg(data_start);
+
+            if (header.data_size <= remaining) {
+                data.resize(header.data_size);
+                file.read(data.data(), header.data_size);
+            }
+            if (header.data_size > remaining || (uint64_t) file.gcount() != header.data_size) {
+                std::print("Pipeline cache at {} is truncated, ignoring it\n", path.string());
+                data.clear();
+            }
+        } else {
+            std::print("Pipeline cache at {} is from another device or driver, ignoring it\n", path.string());
+        }
+    }
+
+    VkPipelineCacheCreateInfo create_info = { .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO };
+    create_info.initialDataSize = data.size();
+    create_info.pInitialData = data.empty() ? nullptr : data.data();
+
+    VkPipelineCache cache;
+    if (vkCreatePipelineCache(device, &create_info, nullptr, &cache) != VK_SUCCESS) {
+        // The driver can still refuse the data, fall back to an empty cache
+        create_info.initialDataSize = 0;
+        create_info.pInitialData = nullptr;
+        VK_CHECK(vkCreatePipelineCache(device, &create_info, nullptr, &cache));
+    }
+
+    if (!data.empty()) {
+        std::print("Loaded pipeline cache at: {} ({} bytes)\n", path.string(), data.size());
+    }
+
+    return cache;
+}
+
+bool vkutil::save_pipeline_cache(VkDevice device, VkPhysicalDevice gpu, VkPipelineCache cache, const std::filesystem::path& path)
+{
+    size_t data_size = 0;
+    if (vkGetPipelineCacheData(device, cache, &data_size, nullptr) != VK_SUCCESS || data_size == 0) {
+        return false;
+    }
+
+    std::vector<char> data(data_size);
+    if (vkGetPipelineCacheData(device, cache, &data_size, data.data()) != VK_SUCCESS) {
+        return false;
+    }
+
+    PipelineCacheHeader header = make_pipeline_cache_header(gpu);
+    header.data_size = data_size;
+
+    // Write next to the real file and swap it in, so a crash mid-write never leaves a corrupt cache behind
+    std::filesystem::path tmp_path = path;
+    tmp_path += ".tmp";
+    {
+        std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            std::print("Could not write pipeline cache at: {}\n", tmp_path.string());
+            return false;
+        }
+        file.write((const char*) &header, sizeof(header));
+        file.write(data.data(), data_size);
+    }
+
+    std::error_code error;
+    std::filesystem::rename(tmp_path, path, error);
+    if (error) {
+        std::print("Could not write pipeline cache at: {}\n", path.string());
+        return false;
+    }
+
+    return true;
+}
+
+VkPipeline vkutil::create_compute_pipeline(VkDevice device, VkPipelineCache cache, VkPipelineLayout layout,
+    std::span<const uint32_t> code)
+{
+    VkShaderModule module;
+    if (!vkutil::load_shader_module(code, device, &module)) {
+        std::print("Error when building the compute shader \n");
+        abort();
+    }
+
+    VkPipelineShaderStageCreateInfo stage_info { .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO };
+    stage_info.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    stage_info.module = module;
+    stage_info.pName = "main";
+
+    VkComputePipelineCreateInfo pipeline_info { .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+    pipeline_info.layout = layout;
+    pipeline_info.stage = stage_info;
+
+    VkPipeline pipeline;
+    VK_CHECK(vkCreateComputePipelines(device, cache, 1, &pipeline_info, nullptr, &pipeline));
+
+    vkDestroyShaderModule(device, module, nullptr);
+    return pipeline;
+}
+
+VkPipelineLayout vkutil::create_compute_layout(VkDevice device, VkDescriptorSetLayout set_layout, uint32_t push_constant_size)
+{
+    VkPushConstantRange push_constant {};
+    push_constant.offset = 0;
+    push_constant.size = push_constant_size;
+    push_constant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkPipelineLayoutCreateInfo layout_info { .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+    layout_info.setLayoutCount = 1;
+    layout_info.pSetLayouts = &set_layout;
+    layout_info.pushConstantRangeCount = 1;
+    layout_info.pPushConstantRanges = &push_constant;
+
+    VkPipelineLayout layout;
+    VK_CHECK(vkCreatePipelineLayout(device, &layout_info, nullptr, &layout));
+    return layout;
+}
 
 void PipelineBuilder::clear()
 {
@@ -58,10 +223,17 @@ void PipelineBuilder::clear()
 
     _rendering = { .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO };
 
+    _dynamic_raster_state = false;
+    _dynamic_polygon_mode = false;
+
+    _fragment_constants.clear();
+    _fragment_constant_entries.clear();
+    _fragment_specialization = {};
+
     _shader_stages.clear();
 }
 
-VkPipeline PipelineBuilder::build_pipeline(VkDevice device)
+VkPipeline PipelineBuilder::build_pipeline(VkDevice device, VkPipelineCache cache)
 {
     // Setup hard-coded pipeline states
 
@@ -87,16 +259,50 @@ VkPipeline PipelineBuilder::build_pipeline(VkDevice device)
 
     // Create Graphics Pipeline
 
-    VkDynamicState state[] = {
+    VkDynamicState state[6] = {
         VK_DYNAMIC_STATE_VIEWPORT,
         VK_DYNAMIC_STATE_SCISSOR
     };
+    uint32_t state_count = 2;
+
+    if (_dynamic_raster_state) {
+        state[state_count++] = VK_DYNAMIC_STATE_CULL_MODE;
+        state[state_count++] = VK_DYNAMIC_STATE_DEPTH_WRITE_ENABLE;
+        state[state_count++] = VK_DYNAMIC_STATE_DEPTH_COMPARE_OP;
+        if (_dynamic_polygon_mode) {
+            state[state_count++] = VK_DYNAMIC_STATE_POLYGON_MODE_EXT;
+        }
+    }
 
     VkPipelineDynamicStateCreateInfo dynamic_info = {};
     dynamic_info.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
     dynamic_info.pNext = nullptr;
     dynamic_info.pDynamicStates = &state[0];
-    dynamic_info.dynamicStateCount = 2;
+    dynamic_info.dynamicStateCount = state_count;
+
+    // NOTE: The builder may have been copied since the format was set, point back at our own member
+    if (_rendering.colorAttachmentCount > 0) {
+        _rendering.pColorAttachmentFormats = &_color_attachment_format;
+    }
+
+    // Same for the specialization info, it is rebuilt from our own vectors every time
+    if (!_fragment_constants.empty()) {
+        _fragment_constant_entries.resize(_fragment_constants.size());
+        for (uint32_t i = 0; i < _fragment_constants.size(); i++) {
+            _fragment_constant_entries[i] = { .constantID = i, .offset = i * (uint32_t) sizeof(uint32_t), .size = sizeof(uint32_t) };
+        }
+
+        _fragment_specialization.mapEntryCount = (uint32_t) _fragment_constant_entries.size();
+        _fragment_specialization.pMapEntries = _fragment_constant_entries.data();
+        _fragment_specialization.dataSize = _fragment_constants.size() * sizeof(uint32_t);
+        _fragment_specialization.pData = _fragment_constants.data();
+    }
+
+    for (VkPipelineShaderStageCreateInfo& stage : _shader_stages) {
+        if (stage.stage == VK_SHADER_STAGE_FRAGMENT_BIT) {
+            stage.pSpecializationInfo = _fragment_constants.empty() ? nullptr : &_fragment_specialization;
+        }
+    }
 
     // NOTE: Connect the RenderingInfo to the pnext chain
     VkGraphicsPipelineCreateInfo pipeline_info = {};
@@ -116,7 +322,7 @@ VkPipeline PipelineBuilder::build_pipeline(VkDevice device)
     pipeline_info.pDynamicState = &dynamic_info;
 
     VkPipeline new_pipeline;
-    if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipeline_info,
+    if (vkCreateGraphicsPipelines(device, cache, 1, &pipeline_info,
             nullptr, &new_pipeline) != VK_SUCCESS) {
         std::println("failed to create pipeline");
         return VK_NULL_HANDLE;
@@ -136,6 +342,11 @@ void PipelineBuilder::set_shaders(VkShaderModule vertex_shader, VkShaderModule f
         vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_FRAGMENT_BIT, fragment_shader));
 }
 
+void PipelineBuilder::set_fragment_constants(std::span<const uint32_t> constants)
+{
+    _fragment_constants.assign(constants.begin(), constants.end());
+}
+
 void PipelineBuilder::set_input_topology(VkPrimitiveTopology topology)
 {
     _input_assembly.topology = topology;
@@ -223,6 +434,12 @@ void PipelineBuilder::enable_depthtest(bool depth_write_enable, VkCompareOp op)
     _depth_stencil.maxDepthBounds = 1.f;
 }
 
+void PipelineBuilder::enable_dynamic_raster_state(bool dynamic_polygon_mode)
+{
+    _dynamic_raster_state = true;
+    _dynamic_polygon_mode = dynamic_polygon_mode;
+}
+
 void PipelineBuilder::set_color_attachment_format(VkFormat format)
 {
     _color_attachment_format = format;
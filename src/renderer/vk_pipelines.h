@@ -1,14 +1,28 @@
 #pragma once
 
 #include <vector>
+#include <span>
+#include <filesystem>
 
 #include "vk_types.h"
 
 namespace vkutil {
 
-bool load_shader_module(const char* file_path,
+// `code` is one of the SPIR-V arrays embedded at build time, see `shaders/<name>.spv.h`
+bool load_shader_module(std::span<const uint32_t> code,
     VkDevice device,
     VkShaderModule* out_shader_module);
+
+// Creates a pipeline cache seeded with the data at `path`, if it was written for this exact device and driver.
+// Otherwise the cache starts empty and pipelines get compiled from scratch
+VkPipelineCache load_pipeline_cache(VkDevice device, VkPhysicalDevice gpu, const std::filesystem::path& path);
+bool save_pipeline_cache(VkDevice device, VkPhysicalDevice gpu, VkPipelineCache cache, const std::filesystem::path& path);
+
+// Aborts if the shader module can't be created
+VkPipeline create_compute_pipeline(VkDevice device, VkPipelineCache cache, VkPipelineLayout layout,
+    std::span<const uint32_t> code);
+// One descriptor set and a push constant range starting at 0, both for the compute stage
+VkPipelineLayout create_compute_layout(VkDevice device, VkDescriptorSetLayout set_layout, uint32_t push_constant_size);
     
 };
 
@@ -24,6 +38,16 @@ struct PipelineBuilder {
     VkPipelineRenderingCreateInfo _rendering;
     VkFormat _color_attachment_format;
 
+    // Cull mode and depth write/compare are set with vkCmdSet* at bind time (core in 1.3),
+    // polygon mode too when VK_EXT_extended_dynamic_state3 is available
+    bool _dynamic_raster_state;
+    bool _dynamic_polygon_mode;
+
+    // Fragment shader specialization constants, `constant_id = i` is `_fragment_constants[i]`
+    std::vector<uint32_t> _fragment_constants;
+    std::vector<VkSpecializationMapEntry> _fragment_constant_entries;
+    VkSpecializationInfo _fragment_specialization;
+
 	PipelineBuilder() { 
         clear(); 
     }
@@ -31,6 +55,7 @@ struct PipelineBuilder {
     void clear();
 
     void set_shaders(VkShaderModule vertex_shader, VkShaderModule fragment_shader);
+    void set_fragment_constants(std::span<const uint32_t> constants);
     void set_input_topology(VkPrimitiveTopology topology);
     void set_polygon_mode(VkPolygonMode mode);
     void set_cull_mode(VkCullModeFlags cull_mode, VkFrontFace front_face);
@@ -46,5 +71,7 @@ struct PipelineBuilder {
     void disable_depthtest();
     void enable_depthtest(bool depth_write_enable, VkCompareOp op);
 
-    VkPipeline build_pipeline(VkDevice device);
+    void enable_dynamic_raster_state(bool dynamic_polygon_mode);
+
+    VkPipeline build_pipeline(VkDevice device, VkPipelineCache cache = VK_NULL_HANDLE);
 };
@@ -0,0 +1,263 @@
+#include "vk_render_world.h"
+
+#include "../defs.h"
+
+#include <algorithm>
+#include <array>
+
+RenderHandle RenderWorld::add(const RenderObject& object, TransformHandle transform) {
+    RenderHandle handle;
+    if (!free_handles.empty()) {
+        handle.id = free_handles.back();
+        free_handles.pop_back();
+    } else {
+        handle.id = static_cast<uint32_t>(handle_to_dense.size());
+        handle_to_dense.push_back(no_record);
+        record_transforms.emplace_back();
+        next_with_transform.push_back(no_record);
+    }
+
+    handle_to_dense[handle.id] = size();
+    handles.push_back(handle.id);
+
+    transforms.push_back(object.transform);
+    bounds.push_back(object.bounds);
+    materials.push_back(object.material);
+    index_buffers.push_back(object.index_buffer);
+    first_indices.push_back(object.first_index);
+    index_counts.push_back(object.index_count);
+    vertex_buffer_addresses.push_back(object.vertex_buffer_address);
+    lods.push_back(object.lods);
+    lod_levels.push_back(0);
+    meshlet_addresses.push_back(object.meshlet_address);
+    meshlet_counts.push_back(object.meshlet_count);
+    tree_dirty = true;
+    structure_version++;
+
+    // Push to the front of the transform's list
+    record_transforms[handle.id] = transform;
+    next_with_transform[handle.id] = no_record;
+    if (transform.valid()) {
+        if (transform.id >= transform_first_record.size()) {
+            transform_first_record.resize(transform.id + 1, no_record);
+        }
+        next_with_transform[handle.id] = transform_first_record[transform.id];
+        transform_first_record[transform.id] = handle.id;
+    }
+
+    return handle;
+}
+
+void RenderWorld::remove(RenderHandle handle) {
+    const uint32_t dense = index(handle);
+
+    // Unlink from the transform's list
+    const TransformHandle transform = record_transforms[handle.id];
+    if (transform.valid()) {
+        uint32_t* link = &transform_first_record[transform.id];
+        while (*link != handle.id) {
+            link = &next_with_transform[*link];
+        }
+        *link = next_with_transform[handle.id];
+    }
+
+    // Swap with the last record to keep the arrays dense
+    const uint32_t last = size() - 1;
+    if (dense != last) {
+        transforms[dense] = transforms[last];
+        bounds[dense] = bounds[last];
+        materials[dense] = materials[last];
+        index_buffers[dense] = index_buffers[last];
+        first_indices[dense] = first_indices[last];
+        index_counts[dense] = index_counts[last];
+        vertex_buffer_addresses[dense] = vertex_buffer_addresses[last];
+        lods[dense] = lods[last];
+        lod_levels[dense] = lod_levels[last];
+        meshlet_addresses[dense] = meshlet_addresses[last];
+        meshlet_counts[dense] = meshlet_counts[last];
+        handles[dense] = handles[last];
+        handle_to_dense[handles[dense]] = dense;
+    }
+
+    transforms.pop_back();
+    bounds.pop_back();
+    materials.pop_back();
+    index_buffers.pop_back();
+    first_indices.pop_back();
+    index_counts.pop_back();
+    vertex_buffer_addresses.pop_back();
+    lods.pop_back();
+    lod_levels.pop_back();
+    meshlet_addresses.pop_back();
+    meshlet_counts.pop_back();
+    handles.pop_back();
+
+    handle_to_dense[handle.id] = no_record;
+    record_transforms[handle.id] = {};
+    free_handles.push_back(handle.id);
+    tree_dirty = true;
+    structure_version++;
+}
+
+void RenderWorld::set_material(RenderHandle handle, MaterialInstance* material) {
+    materials[index(handle)] = material;
+    structure_version++;
+}
+
+void RenderWorld::set_transform(RenderHandle handle, const glm::mat4& transform) {
+    const uint32_t i = index(handle);
+    transforms[i] = transform;
+    if (!tree_dirty) {
+        tree.update(handle.id, world_bounds(i));
+    }
+    mark_moved(handle.id);
+}
+
+void RenderWorld::set_lod_level(uint32_t index, uint32_t level) {
+    M_Assert(level < lods[index].size(), "Record has no such level of detail");
+
+    // NOTE: The draw order doesn't depend on the index range, so this is not a structural change
+    const SurfaceLod& lod = lods[index][level];
+    first_indices[index] = lod.first_index;
+    index_counts[index] = lod.index_count;
+    lod_levels[index] = static_cast<uint8_t>(level);
+}
+
+void RenderWorld::sync_transforms(const TransformHierarchy& hierarchy) {
+    for (const TransformHandle transform : hierarchy.changed_transforms()) {
+        if (transform.id >= transform_first_record.size()) {
+            continue;
+        }
+
+        for (uint32_t record = transform_first_record[transform.id]; record != no_record; record = next_with_transform[record]) {
+            const uint32_t i = handle_to_dense[record];
+            transforms[i] = hierarchy.world(transform);
+            if (!tree_dirty) {
+                tree.update(record, world_bounds(i));
+            }
+            mark_moved(record);
+        }
+    }
+}
+
+void RenderWorld::update_bvh() {
+    if (!tree_dirty) {
+        tree.refit();
+        return;
+    }
+
+    std::vector<AABB> world(size());
+    for (uint32_t i = 0; i < size(); i++) {
+        world[i] = world_bounds(i);
+    }
+    tree.build(world, handles);
+    tree_dirty = false;
+}
+
+void RenderWorld::cull(const glm::mat4& view_proj, std::vector<uint32_t>& out_indices) const {
+    M_Assert(!tree_dirty, "RenderWorld::update_bvh has to run before culling");
+
+    const size_t first = out_indices.size();
+    tree.cull(Frustum::from_view_proj(view_proj), out_indices);
+
+    // The tree hands back handle ids, draws index the dense arrays
+    for (size_t i = first; i < out_indices.size(); i++) {
+        out_indices[i] = handle_to_dense[out_indices[i]];
+    }
+}
+
+std::optional<RayHit> RenderWorld::raycast(const Ray& ray, float max_t) const {
+    M_Assert(!tree_dirty, "RenderWorld::update_bvh has to run before raycasts");
+    return tree.raycast(ray, max_t);
+}
+
+AABB RenderWorld::world_bounds(uint32_t index) const {
+    return transform_aabb(bounds[index].origin, bounds[index].extents, transforms[index]);
+}
+
+void RenderWorld::mark_moved(uint32_t handle_id) {
+    // Nobody consumed the list for a while, more moved than there are records. Report a structural change instead
+    // so consumers rebuild from scratch, and keep the list bounded
+    if (moved.size() >= size()) {
+        moved.clear();
+        structure_version++;
+        return;
+    }
+    moved.push_back(handle_id);
+}
+
+uint32_t RenderWorld::index(RenderHandle handle) const {
+    M_Assert(handle.valid() && handle.id < handle_to_dense.size() && handle_to_dense[handle.id] != no_record,
+        "Render handle is not alive");
+    return handle_to_dense[handle.id];
+}
+
+bool is_visible(const Bounds& bounds, const glm::mat4& transform, const glm::mat4& view_proj) {
+    // Create the 8 corners of the mesh-space bounding box, with the bounds x: [-1, 1], y: [-1, 1], z: [-1, 1]
+    std::array<glm::vec3, 8> corners {
+        glm::vec3 { 1, 1, 1 },
+        glm::vec3 { 1, 1, -1 },
+        glm::vec3 { 1, -1, 1 },
+        glm::vec3 { 1, -1, -1 },
+        glm::vec3 { -1, 1, 1 },
+        glm::vec3 { -1, 1, -1 },
+        glm::vec3 { -1, -1, 1 },
+        glm::vec3 { -1, -1, -1 },
+    };
+
+    const glm::mat4 matrix = view_proj * transform;
+
+    // Initial min/max bounds outside mesh bounding box
+    glm::vec3 min = { 1.5, 1.5, 1.5 };
+    glm::vec3 max = { -1.5, -1.5, -1.5 };
+
+    for (int c = 0; c < 8; c++) {
+        // Project each corner into clip space
+        glm::vec3 corner_extent = corners[c] * bounds.extents;
+        glm::vec4 v = matrix * glm::vec4(bounds.origin + corner_extent, 1.f);
+
+        // Perspective correction
+        v.x = v.x / v.w;
+        v.y = v.y / v.w;
+        v.z = v.z / v.w;
+
+        min = glm::min(glm::vec3 { v.x, v.y, v.z }, min);
+        max = glm::max(glm::vec3 { v.x, v.y, v.z }, max);
+    }
+
+    if (min.z > 1.f || max.z < 0.f || min.x > 1.f || max.x < -1.f || min.y > 1.f || max.y < -1.f) {
+        return false;
+    } else {
+        return true;
+    }
+}
+
+float distance_to_camera(const Bounds& bounds, const glm::mat4& transform, const PerspectiveCamera& camera) {
+    const glm::vec3 origin = transform * glm::vec4(bounds.origin, 1.f);
+    return glm::length(origin - camera.position);
+}
+
+bool opaque_draw_before(const RenderWorld& world, uint32_t a, uint32_t b) {
+    if (world.materials[a] == world.materials[b]) {
+        return world.index_buffers[a] < world.index_buffers[b];
+    } else {
+        return world.materials[a] < world.materials[b];
+    }
+}
+
+bool transparent_draw_before(const RenderWorld& world, const PerspectiveCamera& camera, uint32_t a, uint32_t b) {
+    return distance_to_camera(world.bounds[a], world.transforms[a], camera) >
+        distance_to_camera(world.bounds[b], world.transforms[b], camera);
+}
+
+void sort_opaque_draws(std::vector<uint32_t>& draws, const RenderWorld& world) {
+    std::sort(draws.begin(), draws.end(), [&](const auto& iA, const auto& iB) {
+        return opaque_draw_before(world, iA, iB);
+    });
+}
+
+void sort_transparent_draws(std::vector<uint32_t>& draws, const RenderWorld& world, const PerspectiveCamera& camera) {
+    std::sort(draws.begin(), draws.end(), [&](const auto& iA, const auto& iB) {
+        return transparent_draw_before(world, camera, iA, iB);
+    });
+}
\ No newline at end of file
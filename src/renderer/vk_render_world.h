@@ -0,0 +1,156 @@
+#pragma once
+
+#include "vk_types.h"
+#include "vk_material.h"
+#include "camera.h"
+
+#include "../scene/transform_hierarchy.h"
+#include "../scene/bvh.h"
+
+#include <optional>
+#include <span>
+#include <vector>
+
+struct Bounds {
+    glm::vec3 origin;
+    float sphere_radius;
+    glm::vec3 extents;
+};
+
+// Levels of detail of a surface are ranges of the same index buffer, from the full surface to the coarsest
+constexpr uint32_t max_lod_count = 4;
+
+struct SurfaceLod {
+    uint32_t first_index;
+    uint32_t index_count;
+    // Object space distance the simplified surface deviates from the full one by, 0 for the full surface
+    float error;
+};
+
+// Everything needed to draw one surface, copied into the draw records by `RenderWorld::add`
+struct RenderObject {
+    uint32_t index_count;
+    uint32_t first_index;
+    VkBuffer index_buffer;
+    
+    Bounds bounds;
+    // Empty, or every level with the first being `first_index`/`index_count`. Must outlive the record
+    std::span<const SurfaceLod> lods;
+
+    MaterialInstance* material;
+
+    glm::mat4 transform;
+    VkDeviceAddress vertex_buffer_address;
+
+    // The surface's meshlets, see `ClusterCuller`. None for surfaces that are culled as a whole
+    VkDeviceAddress meshlet_address = 0;
+    uint32_t meshlet_count = 0;
+};
+
+// Stable id of a surface registered in a `RenderWorld`
+struct RenderHandle {
+    static constexpr uint32_t invalid = UINT32_MAX;
+    uint32_t id = invalid;
+
+    bool valid() const { return id != invalid; }
+};
+
+// Retained draw records. Surfaces are registered once and only touched again when their transform or
+// material changes, instead of every frame rebuilding the list from the scene graph.
+// Records are stored as dense parallel arrays, culling only reads `transforms` and `bounds`.
+//
+// World space bounds are kept in a BVH, rebuilt after records are added or removed and refit as transforms change.
+//
+// NOTE: Dense indices move when a record is removed (swap with the last one), hold on to the handle instead
+struct RenderWorld {
+    // If `transform` is valid the record follows it through `sync_transforms`, `object.transform` is the initial value
+    RenderHandle add(const RenderObject& object, TransformHandle transform = {});
+    void remove(RenderHandle handle);
+
+    void set_material(RenderHandle handle, MaterialInstance* material);
+    void set_transform(RenderHandle handle, const glm::mat4& transform);
+    // Points the record at the index range of one of its levels of detail, see `LodSelector`
+    void set_lod_level(uint32_t index, uint32_t level);
+
+    // Copies the world matrices of the transforms the last `TransformHierarchy::update` recomputed,
+    // cost scales with what moved and not with the number of records
+    void sync_transforms(const TransformHierarchy& hierarchy);
+
+    // Call once per frame after the transforms are synced and before `cull` or `raycast`
+    void update_bvh();
+    // Appends the dense index of every record whose world bounds intersect the view frustum
+    void cull(const glm::mat4& view_proj, std::vector<uint32_t>& out_indices) const;
+    // Closest record whose world bounds the ray hits within [0, max_t], `RayHit::id` is the handle id
+    std::optional<RayHit> raycast(const Ray& ray, float max_t = FLT_MAX) const;
+    const Bvh& bvh() const { return tree; }
+
+    uint32_t size() const { return static_cast<uint32_t>(handles.size()); }
+    // Current dense index of a record
+    uint32_t index(RenderHandle handle) const;
+    // Handle id of the record at a dense index
+    uint32_t handle_id(uint32_t index) const { return handles[index]; }
+    // Upper bound of every live handle id, for per-handle data kept outside the world
+    uint32_t handle_capacity() const { return static_cast<uint32_t>(handle_to_dense.size()); }
+    AABB world_bounds(uint32_t index) const;
+
+    // Bumped whenever records are added, removed or change material, anything derived from the dense indices
+    // or the material order has to be rebuilt
+    uint64_t version() const { return structure_version; }
+    // Handle ids whose transform changed since the last `clear_moved`, may hold duplicates
+    const std::vector<uint32_t>& moved_handles() const { return moved; }
+    void clear_moved() { moved.clear(); }
+
+    // Dense, indexed by draw record
+    std::vector<glm::mat4> transforms;
+    std::vector<Bounds> bounds;
+    std::vector<MaterialInstance*> materials;
+    std::vector<VkBuffer> index_buffers;
+    std::vector<uint32_t> first_indices;
+    std::vector<uint32_t> index_counts;
+    std::vector<VkDeviceAddress> vertex_buffer_addresses;
+    std::vector<std::span<const SurfaceLod>> lods;
+    // Level `first_indices` and `index_counts` currently point at
+    std::vector<uint8_t> lod_levels;
+    std::vector<VkDeviceAddress> meshlet_addresses;
+    std::vector<uint32_t> meshlet_counts;
+
+private:
+    static constexpr uint32_t no_record = UINT32_MAX;
+
+    void mark_moved(uint32_t handle_id);
+
+    // Items are handle ids, so they survive the swap-remove of the dense arrays
+    Bvh tree;
+    // Structural change since the last build, refitting can't add or remove items
+    bool tree_dirty = true;
+
+    uint64_t structure_version = 0;
+    std::vector<uint32_t> moved;
+
+    // Dense, handle id of every record
+    std::vector<uint32_t> handles;
+
+    // Sparse, indexed by handle id
+    std::vector<uint32_t> handle_to_dense;
+    std::vector<TransformHandle> record_transforms;
+    // Records that share a transform form a singly linked list of handle ids
+    std::vector<uint32_t> next_with_transform;
+    std::vector<uint32_t> free_handles;
+
+    // Sparse, indexed by transform handle id, first record following that transform
+    std::vector<uint32_t> transform_first_record;
+};
+
+bool is_visible(const Bounds& bounds, const glm::mat4& transform, const glm::mat4& view_proj);
+// From the world space center of the bounds, `bounds` being in the local space of `transform`
+float distance_to_camera(const Bounds& bounds, const glm::mat4& transform, const PerspectiveCamera& camera);
+
+// Draw order comparators, `a` and `b` are dense indices into `world`
+bool opaque_draw_before(const RenderWorld& world, uint32_t a, uint32_t b);
+// NOTE: Farthest first, alpha blending composites each transparent surface over the ones behind it
+bool transparent_draw_before(const RenderWorld& world, const PerspectiveCamera& camera, uint32_t a, uint32_t b);
+
+// Sort opaque draws (dense indices into `world`) by material and then index buffer to minimize state changes
+void sort_opaque_draws(std::vector<uint32_t>& draws, const RenderWorld& world);
+// Sort transparent draws (dense indices into `world`) back-to-front from the camera
+void sort_transparent_draws(std::vector<uint32_t>& draws, const RenderWorld& world, const PerspectiveCamera& camera);
\ No newline at end of file
@@ -2,6 +2,19 @@
 
 #include "vk_renderable.h"
 #include "vk_engine.h"
+#include "vk_gltf_mesh.h"
+#include "vk_ktx2.h"
+#include "vk_mesh_cache.h"
+#include "../geometry/optimize_mesh.h"
+#include "../profiler/profiler.h"
+#include "../core/task_graph.h"
+#include "../core/hash.h"
+#include "../core/mapped_file.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <span>
 
 #include <fastgltf/glm_element_traits.hpp>
 #include <fastgltf/core.hpp>
@@ -45,104 +58,332 @@ namespace {
         }
     }
 
-	std::optional<AllocatedImage> load_image(VkEngine* engine, fastgltf::Asset& asset, fastgltf::Image& image)
+	std::vector<uint8_t> read_file(const std::filesystem::path& path)
 	{
-		AllocatedImage new_image {};
+		std::ifstream file(path, std::ios::binary | std::ios::ate);
+		if (!file) {
+			return {};
+		}
+		std::vector<uint8_t> bytes(static_cast<size_t>(file.tellg()));
+		file.seekg(0);
+		file.read(reinterpret_cast<char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+		return bytes;
+	}
 
-		int width, height, nr_channels;
+	// A glTF image waiting to be decoded on a worker, straight into its slice of the shared staging buffer
+	struct PendingImage {
+		// Contents of the file for URI sources
+		std::vector<uint8_t> source_file;
+		// The encoded image, in `source_file` or in the buffers loaded with the asset
+		std::span<const stbi_uc> encoded;
+		// Block compressed version from `td_texture_bake`, copied as is instead of decoding `encoded`
+		std::vector<uint8_t> baked_file;
+		std::optional<Ktx2Texture> baked;
+		int width = 0;
+		int height = 0;
+		VkDeviceSize staging_offset = 0;
+		VkDeviceSize staging_size = 0;
+		bool decoded = false;
+	};
+
+	// Finds the encoded image and reads its size from the header or the baked texture, without decoding anything
+	bool probe_image(VkEngine* engine, const MeshCache& cache, const CachedImage& image, const std::filesystem::path& gltf_dir,
+		PendingImage& pending)
+	{
+		int nr_channels;
+
+		if (image.uri.length > 0) {
+			pending.source_file = read_file(gltf_image_path(gltf_dir, cache.string(image.uri)));
+			pending.encoded = pending.source_file;
+		} else {
+			pending.encoded = cache.image_data.subspan(image.data_offset, image.data_size);
+		}
 
-		std::visit(
-			fastgltf::visitor {
-				[](auto& arg) {},
-				[&](fastgltf::sources::URI& filePath) {
-					std::print("URI source.\n");
+		if (pending.encoded.empty()) {
+			return false;
+		}
 
-					// We don't support offsets with stbi.
-					assert(filePath.fileByteOffset == 0);
-					// We're only capable of loading local files
-					assert(filePath.uri.isLocalPath());
+		// NOTE: Falls back to decoding when the device can't sample the baked format or the file is not one we can upload as is
+		const std::filesystem::path baked_path = baked_texture_path(gltf_dir, pending.encoded);
+		if (std::filesystem::exists(baked_path)) {
+			pending.baked_file = read_file(baked_path);
+			pending.baked = parse_ktx2(pending.baked_file);
+			if (pending.baked && (!engine->supports_sampled_format(pending.baked->format) ||
+				pending.baked->levels.size() != full_mip_count(pending.baked->width, pending.baked->height))) {
+				pending.baked.reset();
+			}
+		}
 
-					const std::string path(filePath.uri.path().begin(), filePath.uri.path().end());
-					unsigned char* data = stbi_load(path.c_str(), &width, &height, &nr_channels, 4);
-					if (data) {
-						VkExtent3D imagesize;
-						imagesize.width = width;
-						imagesize.height = height;
-						imagesize.depth = 1;
+		if (pending.baked) {
+			pending.width = static_cast<int>(pending.baked->width);
+			pending.height = static_cast<int>(pending.baked->height);
+			for (std::span<const uint8_t> level : pending.baked->levels) {
+				pending.staging_size += level.size();
+			}
+			return true;
+		}
 
-						new_image = engine->create_image(data, imagesize, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT,false);
+		if (stbi_info_from_memory(pending.encoded.data(), static_cast<int>(pending.encoded.size()),
+			&pending.width, &pending.height, &nr_channels) == 0) {
+			return false;
+		}
+		pending.staging_size = VkDeviceSize(pending.width) * pending.height * 4;
+		return true;
+	}
 
-						stbi_image_free(data);
-					}
+	// Runs on a worker, `staging` is the persistently mapped staging buffer shared by every image of the file
+	void decode_image(PendingImage& pending, uint8_t* staging)
+	{
+		if (pending.baked) {
+			uint8_t* dst = staging + pending.staging_offset;
+			for (std::span<const uint8_t> level : pending.baked->levels) {
+				memcpy(dst, level.data(), level.size());
+				dst += level.size();
+			}
+			pending.decoded = true;
+			return;
+		}
+
+		int width, height, nr_channels;
+		stbi_uc* data = stbi_load_from_memory(pending.encoded.data(), static_cast<int>(pending.encoded.size()),
+			&width, &height, &nr_channels, 4);
+
+		// NOTE: stb_image always hands back its own allocation, the one copy left goes straight into mapped
+		// staging memory from this thread instead of through a per-image upload buffer
+		if (data && width == pending.width && height == pending.height) {
+			memcpy(staging + pending.staging_offset, data, size_t(width) * height * 4);
+			pending.decoded = true;
+		}
+
+		stbi_image_free(data);
+	}
+
+	// Everything `LoadedGLTF::load_gltf` needs from the parsed glTF, vertices converted to our layout
+	void cook_gltf(fastgltf::Asset& gltf, std::string_view name, MeshCacheData& cooked)
+	{
+		PROFILE_SCOPE("cook_gltf");
+
+		for (const fastgltf::Sampler& sampler : gltf.samplers) {
+			cooked.samplers.push_back(CachedSampler {
+				.mag_filter = extract_filter(sampler.magFilter.value_or(fastgltf::Filter::Nearest)),
+				.min_filter = extract_filter(sampler.minFilter.value_or(fastgltf::Filter::Nearest)),
+				.mipmap_mode = extract_mipmap_mode(sampler.minFilter.value_or(fastgltf::Filter::Nearest)),
+			});
+		}
+
+		for (fastgltf::Image& image : gltf.images) {
+			CachedImage cached {};
+			cached.name = cooked.add_string(image.name);
+
+			const auto add_data = [&](const auto* bytes, size_t size) {
+				cached.data_offset = cooked.image_data.size();
+				cached.data_size = size;
+				cooked.image_data.insert(cooked.image_data.end(), (const uint8_t*) bytes, (const uint8_t*) bytes + size);
+			};
+
+			std::visit(
+				fastgltf::visitor {
+					[](auto& arg) {},
+					[&](fastgltf::sources::URI& filePath) {
+						// We don't support offsets with stbi.
+						assert(filePath.fileByteOffset == 0);
+						// We're only capable of loading local files
+						assert(filePath.uri.isLocalPath());
+
+						cached.uri = cooked.add_string(filePath.uri.path());
+					},
+					[&](fastgltf::sources::Vector& vector) {
+						add_data(vector.bytes.data(), vector.bytes.size());
+					},
+					[&](fastgltf::sources::BufferView& view) {
+						fastgltf::BufferView& bufferView = gltf.bufferViews[view.bufferViewIndex];
+						fastgltf::Buffer& buffer = gltf.buffers[bufferView.bufferIndex];
+
+						// We only care about VectorWithMime here, because we specify LoadExternalBuffers, meaning all buffers
+						// are already loaded into a vector.
+						std::visit(
+							fastgltf::visitor {
+								[](auto& arg) {
+									std::print("Fallback Buffer data source.\n");
+								},
+								[&](fastgltf::sources::Array& array) {
+									add_data(array.bytes.data() + bufferView.byteOffset, bufferView.byteLength);
+								},
+							},
+							buffer.data
+						);
+					},
 				},
-				[&](fastgltf::sources::Vector& vector) {
-					std::print("Vector source.\n");
-
-					unsigned char* data = stbi_load_from_memory(
-						(stbi_uc*) vector.bytes.data(), static_cast<int>(vector.bytes.size()),
-						&width, &height, &nr_channels, 4
-					);
-					if (data) {
-						VkExtent3D imagesize;
-						imagesize.width = width;
-						imagesize.height = height;
-						imagesize.depth = 1;
-
-						new_image = engine->create_image(data, imagesize, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT,false);
-
-						stbi_image_free(data);
+				image.data
+			);
+
+			cooked.images.push_back(cached);
+		}
+
+		for (fastgltf::Material& mat : gltf.materials) {
+			CachedMaterial cached {};
+			cached.name = cooked.add_string(mat.name);
+			cached.color_factors = glm::vec4(mat.pbrData.baseColorFactor[0], mat.pbrData.baseColorFactor[1],
+				mat.pbrData.baseColorFactor[2], mat.pbrData.baseColorFactor[3]);
+			cached.metal_rough_factors = glm::vec4(mat.pbrData.metallicFactor, mat.pbrData.roughnessFactor, 0.f, 0.f);
+			cached.alpha_blend = mat.alphaMode == fastgltf::AlphaMode::Blend;
+			cached.double_sided = mat.doubleSided;
+			cached.color_image = -1;
+			cached.color_sampler = -1;
+
+			if (mat.pbrData.baseColorTexture.has_value()) {
+				const fastgltf::Texture& texture = gltf.textures[mat.pbrData.baseColorTexture.value().textureIndex];
+				cached.color_image = static_cast<int32_t>(texture.imageIndex.value());
+				cached.color_sampler = static_cast<int32_t>(texture.samplerIndex.value());
+			}
+
+			cooked.materials.push_back(cached);
+		}
+
+		// use the same vectors for all meshes so that the memory doesnt reallocate as
+		// often
+		std::vector<uint32_t> indices;
+		std::vector<Vertex> vertices;
+		std::vector<IndexRange> surface_ranges;
+		MeshStats stats_before;
+		MeshStats stats_after;
+
+		for (const fastgltf::Mesh& mesh : gltf.meshes) {
+			PROFILE_SCOPE("load_mesh");
+
+			// clear the mesh arrays each mesh, we dont want to merge them by error
+			indices.clear();
+			vertices.clear();
+			surface_ranges.clear();
+
+			CachedMesh cached {};
+			cached.name = cooked.add_string(mesh.name);
+			cached.first_surface = static_cast<uint32_t>(cooked.surfaces.size());
+
+			for (const fastgltf::Primitive& p : mesh.primitives) {
+				CachedSurface new_surface {};
+				new_surface.start_index = (uint32_t)indices.size();
+				new_surface.count = (uint32_t)gltf.accessors[p.indicesAccessor.value()].count;
+				new_surface.bounds = gltf_mesh::append_primitive(gltf, p, indices, vertices);
+				new_surface.material = static_cast<uint32_t>(p.materialIndex.value_or(0));
+
+				cooked.surfaces.push_back(new_surface);
+				surface_ranges.push_back({ new_surface.start_index, new_surface.count });
+			}
+
+			stats_before.add(analyze_mesh(indices, vertices));
+			optimize_mesh(indices, vertices, surface_ranges);
+
+			// Only the full surface is split, the simplified levels are too small on screen to be worth it
+			cached.first_meshlet = static_cast<uint32_t>(cooked.meshlets.size());
+			for (uint32_t i = cached.first_surface; i < cooked.surfaces.size(); i++) {
+				CachedSurface& surface = cooked.surfaces[i];
+				const bool double_sided = surface.material < gltf.materials.size() && gltf.materials[surface.material].doubleSided;
+				surface.first_meshlet = static_cast<uint32_t>(cooked.meshlets.size()) - cached.first_meshlet;
+				build_meshlets(indices, vertices, { surface.start_index, surface.count }, double_sided, cooked.meshlets);
+				surface.meshlet_count = static_cast<uint32_t>(cooked.meshlets.size()) - cached.first_meshlet - surface.first_meshlet;
+			}
+			cached.meshlet_count = static_cast<uint32_t>(cooked.meshlets.size()) - cached.first_meshlet;
+
+			stats_after.add(analyze_mesh(indices, vertices));
+
+			// Simplified levels go after the optimized indices, in the same index buffer
+			for (uint32_t i = cached.first_surface; i < cooked.surfaces.size(); i++) {
+				CachedSurface& surface = cooked.surfaces[i];
+				surface.first_lod = static_cast<uint32_t>(cooked.lods.size());
+				generate_lods(indices, vertices, { surface.start_index, surface.count }, cooked.lods);
+				surface.lod_count = static_cast<uint32_t>(cooked.lods.size()) - surface.first_lod;
+			}
+
+			cached.surface_count = static_cast<uint32_t>(cooked.surfaces.size()) - cached.first_surface;
+			cached.first_vertex = static_cast<uint32_t>(cooked.vertices.size());
+			cached.vertex_count = static_cast<uint32_t>(vertices.size());
+			cached.first_index = static_cast<uint32_t>(cooked.indices.size());
+			cached.index_count = static_cast<uint32_t>(indices.size());
+			cooked.vertices.insert(cooked.vertices.end(), vertices.begin(), vertices.end());
+			cooked.indices.insert(cooked.indices.end(), indices.begin(), indices.end());
+
+			cooked.meshes.push_back(cached);
+		}
+
+		print_mesh_stats(name, stats_before, stats_after);
+
+		for (fastgltf::Node& node : gltf.nodes) {
+			CachedNode cached {};
+			cached.name = cooked.add_string(node.name);
+			cached.mesh = node.meshIndex.has_value() ? static_cast<int32_t>(*node.meshIndex) : -1;
+			cached.parent = -1;
+
+			std::visit(
+				fastgltf::visitor {
+					[&](fastgltf::math::fmat4x4 matrix) {
+						memcpy(&cached.local_transform, matrix.data(), sizeof(matrix));
+					},
+					[&](fastgltf::TRS transform) {
+						glm::vec3 tl(transform.translation[0], transform.translation[1],
+							transform.translation[2]);
+						glm::quat rot(transform.rotation[3], transform.rotation[0], transform.rotation[1],
+							transform.rotation[2]);
+						glm::vec3 sc(transform.scale[0], transform.scale[1], transform.scale[2]);
+
+						glm::mat4 tm = glm::translate(glm::mat4(1.f), tl);
+						glm::mat4 rm = glm::toMat4(rot);
+						glm::mat4 sm = glm::scale(glm::mat4(1.f), sc);
+
+						cached.local_transform = tm * rm * sm;
 					}
 				},
-				[&](fastgltf::sources::BufferView& view) {
-					std::print("BufferView source.\n");
-
-					fastgltf::BufferView& bufferView = asset.bufferViews[view.bufferViewIndex];
-					fastgltf::Buffer& buffer = asset.buffers[bufferView.bufferIndex];
-
-					// We only care about VectorWithMime here, because we specify LoadExternalBuffers, meaning all buffers
-					// are already loaded into a vector.
-					std::visit(
-						fastgltf::visitor {
-							[](auto& arg) {
-								std::print("Fallback Buffer data source.\n");
-							},
-							[&](fastgltf::sources::Array& array) {
-								std::print("Array Buffer data source.\n");
-
-								unsigned char* data = stbi_load_from_memory((stbi_uc*) array.bytes.data() + bufferView.byteOffset,
-									static_cast<int>(bufferView.byteLength),
-									&width, &height, &nr_channels, 4);
-								if (data) {
-									VkExtent3D imagesize;
-									imagesize.width = width;
-									imagesize.height = height;
-									imagesize.depth = 1;
-
-									new_image = engine->create_image(data, imagesize, VK_FORMAT_R8G8B8A8_UNORM,
-										VK_IMAGE_USAGE_SAMPLED_BIT,false);
-
-									stbi_image_free(data);
-								}
-							},
-						},
-						buffer.data
-					);
-				},
-			},
-			image.data
-		);
+				node.transform
+			);
 
-		if (new_image.image == VK_NULL_HANDLE) {
-			return {};
-		} else {
-			return new_image;
+			cooked.nodes.push_back(cached);
+		}
+
+		for (size_t i = 0; i < gltf.nodes.size(); i++) {
+			for (size_t c : gltf.nodes[i].children) {
+				cooked.nodes[c].parent = static_cast<int32_t>(i);
+			}
 		}
 	}
+
+	// Mixes the external buffers a glTF references into `hash`, the cache is cooked from their bytes too.
+	// NOTE: Only the buffers are parsed, so a warm load still skips the full glTF parse
+	uint64_t hash_external_buffers(std::span<const uint8_t> source, const std::filesystem::path& gltf_dir, uint64_t hash)
+	{
+		fastgltf::Expected<fastgltf::GltfDataBuffer> expected_data = fastgltf::GltfDataBuffer::FromBytes(
+			reinterpret_cast<const std::byte*>(source.data()), source.size());
+		if (expected_data.error() != fastgltf::Error::None) {
+			return hash;
+		}
+		fastgltf::GltfDataBuffer& data = expected_data.get();
+
+		fastgltf::Parser parser {};
+		fastgltf::Expected<fastgltf::Asset> load = fastgltf::determineGltfFileType(data) == fastgltf::GltfType::GLB
+			? parser.loadGltfBinary(data, gltf_dir, fastgltf::Options::None, fastgltf::Category::Buffers)
+			: parser.loadGltf(data, gltf_dir, fastgltf::Options::None, fastgltf::Category::Buffers);
+		if (!load) {
+			return hash;
+		}
+
+		for (const fastgltf::Buffer& buffer : load.get().buffers) {
+			const fastgltf::sources::URI* uri = std::get_if<fastgltf::sources::URI>(&buffer.data);
+			if (uri == nullptr || !uri->uri.isLocalPath()) {
+				continue;
+			}
+
+			// A missing buffer still changes the hash, a cache cooked with it is not used without it
+			const std::optional<MappedFile> file = MappedFile::open(gltf_image_path(gltf_dir, uri->uri.path()));
+			hash = hash_combine(hash, file ? hash_bytes(file->bytes()) : 0);
+		}
+
+		return hash;
+	}
 };
 
-void MeshNode::draw(const glm::mat4& top_matrix, DrawContext& ctx)
+void MeshNode::register_renderables(RenderWorld& render_world)
 {
-	const glm::mat4 node_matrix = top_matrix * world_transform;
+	unregister_renderables();
+	world = &render_world;
 
 	for (GeoSurface& s : mesh->surfaces) {
 		RenderObject def;
@@ -151,20 +392,29 @@ void MeshNode::draw(const glm::mat4& top_matrix, DrawContext& ctx)
 		def.index_buffer = mesh->mesh_buffers.index_buffer.buffer;
 		def.material = &s.material->data;
         def.bounds = s.bounds;
-		def.transform = node_matrix;
+		def.lods = s.lods;
+		def.transform = world_transform();
 		def.vertex_buffer_address = mesh->mesh_buffers.vertex_buffer_address;
-		
-        if (s.material->data.pass_type == MaterialPass::Transparent) {
-            ctx.transparent_surfaces.push_back(def);
-        } else {
-		    ctx.opaque_surfaces.push_back(def);
-        }
+		if (s.meshlet_count > 0) {
+			def.meshlet_address = mesh->mesh_buffers.meshlet_buffer_address + s.first_meshlet * sizeof(Meshlet);
+			def.meshlet_count = s.meshlet_count;
+		}
+
+		render_handles.push_back(world->add(def, transform));
 	}
+}
 
-	Node::draw(top_matrix, ctx);
+void MeshNode::unregister_renderables()
+{
+	for (RenderHandle handle : render_handles) {
+		world->remove(handle);
+	}
+	render_handles.clear();
 }
 
 std::optional<std::shared_ptr<LoadedGLTF>> LoadedGLTF::load_gltf(VkEngine* engine, std::string_view file_path) {
+    PROFILE_SCOPE("LoadedGLTF::load_gltf");
+
     //
     // Load Gltf file
     //
@@ -175,44 +425,76 @@ std::optional<std::shared_ptr<LoadedGLTF>> LoadedGLTF::load_gltf(VkEngine* engin
     scene->creator = engine;
     LoadedGLTF& file = *scene.get();
 
-    fastgltf::Parser parser {};
-
-    constexpr auto gltf_options = fastgltf::Options::AllowDouble
-            | fastgltf::Options::LoadGLBBuffers
-            | fastgltf::Options::LoadExternalBuffers
-            | fastgltf::Options::GenerateMeshIndices;
+    std::filesystem::path path = file_path;
 
-    fastgltf::Expected<fastgltf::GltfDataBuffer> expected_data = fastgltf::GltfDataBuffer::FromPath(file_path);
-    if (expected_data.error() != fastgltf::Error::None) {
-        std::print("Failed to load glTF: {} \n", fastgltf::getErrorName(expected_data.error()));
+    // NOTE: The cache is only used for the exact bytes it was cooked from, the .bin buffers included
+    const std::optional<MappedFile> source = MappedFile::open(path);
+    if (!source) {
+        std::print("Failed to load glTF: could not read {}\n", file_path);
         return {};
     }
-    fastgltf::GltfDataBuffer& data = expected_data.get();
-
-    fastgltf::Asset gltf;
+    const uint64_t source_hash = hash_external_buffers(source->bytes(), path.parent_path(), hash_bytes(source->bytes()));
 
-    std::filesystem::path path = file_path;
+    const std::filesystem::path cache_path = mesh_cache_path(path);
+    std::optional<MappedFile> cache_file = MappedFile::open(cache_path);
+    std::optional<MeshCache> cache;
+    if (cache_file) {
+        cache = parse_mesh_cache(cache_file->bytes(), source_hash);
+    }
 
-    auto type = fastgltf::determineGltfFileType(data);
-    if (type == fastgltf::GltfType::glTF) {
-        auto load = parser.loadGltf(data, path.parent_path(), gltf_options);
-        if (load) {
-            gltf = std::move(load.get());
-        } else {
-            std::print("Failed to load glTF: {}\n", fastgltf::getErrorName(load.error()));
+    // Only filled when the cache is missing or stale, `cache` then points into it
+    MeshCacheData cooked;
+    if (cache) {
+        std::print("Using mesh cache: {}\n", cache_path.string());
+    } else {
+        fastgltf::Parser parser {};
+
+        constexpr auto gltf_options = fastgltf::Options::AllowDouble
+                | fastgltf::Options::LoadGLBBuffers
+                | fastgltf::Options::LoadExternalBuffers
+                | fastgltf::Options::GenerateMeshIndices;
+
+        // The source is already mapped for hashing, parse it from there instead of reading it again
+        fastgltf::Expected<fastgltf::GltfDataBuffer> expected_data = fastgltf::GltfDataBuffer::FromBytes(
+            reinterpret_cast<const std::byte*>(source->bytes().data()), source->bytes().size());
+        if (expected_data.error() != fastgltf::Error::None) {
+            std::print("Failed to load glTF: {} \n", fastgltf::getErrorName(expected_data.error()));
             return {};
         }
-    } else if (type == fastgltf::GltfType::GLB) {
-        auto load = parser.loadGltfBinary(data, path.parent_path(), gltf_options);
-        if (load) {
-            gltf = std::move(load.get());
+        fastgltf::GltfDataBuffer& data = expected_data.get();
+
+        fastgltf::Asset gltf;
+
+        auto type = fastgltf::determineGltfFileType(data);
+        if (type == fastgltf::GltfType::glTF) {
+            auto load = parser.loadGltf(data, path.parent_path(), gltf_options);
+            if (load) {
+                gltf = std::move(load.get());
+            } else {
+                std::print("Failed to load glTF: {}\n", fastgltf::getErrorName(load.error()));
+                return {};
+            }
+        } else if (type == fastgltf::GltfType::GLB) {
+            auto load = parser.loadGltfBinary(data, path.parent_path(), gltf_options);
+            if (load) {
+                gltf = std::move(load.get());
+            } else {
+                std::print("Failed to load glTF: {}\n", fastgltf::getErrorName(load.error()));
+                return {};
+            }
         } else {
-            std::print("Failed to load glTF: {}\n", fastgltf::getErrorName(load.error()));
+            std::print("Failed to determine glTF container.\n");
             return {};
         }
-    } else {
-        std::print("Failed to determine glTF container.\n");
-        return {};
+
+        cook_gltf(gltf, path.filename().string(), cooked);
+        cache = cooked.view();
+
+        // A stale cache is unmapped before it gets overwritten
+        cache_file.reset();
+        if (save_mesh_cache(*cache, source_hash, cache_path)) {
+            std::print("Wrote mesh cache: {}\n", cache_path.string());
+        }
     }
 
     // Create descriptor pool with a default estimated size
@@ -221,22 +503,22 @@ std::optional<std::shared_ptr<LoadedGLTF>> LoadedGLTF::load_gltf(VkEngine* engin
         { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 3 },
         { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 }
     };
-    file.descriptor_pool.init(engine->_device, gltf.materials.size(), sizes);
+    file.descriptor_pool.init(engine->_device, cache->materials.size(), sizes);
 
     //
     // Load samplers
     //
 
-    for (const fastgltf::Sampler& sampler : gltf.samplers) {
+    for (const CachedSampler& sampler : cache->samplers) {
 
         VkSamplerCreateInfo sampl = { .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO, .pNext = nullptr};
         sampl.maxLod = VK_LOD_CLAMP_NONE;
         sampl.minLod = 0;
 
-        sampl.magFilter = extract_filter(sampler.magFilter.value_or(fastgltf::Filter::Nearest));
-        sampl.minFilter = extract_filter(sampler.minFilter.value_or(fastgltf::Filter::Nearest));
+        sampl.magFilter = sampler.mag_filter;
+        sampl.minFilter = sampler.min_filter;
 
-        sampl.mipmapMode= extract_mipmap_mode(sampler.minFilter.value_or(fastgltf::Filter::Nearest));
+        sampl.mipmapMode = sampler.mipmap_mode;
 
         VkSampler new_sampler;
         vkCreateSampler(engine->_device, &sampl, nullptr, &new_sampler);
@@ -254,20 +536,73 @@ std::optional<std::shared_ptr<LoadedGLTF>> LoadedGLTF::load_gltf(VkEngine* engin
     // Load all textures
     //
 
-    for (fastgltf::Image& image : gltf.images) {
-		std::print("--- gltf loading texture: {} ---\n", image.name);
+    {
+		PROFILE_SCOPE("load_images");
+
+		// Sizes come from the image headers, so every image gets its slice of one staging buffer up front
+		std::vector<PendingImage> pending(cache->images.size());
+		VkDeviceSize staging_size = 0;
+		for (size_t i = 0; i < cache->images.size(); i++) {
+			std::print("--- gltf loading texture: {} ---\n", cache->string(cache->images[i].name));
 
-        std::optional<AllocatedImage> img = load_image(engine, gltf, image);
+			if (!probe_image(engine, *cache, cache->images[i], path.parent_path(), pending[i])) {
+				continue;
+			}
 
-		if (img.has_value()) {
-			images.push_back(*img);
-			file.images[image.name.c_str()] = *img;
+			pending[i].staging_offset = staging_size;
+			staging_size += (pending[i].staging_size + 15) & ~VkDeviceSize(15);
 		}
-		else {
-			// we failed to load, so lets give the slot a default white texture to not
-			// completely break loading
-			images.push_back(engine->_default_images._error_checkerboard_image);
-			std::print("gltf failed to load texture\n");
+
+		AllocatedBuffer staging {};
+		if (staging_size > 0) {
+			staging = engine->create_buffer(staging_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+			uint8_t* staging_data = (uint8_t*) staging.info.pMappedData;
+
+			TaskGraph graph;
+			for (PendingImage& image : pending) {
+				if (image.width > 0) {
+					graph.add("decode_image", [&image, staging_data]() { decode_image(image, staging_data); });
+				}
+			}
+			graph.run(engine->_workers);
+		}
+
+		std::vector<ImageUpload> uploads;
+		uint32_t baked_count = 0;
+		for (const PendingImage& image : pending) {
+			if (image.decoded) {
+				uploads.push_back(ImageUpload {
+					.size = VkExtent3D { uint32_t(image.width), uint32_t(image.height), 1 },
+					.format = image.baked ? image.baked->format : VK_FORMAT_R8G8B8A8_UNORM,
+					.usage = VK_IMAGE_USAGE_SAMPLED_BIT,
+					.mip_mapped = image.baked.has_value(),
+					.staging_offset = image.staging_offset,
+					.staged_mips = image.baked ? static_cast<uint32_t>(image.baked->levels.size()) : 1,
+				});
+				baked_count += image.baked ? 1 : 0;
+			}
+		}
+		std::print("gltf textures: {} baked, {} decoded, {} KiB uploaded\n", baked_count, uploads.size() - baked_count,
+			staging_size / 1024);
+
+		// One submit for the whole file instead of one per image
+		const std::vector<AllocatedImage> uploaded = engine->create_images(staging, uploads);
+		if (staging_size > 0) {
+			engine->destroy_buffer(staging);
+		}
+
+		size_t next_uploaded = 0;
+		for (size_t i = 0; i < cache->images.size(); i++) {
+			if (pending[i].decoded) {
+				const AllocatedImage& img = uploaded[next_uploaded++];
+				images.push_back(img);
+				file.images[std::string(cache->string(cache->images[i].name))] = img;
+			} else {
+				// we failed to load, so lets give the slot a default white texture to not
+				// completely break loading
+				images.push_back(engine->_default_images._error_checkerboard_image);
+				std::print("gltf failed to load texture\n");
+			}
 		}
     }
 
@@ -278,7 +613,7 @@ std::optional<std::shared_ptr<LoadedGLTF>> LoadedGLTF::load_gltf(VkEngine* engin
     // Create buffer big enough to hold the material data
     // TODO: Will be more complicated once we have more material types
     file.material_data_buffer = engine->create_buffer(
-        sizeof(GLTFMetallic_Roughness::MaterialConstants) * gltf.materials.size(),
+        sizeof(GLTFMetallic_Roughness::MaterialConstants) * cache->materials.size(),
         VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU
     );
 
@@ -286,26 +621,24 @@ std::optional<std::shared_ptr<LoadedGLTF>> LoadedGLTF::load_gltf(VkEngine* engin
     GLTFMetallic_Roughness::MaterialConstants* sceneMaterialConstants =
         (GLTFMetallic_Roughness::MaterialConstants*) file.material_data_buffer.info.pMappedData;
 
-    for (fastgltf::Material& mat : gltf.materials) {
+    for (const CachedMaterial& mat : cache->materials) {
         std::shared_ptr<GLTFMaterial> new_material = std::make_shared<GLTFMaterial>();
         materials.push_back(new_material);
-        file.materials[mat.name.c_str()] = new_material;
+        file.materials[std::string(cache->string(mat.name))] = new_material;
 
         GLTFMetallic_Roughness::MaterialConstants constants;
-        constants.color_factors.x = mat.pbrData.baseColorFactor[0];
-        constants.color_factors.y = mat.pbrData.baseColorFactor[1];
-        constants.color_factors.z = mat.pbrData.baseColorFactor[2];
-        constants.color_factors.w = mat.pbrData.baseColorFactor[3];
-
-        constants.metal_rough_factors.x = mat.pbrData.metallicFactor;
-        constants.metal_rough_factors.y = mat.pbrData.roughnessFactor;
+        constants.color_factors = mat.color_factors;
+        constants.metal_rough_factors = mat.metal_rough_factors;
 
         // Write material parameters to buffer
         sceneMaterialConstants[data_index] = constants;
 
-        MaterialPass pass_type = MaterialPass::MainColor;
-        if (mat.alphaMode == fastgltf::AlphaMode::Blend) {
-            pass_type = MaterialPass::Transparent;
+        MaterialFeatures features = MATERIAL_FEATURE_LIT_BIT;
+        if (mat.alpha_blend) {
+            features |= MATERIAL_FEATURE_ALPHA_BLEND_BIT;
+        }
+        if (mat.double_sided) {
+            features |= MATERIAL_FEATURE_DOUBLE_SIDED_BIT;
         }
 
         GLTFMetallic_Roughness::MaterialResources material_resources;
@@ -320,16 +653,14 @@ std::optional<std::shared_ptr<LoadedGLTF>> LoadedGLTF::load_gltf(VkEngine* engin
         material_resources.data_buffer_offset = data_index * sizeof(GLTFMetallic_Roughness::MaterialConstants);
 
         // Grab color image and sampler
-        if (mat.pbrData.baseColorTexture.has_value()) {
-            size_t img = gltf.textures[mat.pbrData.baseColorTexture.value().textureIndex].imageIndex.value();
-            size_t sampler = gltf.textures[mat.pbrData.baseColorTexture.value().textureIndex].samplerIndex.value();
-
-            material_resources.color_image = images[img];
-            material_resources.color_sampler = file.samplers[sampler];
+        if (mat.color_image >= 0) {
+            material_resources.color_image = images[mat.color_image];
+            material_resources.color_sampler = file.samplers[mat.color_sampler];
+            features |= MATERIAL_FEATURE_TEXTURED_BIT;
         }
 
         // Build material
-        new_material->data = engine->metal_rough_material.write_material(engine->_device, pass_type, material_resources, file.descriptor_pool);
+        new_material->data = engine->metal_rough_material.write_material(engine->_device, features, material_resources, file.descriptor_pool);
 
         data_index++;
     }
@@ -338,184 +669,88 @@ std::optional<std::shared_ptr<LoadedGLTF>> LoadedGLTF::load_gltf(VkEngine* engin
     // Load meshes
     //
 
-    // use the same vectors for all meshes so that the memory doesnt reallocate as
-    // often
-    std::vector<uint32_t> indices;
-    std::vector<Vertex> vertices;
-
-    for (const fastgltf::Mesh& mesh : gltf.meshes) {
-        std::shared_ptr<MeshAsset> new_mesh = std::make_shared<MeshAsset>();
-        meshes.push_back(new_mesh);
-        file.meshes[mesh.name.c_str()] = new_mesh;
-        new_mesh->name = mesh.name;
-
-        // clear the mesh arrays each mesh, we dont want to merge them by error
-        indices.clear();
-        vertices.clear();
-
-        for (const fastgltf::Primitive& p : mesh.primitives) {
-            GeoSurface new_surface;
-            new_surface.start_index = (uint32_t)indices.size();
-            new_surface.count = (uint32_t)gltf.accessors[p.indicesAccessor.value()].count;
-
-            const size_t initial_vtx = vertices.size();
-
-            // load indexes
-            {
-                fastgltf::Accessor& index_accessor = gltf.accessors[p.indicesAccessor.value()];
-                indices.reserve(indices.size() + index_accessor.count);
-
-                fastgltf::iterateAccessor<std::uint32_t>(gltf, index_accessor,
-                    [&](std::uint32_t idx) {
-                        indices.push_back(idx + initial_vtx);
-                    });
-            }
-
-            // load vertex positions
-            {
-                fastgltf::Accessor& pos_accessor = gltf.accessors[p.findAttribute("POSITION")->accessorIndex];
-                vertices.resize(vertices.size() + pos_accessor.count);
-
-                fastgltf::iterateAccessorWithIndex<glm::vec3>(gltf, pos_accessor,
-                    [&](glm::vec3 v, size_t index) {
-                        Vertex newvtx;
-                        newvtx.position = v;
-                        newvtx.normal = { 1, 0, 0 };
-                        newvtx.color = glm::vec4 { 1.f };
-                        newvtx.uv_x = 0;
-                        newvtx.uv_y = 0;
-                        vertices[initial_vtx + index] = newvtx;
-                    });
-            }
-
-            // load vertex normals
-            const auto normals = p.findAttribute("NORMAL");
-            if (normals != p.attributes.end()) {
-
-                fastgltf::iterateAccessorWithIndex<glm::vec3>(gltf, gltf.accessors[(*normals).accessorIndex],
-                    [&](glm::vec3 v, size_t index) {
-                        vertices[initial_vtx + index].normal = v;
-                    });
-            }
-
-            // load UVs
-            const auto uv = p.findAttribute("TEXCOORD_0");
-            if (uv != p.attributes.end()) {
-
-                fastgltf::iterateAccessorWithIndex<glm::vec2>(gltf, gltf.accessors[(*uv).accessorIndex],
-                    [&](glm::vec2 v, size_t index) {
-                        vertices[initial_vtx + index].uv_x = v.x;
-                        vertices[initial_vtx + index].uv_y = v.y;
-                    });
-            }
-
-            // load vertex colors
-            const auto colors = p.findAttribute("COLOR_0");
-            if (colors != p.attributes.end()) {
-
-                fastgltf::iterateAccessorWithIndex<glm::vec4>(gltf, gltf.accessors[(*colors).accessorIndex],
-                    [&](glm::vec4 v, size_t index) {
-                        vertices[initial_vtx + index].color = v;
-                    });
-            }
-
-            if (p.materialIndex.has_value()) {
-                new_surface.material = materials[p.materialIndex.value()];
-            } else {
-                new_surface.material = materials[0];
-            }
-
-            // Calculate bounds
-            // TODO: Duplicated code in Cube
-            glm::vec3 min_pos = vertices[initial_vtx].position;
-            glm::vec3 max_pos = vertices[initial_vtx].position;
-            for (int i = initial_vtx; i < vertices.size(); i++) {
-                min_pos = glm::min(min_pos, vertices[i].position);
-                max_pos = glm::max(max_pos, vertices[i].position);
+    {
+        PROFILE_SCOPE("load_meshes");
+
+        // The cached vertex and index arrays go to staging as a whole, one submit for every mesh of the file
+        std::vector<MeshUpload> uploads;
+        uploads.reserve(cache->meshes.size());
+        for (const CachedMesh& mesh : cache->meshes) {
+            uploads.push_back({ mesh.first_vertex, mesh.vertex_count, mesh.first_index, mesh.index_count,
+                mesh.first_meshlet, mesh.meshlet_count });
+        }
+        std::vector<GPUMeshBuffers> mesh_buffers = engine->upload_meshes(cache->indices, cache->vertices, uploads,
+            cache->meshlets);
+
+        for (size_t i = 0; i < cache->meshes.size(); i++) {
+            const CachedMesh& mesh = cache->meshes[i];
+
+            std::shared_ptr<MeshAsset> new_mesh = std::make_shared<MeshAsset>();
+            meshes.push_back(new_mesh);
+            new_mesh->name = cache->string(mesh.name);
+            file.meshes[new_mesh->name] = new_mesh;
+
+            for (const CachedSurface& surface : cache->surfaces.subspan(mesh.first_surface, mesh.surface_count)) {
+                GeoSurface new_surface;
+                new_surface.start_index = surface.start_index;
+                new_surface.count = surface.count;
+                new_surface.bounds = surface.bounds;
+                new_surface.material = materials[surface.material];
+                const std::span<const SurfaceLod> lods = cache->lods.subspan(surface.first_lod, surface.lod_count);
+                new_surface.lods.assign(lods.begin(), lods.end());
+                new_surface.first_meshlet = surface.first_meshlet;
+                new_surface.meshlet_count = surface.meshlet_count;
+
+                new_mesh->surfaces.push_back(new_surface);
             }
-            new_surface.bounds.origin = (max_pos + min_pos) / 2.f;
-            new_surface.bounds.extents = (max_pos - min_pos) / 2.f;
-            new_surface.bounds.sphere_radius = glm::length(new_surface.bounds.extents);
 
-            new_mesh->surfaces.push_back(new_surface);
+            new_mesh->mesh_buffers = mesh_buffers[i];
         }
-
-        new_mesh->mesh_buffers = engine->upload_mesh(indices, vertices);
     }
 
     //
     // Load nodes
     //
 
-    for (fastgltf::Node& node : gltf.nodes) {
+    for (const CachedNode& node : cache->nodes) {
         std::shared_ptr<Node> new_node;
 
         // Find if the node has a mesh, and if it does hook it to the mesh pointer,
         // and allocate it with the meshnode class
-        if (node.meshIndex.has_value()) {
-            new_node = std::make_shared<MeshNode>();
-            static_cast<MeshNode*>(new_node.get())->mesh = meshes[*node.meshIndex];
+        if (node.mesh >= 0) {
+            new_node = std::make_shared<MeshNode>(engine->_transforms);
+            static_cast<MeshNode*>(new_node.get())->mesh = meshes[node.mesh];
         } else {
-            new_node = std::make_shared<Node>();
+            new_node = std::make_shared<Node>(engine->_transforms);
         }
 
         nodes.push_back(new_node);
-        file.nodes[node.name.c_str()];
-
-        std::visit(
-            fastgltf::visitor {
-                [&](fastgltf::math::fmat4x4 matrix) {
-                    memcpy(&new_node->local_transform, matrix.data(), sizeof(matrix));
-                },
-                [&](fastgltf::TRS transform) {
-                    glm::vec3 tl(transform.translation[0], transform.translation[1],
-                        transform.translation[2]);
-                    glm::quat rot(transform.rotation[3], transform.rotation[0], transform.rotation[1],
-                        transform.rotation[2]);
-                    glm::vec3 sc(transform.scale[0], transform.scale[1], transform.scale[2]);
-
-                    glm::mat4 tm = glm::translate(glm::mat4(1.f), tl);
-                    glm::mat4 rm = glm::toMat4(rot);
-                    glm::mat4 sm = glm::scale(glm::mat4(1.f), sc);
-
-                    new_node->local_transform = tm * rm * sm;
-                }
-            },
-            node.transform
-        );
+        file.nodes[std::string(cache->string(node.name))] = new_node;
+
+        new_node->set_local_transform(node.local_transform);
     }
 
     //
     // Build scene-graph
     //
 
-    // Setup transform hierarchy
-    for (int i = 0; i < gltf.nodes.size(); i++) {
-        fastgltf::Node& node = gltf.nodes[i];
-        std::shared_ptr<Node>& scene_node = nodes[i];
-
-        for (auto& c : node.children) {
-            scene_node->children.push_back(nodes[c]);
-            nodes[c]->parent = scene_node;
+    // Setup transform hierarchy, world transforms are computed by the engine's next transform update
+    for (size_t i = 0; i < cache->nodes.size(); i++) {
+        if (cache->nodes[i].parent >= 0) {
+            nodes[i]->set_parent(*nodes[cache->nodes[i].parent]);
         }
     }
 
-    // Find roots
-    for (auto& node : nodes) {
-        if (node->parent.lock() == nullptr) {
-            file.roots.push_back(node);
-            node->refresh_transform(glm::mat4 { 1.f });
-        }
-    }
+    file.scene_nodes = std::move(nodes);
 
     return scene;
 }
 
-void LoadedGLTF::draw(const glm::mat4& top_matrix, DrawContext& ctx)
+void LoadedGLTF::register_renderables(RenderWorld& world)
 {
     // create renderables from the scenenodes
-    for (auto& n : roots) {
-        n->draw(top_matrix, ctx);
+    for (auto& n : scene_nodes) {
+        n->register_renderables(world);
     }
 }
 
@@ -529,6 +764,9 @@ void LoadedGLTF::clear_all() {
 
 		creator->destroy_buffer(v->mesh_buffers.index_buffer);
 		creator->destroy_buffer(v->mesh_buffers.vertex_buffer);
+		if (v->mesh_buffers.meshlet_buffer.buffer != VK_NULL_HANDLE) {
+			creator->destroy_buffer(v->mesh_buffers.meshlet_buffer);
+		}
     }
 
     for (auto& [k, v] : images) {
@@ -543,48 +781,4 @@ void LoadedGLTF::clear_all() {
 	for (auto& sampler : samplers) {
 		vkDestroySampler(dv, sampler, nullptr);
     }
-}
-
-bool is_visible(const RenderObject& obj, const glm::mat4& view_proj) {
-    // Create the 8 corners of the mesh-space bounding box, with the bounds x: [-1, 1], y: [-1, 1], z: [-1, 1]
-    std::array<glm::vec3, 8> corners {
-        glm::vec3 { 1, 1, 1 },
-        glm::vec3 { 1, 1, -1 },
-        glm::vec3 { 1, -1, 1 },
-        glm::vec3 { 1, -1, -1 },
-        glm::vec3 { -1, 1, 1 },
-        glm::vec3 { -1, 1, -1 },
-        glm::vec3 { -1, -1, 1 },
-        glm::vec3 { -1, -1, -1 },
-    };
-
-    const glm::mat4 matrix = view_proj * obj.transform;
-
-    // Initial min/max bounds outside mesh bounding box
-    glm::vec3 min = { 1.5, 1.5, 1.5 };
-    glm::vec3 max = { -1.5, -1.5, -1.5 };
-
-    for (int c = 0; c < 8; c++) {
-        // Project each corner into clip space
-        glm::vec3 corner_extent = corners[c] * obj.bounds.extents;
-        glm::vec4 v = matrix * glm::vec4(obj.bounds.origin + corner_extent, 1.f);
-
-        // Perspective correction
-        v.x = v.x / v.w;
-        v.y = v.y / v.w;
-        v.z = v.z / v.w;
-
-        min = glm::min(glm::vec3 { v.x, v.y, v.z }, min);
-        max = glm::max(glm::vec3 { v.x, v.y, v.z }, max);
-    }
-
-    if (min.z > 1.f || max.z < 0.f || min.x > 1.f || max.x < -1.f || min.y > 1.f || max.y < -1.f) {
-        return false;
-    } else {
-        return true;
-    }
-}
-
-float distance_to_camera(const RenderObject& obj, const PerspectiveCamera& camera) {
-    return glm::length(obj.bounds.origin - camera.position);
 }
\ No newline at end of file
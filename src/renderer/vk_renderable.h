@@ -3,64 +3,40 @@
 #include "vk_types.h"
 #include "vk_material.h"
 #include "vk_descriptors.h"
+#include "vk_render_world.h"
 #include "camera.h"
 
+#include "../scene/transform_hierarchy.h"
+
 #include <optional>
 #include <unordered_map>
 
-struct Bounds {
-    glm::vec3 origin;
-    float sphere_radius;
-    glm::vec3 extents;
+// Registered once with the `RenderWorld`, the draw records then follow the transforms on their own
+class IRenderable {
+    virtual void register_renderables(RenderWorld& world) = 0;
 };
 
-struct RenderObject {
-    uint32_t index_count;
-    uint32_t first_index;
-    VkBuffer index_buffer;
-    
-    Bounds bounds;
+// Handle into a `TransformHierarchy`, the matrices live there and are released with the node.
+// The hierarchy must outlive the node
+struct Node : public IRenderable {
+    Node(TransformHierarchy& transforms, const glm::mat4& local_transform = glm::mat4 { 1.f })
+        : hierarchy(&transforms), transform(transforms.add(local_transform)) {}
+    virtual ~Node() { hierarchy->remove(transform); }
 
-    MaterialInstance* material;
+    Node(const Node&) = delete;
+    Node& operator=(const Node&) = delete;
 
-    glm::mat4 transform;
-    VkDeviceAddress vertex_buffer_address;
-};
+    TransformHierarchy* hierarchy;
+    TransformHandle transform;
 
-bool is_visible(const RenderObject& obj, const glm::mat4& view_proj);
-float distance_to_camera(const RenderObject& obj, const PerspectiveCamera& camera);
+    void set_parent(const Node& parent) { hierarchy->set_parent(transform, parent.transform); }
+    void set_local_transform(const glm::mat4& local) { hierarchy->set_local(transform, local); }
 
-struct DrawContext {
-	std::vector<RenderObject> opaque_surfaces;
-    std::vector<RenderObject> transparent_surfaces;
-};
+    const glm::mat4& local_transform() const { return hierarchy->local(transform); }
+    // As of the last `TransformHierarchy::update`
+    const glm::mat4& world_transform() const { return hierarchy->world(transform); }
 
-class IRenderable {
-    virtual void draw(const glm::mat4& topMatrix, DrawContext& ctx) = 0;
-};
-
-struct Node : public IRenderable {
-    // weak_ptr avoids circular dependencies
-    std::weak_ptr<Node> parent;
-    std::vector<std::shared_ptr<Node>> children;
-
-    glm::mat4 local_transform;
-    glm::mat4 world_transform;
-
-    void refresh_transform(const glm::mat4& parent_matrix)
-    {
-        world_transform = parent_matrix * local_transform;
-        for (auto c : children) {
-            c->refresh_transform(world_transform);
-        }
-    }
-
-    virtual void draw(const glm::mat4& top_matrix, DrawContext& ctx)
-    {
-        for (auto& c : children) {
-            c->draw(top_matrix, ctx);
-        }
-    }
+    virtual void register_renderables(RenderWorld&) {}
 };
 
 struct GLTFMaterial {
@@ -72,6 +48,11 @@ struct GeoSurface {
     uint32_t count;
     Bounds bounds;
     std::shared_ptr<GLTFMaterial> material;
+    // Empty, or every level of detail starting with [start_index, start_index + count)
+    std::vector<SurfaceLod> lods;
+    // Range of `GPUMeshBuffers::meshlet_buffer`, empty if the surface is not split
+    uint32_t first_meshlet = 0;
+    uint32_t meshlet_count = 0;
 };
 
 struct MeshAsset {
@@ -82,10 +63,17 @@ struct MeshAsset {
 };
 
 struct MeshNode : public Node {
+	using Node::Node;
+	~MeshNode() { unregister_renderables(); }
 
 	std::shared_ptr<MeshAsset> mesh;
 
-	virtual void draw(const glm::mat4& topMatrix, DrawContext& ctx) override;
+	// One record per surface, removed again when the node goes away
+	RenderWorld* world = nullptr;
+	std::vector<RenderHandle> render_handles;
+
+	virtual void register_renderables(RenderWorld& world) override;
+	void unregister_renderables();
 };
 
 class VkEngine;
@@ -99,7 +87,8 @@ struct LoadedGLTF : public IRenderable {
     std::unordered_map<std::string, AllocatedImage> images;
     std::unordered_map<std::string, std::shared_ptr<GLTFMaterial>> materials;
 
-    std::vector<std::shared_ptr<Node>> roots;
+    // Every node in the file, the hierarchy itself is in the engine's `TransformHierarchy`
+    std::vector<std::shared_ptr<Node>> scene_nodes;
 
     std::vector<VkSampler> samplers;
 
@@ -111,7 +100,7 @@ struct LoadedGLTF : public IRenderable {
 
     ~LoadedGLTF() { clear_all(); };
 
-    virtual void draw(const glm::mat4& topMatrix, DrawContext& ctx);
+    virtual void register_renderables(RenderWorld& world);
 
 private:
 
@@ -41,10 +41,27 @@ struct Vertex {
 	glm::vec4 color;
 };
 
+// A cluster of up to 124 triangles of a surface, culled on its own by `meshlet_cull.comp` (std430).
+// Its triangles are the range [first_index, first_index + index_count) of the mesh's index buffer
+struct Meshlet {
+    glm::vec3 center;
+    float radius;
+    glm::vec3 cone_apex;
+    uint32_t first_index;
+    // Every triangle faces away from a camera inside the cone, a cutoff of 1 or more never culls
+    glm::vec3 cone_axis;
+    float cone_cutoff;
+    uint32_t index_count;
+    uint32_t padding[3];
+};
+
 struct GPUMeshBuffers {
     AllocatedBuffer index_buffer;
     AllocatedBuffer vertex_buffer;
     VkDeviceAddress vertex_buffer_address;
+    // Only for meshes with meshlets
+    AllocatedBuffer meshlet_buffer {};
+    VkDeviceAddress meshlet_buffer_address = 0;
 };
 
 struct GPUDrawPushConstants {
@@ -0,0 +1,89 @@
+#include "vk_visibility_cache.h"
+
+#include "../profiler/profiler.h"
+
+#include <algorithm>
+
+VisibilityCache::Update VisibilityCache::update(RenderWorld& world, const glm::mat4& view_proj, const PerspectiveCamera& camera) {
+    PROFILE_SCOPE("VisibilityCache::update");
+
+    last_retested = 0;
+
+    // NOTE: The position is checked on its own, the orthographic view sorts from the perspective camera
+    if (!valid || world.version() != world_version || view_proj != this->view_proj || camera.position != camera_position) {
+        this->view_proj = view_proj;
+        camera_position = camera.position;
+        world_version = world.version();
+        rebuild(world, camera);
+        world.clear_moved();
+        valid = true;
+        last_update = Update::Rebuilt;
+        return last_update;
+    }
+
+    if (world.moved_handles().empty()) {
+        last_update = Update::Reused;
+        return last_update;
+    }
+
+    const Frustum frustum = Frustum::from_view_proj(view_proj);
+    bool resort_transparent = false;
+
+    for (uint32_t handle : world.moved_handles()) {
+        const uint32_t i = world.index(RenderHandle { handle });
+        const bool now_visible = frustum.intersects(world.world_bounds(i));
+        last_retested++;
+
+        const bool transparent_pass = world.materials[i]->pass_type == MaterialPass::Transparent;
+        if (transparent_pass) {
+            // Its distance changed, the list is sorted again once every moved record is in
+            if (now_visible != (visible[i] != 0)) {
+                if (now_visible) {
+                    transparent.push_back(i);
+                } else {
+                    transparent.erase(std::find(transparent.begin(), transparent.end(), i));
+                }
+            }
+            resort_transparent |= now_visible;
+        } else if (now_visible != (visible[i] != 0)) {
+            // NOTE: The opaque order doesn't depend on the transform, a record that stays visible keeps its place.
+            // Same comparator as the full sort, so the list stays in the order it is drawn in
+            const auto before = [&](uint32_t a, uint32_t b) { return opaque_draw_before(world, a, b); };
+            if (now_visible) {
+                opaque.insert(std::upper_bound(opaque.begin(), opaque.end(), i, before), i);
+            } else {
+                opaque.erase(std::find(opaque.begin(), opaque.end(), i));
+            }
+        }
+        visible[i] = now_visible;
+    }
+
+    if (resort_transparent) {
+        sort_transparent_draws(transparent, world, camera);
+    }
+
+    world.clear_moved();
+    last_update = Update::Patched;
+    return last_update;
+}
+
+void VisibilityCache::rebuild(const RenderWorld& world, const PerspectiveCamera& camera) {
+    opaque.clear();
+    transparent.clear();
+    culled.clear();
+    visible.assign(world.size(), 0);
+
+    world.cull(view_proj, culled);
+
+    for (uint32_t i : culled) {
+        visible[i] = 1;
+        if (world.materials[i]->pass_type == MaterialPass::Transparent) {
+            transparent.push_back(i);
+        } else {
+            opaque.push_back(i);
+        }
+    }
+
+    sort_opaque_draws(opaque, world);
+    sort_transparent_draws(transparent, world, camera);
+}
\ No newline at end of file
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "vk_render_world.h"
+
+#include <vector>
+
+// Culled and sorted draw order of a `RenderWorld`, carried over between frames.
+// Keyed on the view projection, the position of the camera the transparent draws are sorted from and
+// `RenderWorld::version`: a moving camera or a structural change redoes the whole cull and sort, otherwise only records
+// in `RenderWorld::moved_handles` are re-tested and patched into the lists. Moved transparent records change their
+// distance, so the transparent list is re-sorted when any of them is visible.
+// With a still camera and nothing moving an update costs a matrix compare.
+struct VisibilityCache {
+    enum class Update {
+        Reused,
+        Patched,
+        Rebuilt,
+    };
+
+    Update update(RenderWorld& world, const glm::mat4& view_proj, const PerspectiveCamera& camera);
+    // Drops the cached result, the next update rebuilds
+    void invalidate() { valid = false; }
+
+    // Dense indices into the world, in draw order
+    std::vector<uint32_t> opaque;
+    std::vector<uint32_t> transparent;
+
+    // What the last update did, and how many moved records it re-tested
+    Update last_update = Update::Rebuilt;
+    uint32_t last_retested = 0;
+
+private:
+    void rebuild(const RenderWorld& world, const PerspectiveCamera& camera);
+
+    bool valid = false;
+    glm::mat4 view_proj;
+    glm::vec3 camera_position;
+    uint64_t world_version = 0;
+
+    // Dense, whether the record is in one of the lists
+    std::vector<uint8_t> visible;
+    std::vector<uint32_t> culled;
+};
+
+static const char* visibility_update_name(VisibilityCache::Update update) {
+    switch (update) {
+        case VisibilityCache::Update::Reused: { return "reused"; }
+        case VisibilityCache::Update::Patched: { return "patched"; }
+        case VisibilityCache::Update::Rebuilt: { return "rebuilt"; }
+        default: { return "unknown"; }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,114 @@
+#include "scenario.h"
+
+#include <glm/common.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <print>
+#include <sstream>
+#include <string>
+
+std::optional<Scenario> Scenario::from_path(const std::filesystem::path& path) {
+    std::fstream file;
+    file.open(path, std::ios::in);
+    if (!file) {
+        std::print("Could not open scenario at: {}\n", path.string());
+        return {};
+    }
+
+    Scenario scenario;
+    std::string line;
+    int line_number = 0;
+
+    while (std::getline(file, line)) {
+        ++line_number;
+
+        const size_t comment = line.find('#');
+        if (comment != std::string::npos) {
+            line.erase(comment);
+        }
+
+        std::istringstream tokens(line);
+        std::string directive;
+        if (!(tokens >> directive)) {
+            continue;
+        }
+
+        bool ok = true;
+        if (directive == "map") {
+            std::string map_path;
+            ok = static_cast<bool>(tokens >> map_path);
+            scenario.map_path = map_path;
+        } else if (directive == "camera") {
+            std::string camera;
+            ok = static_cast<bool>(tokens >> camera) && (camera == "ortho" || camera == "perspective");
+            scenario.ortho_camera = camera == "ortho";
+        } else if (directive == "frames") {
+            ok = static_cast<bool>(tokens >> scenario.frame_count);
+        } else if (directive == "timestep") {
+            ok = static_cast<bool>(tokens >> scenario.timestep) && scenario.timestep > 0.f;
+        } else if (directive == "render_scale") {
+            ok = static_cast<bool>(tokens >> scenario.render_scale);
+            scenario.render_scale = std::clamp(scenario.render_scale, 0.3f, 1.f);
+        } else if (directive == "wireframe") {
+            std::string wireframe;
+            ok = static_cast<bool>(tokens >> wireframe) && (wireframe == "on" || wireframe == "off");
+            scenario.wireframe = wireframe == "on";
+        } else if (directive == "output") {
+            std::string output_path;
+            ok = static_cast<bool>(tokens >> output_path);
+            scenario.output_path = output_path;
+        } else if (directive == "key") {
+            CameraKeyframe key;
+            ok = static_cast<bool>(tokens >> key.time
+                >> key.position.x >> key.position.y >> key.position.z
+                >> key.pitch >> key.yaw >> key.zoom);
+            scenario.keyframes.push_back(key);
+        } else {
+            ok = false;
+        }
+
+        if (!ok) {
+            std::print("Invalid scenario directive at {}:{}: {}\n", path.string(), line_number, line);
+            return {};
+        }
+    }
+
+    if (scenario.keyframes.empty()) {
+        std::print("Scenario at {} needs at least one camera keyframe\n", path.string());
+        return {};
+    }
+
+    std::stable_sort(scenario.keyframes.begin(), scenario.keyframes.end(), [](const CameraKeyframe& a, const CameraKeyframe& b) {
+        return a.time < b.time;
+    });
+
+    std::print("Loaded scenario at: {}\n", path.string());
+    return scenario;
+}
+
+CameraKeyframe Scenario::sample(float time) const {
+    if (time <= keyframes.front().time) {
+        return keyframes.front();
+    }
+    if (time >= keyframes.back().time) {
+        return keyframes.back();
+    }
+
+    // First keyframe strictly after `time`, there is always one before it because of the checks above
+    const auto next = std::upper_bound(keyframes.begin(), keyframes.end(), time, [](float t, const CameraKeyframe& key) {
+        return t < key.time;
+    });
+    const CameraKeyframe& a = *(next - 1);
+    const CameraKeyframe& b = *next;
+
+    const float t = (time - a.time) / (b.time - a.time);
+
+    return CameraKeyframe{
+        time,
+        glm::mix(a.position, b.position, t),
+        glm::mix(a.pitch, b.pitch, t),
+        glm::mix(a.yaw, b.yaw, t),
+        glm::mix(a.zoom, b.zoom, t),
+    };
+}
\ No newline at end of file
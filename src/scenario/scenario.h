@@ -0,0 +1,46 @@
+#pragma once
+
+#include <glm/vec3.hpp>
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <vector>
+
+// A camera pose at a point in time, the runner linearly interpolates between keyframes.
+// NOTE: Angles are in the units of the camera they drive (radians for perspective, degrees for orthographic),
+// `zoom` is the fov of the perspective camera or the scale of the orthographic one
+struct CameraKeyframe {
+    float time;
+    glm::vec3 position;
+    float pitch;
+    float yaw;
+    float zoom;
+};
+
+// Deterministic, replayable benchmark run. File format is one directive per line, `#` starts a comment:
+//
+//     map ../maps/test_map.tdm
+//     camera ortho            (or perspective)
+//     frames 600
+//     timestep 0.0166667      (seconds per simulated frame)
+//     render_scale 1.0
+//     wireframe off           (or on)
+//     output scenario.csv
+//     key <time> <x> <y> <z> <pitch> <yaw> <zoom>
+struct Scenario {
+    static std::optional<Scenario> from_path(const std::filesystem::path& path);
+
+    CameraKeyframe sample(float time) const;
+
+    std::filesystem::path map_path = "../maps/test_map.tdm";
+    bool ortho_camera = true;
+    uint32_t frame_count = 600;
+    float timestep = 1.f / 60.f;
+    float render_scale = 1.f;
+    bool wireframe = false;
+    std::filesystem::path output_path = "scenario.csv";
+
+    // Sorted by time
+    std::vector<CameraKeyframe> keyframes;
+};
\ No newline at end of file
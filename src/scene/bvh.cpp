@@ -0,0 +1,409 @@
+#include "bvh.h"
+
+#include "../defs.h"
+
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+
+#include <algorithm>
+#include <functional>
+
+namespace {
+
+enum class Containment {
+    Outside,
+    Intersects,
+    Inside,
+};
+
+Containment classify(const Frustum& frustum, const AABB& box) {
+    const glm::vec3 center = box.center();
+    const glm::vec3 extents = box.extents();
+
+    Containment result = Containment::Inside;
+    for (const glm::vec4& plane : frustum.planes) {
+        const glm::vec3 normal = glm::vec3(plane);
+        // Projected radius of the box onto the plane normal
+        const float radius = glm::dot(glm::abs(normal), extents);
+        const float distance = glm::dot(normal, center) + plane.w;
+
+        if (distance + radius < 0.f) {
+            return Containment::Outside;
+        }
+        if (distance - radius < 0.f) {
+            result = Containment::Intersects;
+        }
+    }
+
+    return result;
+}
+
+// Slab test, `t_near` is where the ray enters the box (0 if it starts inside)
+bool intersect(const AABB& box, const glm::vec3& origin, const glm::vec3& inv_direction, float max_t, float& t_near) {
+    const glm::vec3 t0 = (box.min - origin) * inv_direction;
+    const glm::vec3 t1 = (box.max - origin) * inv_direction;
+    const glm::vec3 t_min = glm::min(t0, t1);
+    const glm::vec3 t_max = glm::max(t0, t1);
+
+    t_near = std::max(std::max(t_min.x, t_min.y), std::max(t_min.z, 0.f));
+    const float t_far = std::min(std::min(t_max.x, t_max.y), std::min(t_max.z, max_t));
+    return t_near <= t_far;
+}
+
+glm::vec4 row(const glm::mat4& m, int i) {
+    return glm::vec4 { m[0][i], m[1][i], m[2][i], m[3][i] };
+}
+
+} // namespace
+
+float AABB::surface_area() const {
+    const glm::vec3 d = max - min;
+    return 2.f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+void AABB::grow(const AABB& other) {
+    min = glm::min(min, other.min);
+    max = glm::max(max, other.max);
+}
+
+AABB AABB::empty() {
+    return AABB { glm::vec3 { FLT_MAX }, glm::vec3 { -FLT_MAX } };
+}
+
+AABB transform_aabb(const glm::vec3& origin, const glm::vec3& extents, const glm::mat4& transform) {
+    const glm::vec3 center = glm::vec3(transform * glm::vec4(origin, 1.f));
+
+    // Each world axis gets the extents projected through the absolute rotation/scale part
+    glm::vec3 world_extents { 0.f };
+    for (int axis = 0; axis < 3; axis++) {
+        world_extents += glm::abs(glm::vec3(transform[axis])) * extents[axis];
+    }
+
+    return AABB { center - world_extents, center + world_extents };
+}
+
+Frustum Frustum::from_view_proj(const glm::mat4& view_proj) {
+    const glm::vec4 x = row(view_proj, 0);
+    const glm::vec4 y = row(view_proj, 1);
+    const glm::vec4 z = row(view_proj, 2);
+    const glm::vec4 w = row(view_proj, 3);
+
+    // -w <= x <= w, -w <= y <= w, 0 <= z <= w
+    return Frustum { {
+        w + x,
+        w - x,
+        w + y,
+        w - y,
+        z,
+        w - z,
+    } };
+}
+
+bool Frustum::intersects(const AABB& box) const {
+    return classify(*this, box) != Containment::Outside;
+}
+
+void Bvh::clear() {
+    nodes.clear();
+    parents.clear();
+    node_dirty.clear();
+    dirty_nodes.clear();
+    max_depth = 0;
+    item_ids.clear();
+    item_bounds.clear();
+    item_leaves.clear();
+    id_to_item.clear();
+}
+
+void Bvh::build(std::span<const AABB> bounds, std::span<const uint32_t> ids) {
+    M_Assert(bounds.size() == ids.size(), "Every BVH item needs an id");
+
+    clear();
+    if (ids.empty()) {
+        return;
+    }
+
+    const uint32_t count = static_cast<uint32_t>(ids.size());
+
+    std::vector<glm::vec3> centroids(count);
+    std::vector<uint32_t> order(count);
+    for (uint32_t i = 0; i < count; i++) {
+        centroids[i] = bounds[i].center();
+        order[i] = i;
+    }
+
+    // A binary tree with at least one item per leaf never has more than 2n - 1 nodes
+    nodes.reserve(2 * count - 1);
+    parents.reserve(2 * count - 1);
+    nodes.push_back(Node { AABB::empty(), 0, count, 0 });
+    parents.push_back(no_node);
+    split(0, 1, order, centroids, bounds);
+
+    item_ids.resize(count);
+    item_bounds.resize(count);
+    for (uint32_t i = 0; i < count; i++) {
+        item_ids[i] = ids[order[i]];
+        item_bounds[i] = bounds[order[i]];
+    }
+
+    item_leaves.resize(count);
+    uint32_t max_id = 0;
+    for (uint32_t id : item_ids) {
+        max_id = std::max(max_id, id);
+    }
+    id_to_item.assign(max_id + 1, no_node);
+
+    for (uint32_t n = 0; n < node_count(); n++) {
+        const Node& node = nodes[n];
+        if (node.left != 0) {
+            continue;
+        }
+
+        for (uint32_t i = node.first; i < node.first + node.count; i++) {
+            item_leaves[i] = n;
+            id_to_item[item_ids[i]] = i;
+        }
+    }
+
+    node_dirty.assign(nodes.size(), 0);
+    traversal_stack.reserve(max_depth + 1);
+}
+
+void Bvh::split(uint32_t node, uint32_t depth, std::span<uint32_t> order, std::span<const glm::vec3> centroids,
+    std::span<const AABB> bounds) {
+    const uint32_t first = nodes[node].first;
+    const uint32_t count = nodes[node].count;
+    const auto begin = order.begin() + first;
+    const auto end = begin + count;
+
+    AABB box = AABB::empty();
+    AABB centroid_box = AABB::empty();
+    for (auto it = begin; it != end; it++) {
+        box.grow(bounds[*it]);
+        centroid_box.grow(AABB { centroids[*it], centroids[*it] });
+    }
+
+    nodes[node].bounds = box;
+    max_depth = std::max(max_depth, depth);
+
+    if (count <= max_leaf_items) {
+        return;
+    }
+
+    struct Bin {
+        AABB bounds = AABB::empty();
+        uint32_t count = 0;
+    };
+
+    // Binned SAH, cost of a split is the number of items on each side weighted by the side's surface area
+    float best_cost = FLT_MAX;
+    int best_axis = -1;
+    uint32_t best_bin = 0;
+
+    const auto bin_of = [&](uint32_t item, int axis) {
+        const float lo = centroid_box.min[axis];
+        const float scale = bin_count / (centroid_box.max[axis] - lo);
+        return std::min(bin_count - 1, static_cast<uint32_t>((centroids[item][axis] - lo) * scale));
+    };
+
+    for (int axis = 0; axis < 3; axis++) {
+        if (centroid_box.max[axis] - centroid_box.min[axis] <= 0.f) {
+            continue;
+        }
+
+        Bin bins[bin_count];
+        for (auto it = begin; it != end; it++) {
+            Bin& bin = bins[bin_of(*it, axis)];
+            bin.bounds.grow(bounds[*it]);
+            bin.count++;
+        }
+
+        // Sweep from the left storing the cost of everything below each split, then from the right
+        float left_cost[bin_count - 1];
+        uint32_t left_count = 0;
+        AABB left = AABB::empty();
+        for (uint32_t b = 0; b < bin_count - 1; b++) {
+            left_count += bins[b].count;
+            left.grow(bins[b].bounds);
+            left_cost[b] = left_count > 0 ? left_count * left.surface_area() : -1.f;
+        }
+
+        uint32_t right_count = 0;
+        AABB right = AABB::empty();
+        for (uint32_t b = bin_count - 1; b > 0; b--) {
+            right_count += bins[b].count;
+            right.grow(bins[b].bounds);
+            if (right_count == 0 || left_cost[b - 1] < 0.f) {
+                continue;
+            }
+
+            const float cost = left_cost[b - 1] + right_count * right.surface_area();
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_bin = b;
+            }
+        }
+    }
+
+    auto middle = begin;
+    if (best_axis >= 0 && best_cost < count * box.surface_area()) {
+        middle = std::partition(begin, end, [&](uint32_t item) { return bin_of(item, best_axis) < best_bin; });
+    } else if (count <= max_leaf_items * 4) {
+        // Splitting doesn't pay off, a slightly bigger leaf is cheaper to test
+        return;
+    } else {
+        // Every centroid in the same spot or no split beats a leaf, fall back to a median split to keep the depth bounded
+        const glm::vec3 size = box.max - box.min;
+        const int axis = size.x > size.y ? (size.x > size.z ? 0 : 2) : (size.y > size.z ? 1 : 2);
+        middle = begin + count / 2;
+        std::nth_element(begin, middle, end, [&](uint32_t a, uint32_t b) {
+            return centroids[a][axis] < centroids[b][axis];
+        });
+    }
+
+    const uint32_t left_count = static_cast<uint32_t>(middle - begin);
+
+    const uint32_t left = node_count();
+    nodes.push_back(Node { AABB::empty(), first, left_count, 0 });
+    nodes.push_back(Node { AABB::empty(), first + left_count, count - left_count, 0 });
+    parents.push_back(node);
+    parents.push_back(node);
+    nodes[node].left = left;
+
+    split(left, depth + 1, order, centroids, bounds);
+    split(left + 1, depth + 1, order, centroids, bounds);
+}
+
+void Bvh::update(uint32_t id, const AABB& bounds) {
+    M_Assert(id < id_to_item.size() && id_to_item[id] != no_node, "Item is not in the BVH");
+
+    const uint32_t item = id_to_item[id];
+    item_bounds[item] = bounds;
+
+    // Everything above the leaf needs refitting, stop at the first node an earlier update already marked
+    for (uint32_t node = item_leaves[item]; node != no_node && !node_dirty[node]; node = parents[node]) {
+        node_dirty[node] = 1;
+        dirty_nodes.push_back(node);
+    }
+}
+
+void Bvh::refit() {
+    if (dirty_nodes.empty()) {
+        return;
+    }
+
+    // Children have higher indices than their parents, going backwards refits bottom up
+    std::sort(dirty_nodes.begin(), dirty_nodes.end(), std::greater<uint32_t>());
+
+    for (uint32_t n : dirty_nodes) {
+        Node& node = nodes[n];
+
+        AABB box = AABB::empty();
+        if (node.left == 0) {
+            for (uint32_t i = node.first; i < node.first + node.count; i++) {
+                box.grow(item_bounds[i]);
+            }
+        } else {
+            box.grow(nodes[node.left].bounds);
+            box.grow(nodes[node.left + 1].bounds);
+        }
+
+        node.bounds = box;
+        node_dirty[n] = 0;
+    }
+
+    dirty_nodes.clear();
+}
+
+void Bvh::cull(const Frustum& frustum, std::vector<uint32_t>& out_ids) const {
+    if (nodes.empty()) {
+        return;
+    }
+
+    std::vector<uint32_t>& stack = traversal_stack;
+    stack.clear();
+    stack.push_back(0);
+
+    while (!stack.empty()) {
+        const Node& node = nodes[stack.back()];
+        stack.pop_back();
+
+        switch (classify(frustum, node.bounds)) {
+            case Containment::Outside:
+                break;
+            case Containment::Inside:
+                // Nothing below can be outside, take the subtree's item range without visiting it
+                out_ids.insert(out_ids.end(), item_ids.begin() + node.first, item_ids.begin() + node.first + node.count);
+                break;
+            case Containment::Intersects:
+                if (node.left != 0) {
+                    stack.push_back(node.left);
+                    stack.push_back(node.left + 1);
+                    break;
+                }
+
+                for (uint32_t i = node.first; i < node.first + node.count; i++) {
+                    if (frustum.intersects(item_bounds[i])) {
+                        out_ids.push_back(item_ids[i]);
+                    }
+                }
+                break;
+        }
+    }
+}
+
+std::optional<RayHit> Bvh::raycast(const Ray& ray, float max_t) const {
+    if (nodes.empty()) {
+        return std::nullopt;
+    }
+
+    const glm::vec3 inv_direction = 1.f / ray.direction;
+
+    std::optional<RayHit> closest;
+    float closest_t = max_t;
+
+    std::vector<uint32_t>& stack = traversal_stack;
+    stack.clear();
+    stack.push_back(0);
+
+    while (!stack.empty()) {
+        const Node& node = nodes[stack.back()];
+        stack.pop_back();
+
+        // Re-tested on pop, a closer hit found in the meantime may already rule the node out
+        float t_node;
+        if (!intersect(node.bounds, ray.origin, inv_direction, closest_t, t_node)) {
+            continue;
+        }
+
+        if (node.left == 0) {
+            for (uint32_t i = node.first; i < node.first + node.count; i++) {
+                float t;
+                if (intersect(item_bounds[i], ray.origin, inv_direction, closest_t, t) && (!closest || t < closest_t)) {
+                    closest = RayHit { item_ids[i], t };
+                    closest_t = t;
+                }
+            }
+            continue;
+        }
+
+        // Visit the nearer child first so its hits can cull the farther one
+        float t_left = FLT_MAX;
+        float t_right = FLT_MAX;
+        const bool hit_left = intersect(nodes[node.left].bounds, ray.origin, inv_direction, closest_t, t_left);
+        const bool hit_right = intersect(nodes[node.left + 1].bounds, ray.origin, inv_direction, closest_t, t_right);
+
+        if (hit_left && hit_right) {
+            const bool left_first = t_left <= t_right;
+            stack.push_back(left_first ? node.left + 1 : node.left);
+            stack.push_back(left_first ? node.left : node.left + 1);
+        } else if (hit_left) {
+            stack.push_back(node.left);
+        } else if (hit_right) {
+            stack.push_back(node.left + 1);
+        }
+    }
+
+    return closest;
+}
\ No newline at end of file
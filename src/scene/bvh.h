@@ -0,0 +1,110 @@
+#pragma once
+
+#include <glm/mat4x4.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+
+#include <cfloat>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+struct AABB {
+    glm::vec3 min;
+    glm::vec3 max;
+
+    glm::vec3 center() const { return (min + max) * 0.5f; }
+    glm::vec3 extents() const { return (max - min) * 0.5f; }
+    float surface_area() const;
+
+    void grow(const AABB& other);
+    static AABB empty();
+};
+
+// World space bounds of a box given by its center and half extents in `transform`'s local space
+AABB transform_aabb(const glm::vec3& origin, const glm::vec3& extents, const glm::mat4& transform);
+
+// Six inward facing planes (xyz normal, w distance), extracted from a view projection with a [0, 1] depth range.
+// NOTE: Works with reverse-Z too, an infinite far plane comes out as a zero plane that rejects nothing
+struct Frustum {
+    glm::vec4 planes[6];
+
+    static Frustum from_view_proj(const glm::mat4& view_proj);
+
+    // Conservative, boxes near a corner of the frustum may pass without touching it
+    bool intersects(const AABB& box) const;
+};
+
+struct Ray {
+    glm::vec3 origin;
+    glm::vec3 direction;
+};
+
+struct RayHit {
+    uint32_t id;
+    // Distance along the ray in units of `direction`
+    float t;
+};
+
+// Bounding volume hierarchy over axis aligned boxes, each tagged with a caller chosen id.
+// Built with a binned surface area heuristic, so queries only visit a logarithmic number of nodes for scattered scenes.
+//
+// NOTE: Moving items only refits the boxes on the path to the root, which is cheap but lets the tree degrade.
+// Callers rebuild when items are added or removed, which is also a good point to recover the quality.
+struct Bvh {
+    void build(std::span<const AABB> bounds, std::span<const uint32_t> ids);
+    void clear();
+
+    // Changes the box of an item, the tree is fixed up by the next `refit`
+    void update(uint32_t id, const AABB& bounds);
+    // Recomputes only the nodes above items updated since the last refit
+    void refit();
+
+    // Appends the ids of every item whose box intersects the frustum, whole subtrees are accepted or rejected at once
+    void cull(const Frustum& frustum, std::vector<uint32_t>& out_ids) const;
+    // Closest item box hit by the ray within [0, max_t]
+    std::optional<RayHit> raycast(const Ray& ray, float max_t = FLT_MAX) const;
+
+    uint32_t node_count() const { return static_cast<uint32_t>(nodes.size()); }
+    uint32_t item_count() const { return static_cast<uint32_t>(item_ids.size()); }
+    uint32_t depth() const { return max_depth; }
+
+private:
+    static constexpr uint32_t no_node = UINT32_MAX;
+    static constexpr uint32_t max_leaf_items = 4;
+    static constexpr uint32_t bin_count = 12;
+
+    // Children are allocated as a pair after their parent, so a parent always has a lower index
+    struct Node {
+        AABB bounds;
+        // Items of the whole subtree are the contiguous range [first, first + count) of `item_ids`
+        uint32_t first;
+        uint32_t count;
+        // 0 for leaves, the root is never anybody's child. The right child is `left + 1`
+        uint32_t left;
+    };
+
+    // Partitions `order` (indices into `bounds`) in place below `node`
+    void split(uint32_t node, uint32_t depth, std::span<uint32_t> order, std::span<const glm::vec3> centroids,
+        std::span<const AABB> bounds);
+
+    std::vector<Node> nodes;
+    std::vector<uint32_t> parents;
+    std::vector<uint8_t> node_dirty;
+    std::vector<uint32_t> dirty_nodes;
+    uint32_t max_depth = 0;
+
+    // Ordered so every node's items are contiguous
+    std::vector<uint32_t> item_ids;
+    std::vector<AABB> item_bounds;
+    std::vector<uint32_t> item_leaves;
+
+    // Sparse, indexed by id
+    std::vector<uint32_t> id_to_item;
+
+    // Reused by `cull` and `raycast` to avoid allocating every query. A depth first walk holds at most one node
+    // per level plus a sibling, so the reserve in `build` covers it
+    // NOTE: Queries on one tree must therefore not run concurrently
+    mutable std::vector<uint32_t> traversal_stack;
+};
\ No newline at end of file
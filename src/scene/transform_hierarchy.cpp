@@ -0,0 +1,201 @@
+#include "transform_hierarchy.h"
+
+#include "../defs.h"
+#include "../profiler/profiler.h"
+
+#include <algorithm>
+
+TransformHandle TransformHierarchy::add(const glm::mat4& local) {
+    TransformHandle handle;
+    if (!free_handles.empty()) {
+        handle.id = free_handles.back();
+        free_handles.pop_back();
+    } else {
+        handle.id = static_cast<uint32_t>(handle_to_dense.size());
+        handle_to_dense.push_back(TransformHandle::invalid);
+    }
+
+    // NOTE: Appended out of order, the next update sorts it into its level
+    handle_to_dense[handle.id] = static_cast<uint32_t>(handles.size());
+    local_matrices.push_back(local);
+    world_matrices.push_back(local);
+    parents.push_back(no_parent);
+    dirty.push_back(1);
+    updated_pass.push_back(0);
+    handles.push_back(handle.id);
+
+    order_dirty = true;
+    return handle;
+}
+
+void TransformHierarchy::remove(TransformHandle handle) {
+    const uint32_t index = dense_index(handle);
+
+    // The slot is dropped when the order is rebuilt, children left behind become roots
+    handles[index] = TransformHandle::invalid;
+    handle_to_dense[handle.id] = TransformHandle::invalid;
+    free_handles.push_back(handle.id);
+
+    order_dirty = true;
+}
+
+void TransformHierarchy::set_parent(TransformHandle child, TransformHandle parent) {
+    const uint32_t index = dense_index(child);
+    parents[index] = parent.valid() ? dense_index(parent) : no_parent;
+    dirty[index] = 1;
+
+    order_dirty = true;
+}
+
+void TransformHierarchy::set_local(TransformHandle handle, const glm::mat4& local) {
+    const uint32_t index = dense_index(handle);
+    local_matrices[index] = local;
+    dirty[index] = 1;
+}
+
+const glm::mat4& TransformHierarchy::local(TransformHandle handle) const {
+    return local_matrices[dense_index(handle)];
+}
+
+const glm::mat4& TransformHierarchy::world(TransformHandle handle) const {
+    return world_matrices[dense_index(handle)];
+}
+
+bool TransformHierarchy::changed(TransformHandle handle) const {
+    return updated_pass[dense_index(handle)] == pass;
+}
+
+void TransformHierarchy::update() {
+    PROFILE_SCOPE("TransformHierarchy::update");
+
+    begin_update();
+    for (uint32_t level = 0; level < level_count(); level++) {
+        update_range(level_begin(level), level_end(level));
+    }
+}
+
+void TransformHierarchy::begin_update() {
+    if (order_dirty) {
+        rebuild_order();
+    }
+    pass++;
+    changed_handles.clear();
+}
+
+void TransformHierarchy::update_range(uint32_t begin, uint32_t end, std::vector<TransformHandle>& changed) {
+    for (uint32_t i = begin; i < end; i++) {
+        const uint32_t parent = parents[i];
+        const bool parent_changed = parent != no_parent && updated_pass[parent] == pass;
+        if (!dirty[i] && !parent_changed) {
+            continue;
+        }
+
+        world_matrices[i] = parent == no_parent ? local_matrices[i] : world_matrices[parent] * local_matrices[i];
+        updated_pass[i] = pass;
+        dirty[i] = 0;
+        changed.push_back(TransformHandle { handles[i] });
+    }
+}
+
+void TransformHierarchy::append_changed(const std::vector<TransformHandle>& changed) {
+    changed_handles.insert(changed_handles.end(), changed.begin(), changed.end());
+}
+
+void TransformHierarchy::rebuild_order() {
+    PROFILE_SCOPE("TransformHierarchy::rebuild_order");
+
+    const uint32_t old_count = static_cast<uint32_t>(handles.size());
+
+    // Depth of every live slot, parents can come after their children until the order is rebuilt
+    constexpr uint32_t unknown_depth = UINT32_MAX;
+    std::vector<uint32_t> depths(old_count, unknown_depth);
+    std::vector<uint32_t> chain;
+    uint32_t max_depth = 0;
+
+    for (uint32_t i = 0; i < old_count; i++) {
+        if (handles[i] == TransformHandle::invalid) {
+            continue;
+        }
+
+        // Walk up until a slot with a known depth or a root, then fill the depths back down
+        uint32_t current = i;
+        while (depths[current] == unknown_depth) {
+            const uint32_t parent = parents[current];
+            if (parent == no_parent || handles[parent] == TransformHandle::invalid) {
+                if (parent != no_parent) {
+                    dirty[current] = 1;
+                }
+                parents[current] = no_parent;
+                depths[current] = 0;
+                break;
+            }
+            chain.push_back(current);
+            current = parent;
+        }
+
+        uint32_t depth = depths[current];
+        while (!chain.empty()) {
+            depth++;
+            depths[chain.back()] = depth;
+            chain.pop_back();
+        }
+        max_depth = std::max(max_depth, depths[i]);
+    }
+
+    // Counting sort by depth, stable so siblings keep their relative order
+    level_offsets.assign(max_depth + 2, 0);
+    for (uint32_t i = 0; i < old_count; i++) {
+        if (handles[i] != TransformHandle::invalid) {
+            level_offsets[depths[i] + 1]++;
+        }
+    }
+    for (uint32_t level = 1; level < level_offsets.size(); level++) {
+        level_offsets[level] += level_offsets[level - 1];
+    }
+
+    const uint32_t new_count = level_offsets.back();
+    std::vector<uint32_t> old_to_new(old_count, no_parent);
+    std::vector<uint32_t> next = level_offsets;
+    for (uint32_t i = 0; i < old_count; i++) {
+        if (handles[i] != TransformHandle::invalid) {
+            old_to_new[i] = next[depths[i]]++;
+        }
+    }
+
+    std::vector<glm::mat4> new_local(new_count);
+    std::vector<glm::mat4> new_world(new_count);
+    std::vector<uint32_t> new_parents(new_count);
+    std::vector<uint8_t> new_dirty(new_count);
+    std::vector<uint32_t> new_updated_pass(new_count);
+    std::vector<uint32_t> new_handles(new_count);
+
+    for (uint32_t i = 0; i < old_count; i++) {
+        const uint32_t n = old_to_new[i];
+        if (n == no_parent) {
+            continue;
+        }
+
+        new_local[n] = local_matrices[i];
+        new_world[n] = world_matrices[i];
+        new_parents[n] = parents[i] == no_parent ? no_parent : old_to_new[parents[i]];
+        new_dirty[n] = dirty[i];
+        new_updated_pass[n] = updated_pass[i];
+        new_handles[n] = handles[i];
+        handle_to_dense[handles[i]] = n;
+    }
+
+    local_matrices = std::move(new_local);
+    world_matrices = std::move(new_world);
+    parents = std::move(new_parents);
+    dirty = std::move(new_dirty);
+    updated_pass = std::move(new_updated_pass);
+    handles = std::move(new_handles);
+
+    order_dirty = false;
+}
+
+uint32_t TransformHierarchy::dense_index(TransformHandle handle) const {
+    M_Assert(handle.valid() && handle.id < handle_to_dense.size() && handle_to_dense[handle.id] != TransformHandle::invalid,
+        "Transform handle is not alive");
+    return handle_to_dense[handle.id];
+}
\ No newline at end of file
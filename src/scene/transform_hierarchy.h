@@ -0,0 +1,83 @@
+#pragma once
+
+#include <glm/mat4x4.hpp>
+
+#include <cstdint>
+#include <vector>
+
+// Stable id of a transform, survives other transforms being added, removed or reordered
+struct TransformHandle {
+    static constexpr uint32_t invalid = UINT32_MAX;
+    uint32_t id = invalid;
+
+    bool valid() const { return id != invalid; }
+};
+
+// Flat scene transform storage. Matrices live in parallel arrays sorted by depth, so every parent is
+// updated before its children and the update is one linear pass over memory.
+// Only transforms that were marked dirty, or whose parent changed this pass, are recomputed.
+//
+// NOTE: Structural changes (add/remove/set_parent) are batched, the order is rebuilt at the start of the next update.
+// Transforms inside one level don't depend on each other, so a level can be split across threads:
+//
+//     hierarchy.begin_update();
+//     for (uint32_t level = 0; level < hierarchy.level_count(); level++) {
+//         // split [level_begin(level), level_end(level)) into chunks, `update_range(begin, end, thread_changed)` each,
+//         // wait for all, then `append_changed(thread_changed)` for every thread
+//     }
+struct TransformHierarchy {
+    TransformHandle add(const glm::mat4& local = glm::mat4 { 1.f });
+    void remove(TransformHandle handle);
+
+    // `parent` may be invalid to make `child` a root
+    void set_parent(TransformHandle child, TransformHandle parent);
+    void set_local(TransformHandle handle, const glm::mat4& local);
+
+    const glm::mat4& local(TransformHandle handle) const;
+    // Up to date as of the last update
+    const glm::mat4& world(TransformHandle handle) const;
+    // True if the world matrix was recomputed by the last update
+    bool changed(TransformHandle handle) const;
+    // Every transform whose world matrix was recomputed by the last update, so consumers only visit what moved
+    const std::vector<TransformHandle>& changed_transforms() const { return changed_handles; }
+
+    // Single threaded, equivalent to the loop above
+    void update();
+
+    void begin_update();
+    uint32_t level_count() const { return static_cast<uint32_t>(level_offsets.size()) - 1; }
+    uint32_t level_begin(uint32_t level) const { return level_offsets[level]; }
+    uint32_t level_end(uint32_t level) const { return level_offsets[level + 1]; }
+    void update_range(uint32_t begin, uint32_t end) { update_range(begin, end, changed_handles); }
+    void update_range(uint32_t begin, uint32_t end, std::vector<TransformHandle>& changed);
+    void append_changed(const std::vector<TransformHandle>& changed);
+
+    uint32_t size() const { return static_cast<uint32_t>(handles.size()); }
+
+private:
+    static constexpr uint32_t no_parent = UINT32_MAX;
+
+    void rebuild_order();
+    uint32_t dense_index(TransformHandle handle) const;
+
+    // Dense, indexed in update order
+    std::vector<glm::mat4> local_matrices;
+    std::vector<glm::mat4> world_matrices;
+    std::vector<uint32_t> parents;
+    std::vector<uint8_t> dirty;
+    // The update pass that last recomputed the world matrix, children compare against it
+    std::vector<uint32_t> updated_pass;
+    // Handle id of every dense slot, `TransformHandle::invalid` once removed
+    std::vector<uint32_t> handles;
+
+    // Sparse, indexed by handle id
+    std::vector<uint32_t> handle_to_dense;
+    std::vector<uint32_t> free_handles;
+
+    std::vector<TransformHandle> changed_handles;
+
+    // Level `i` is the range [level_offsets[i], level_offsets[i + 1])
+    std::vector<uint32_t> level_offsets = { 0 };
+    bool order_dirty = false;
+    uint32_t pass = 0;
+};
\ No newline at end of file
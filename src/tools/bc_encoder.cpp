@@ -0,0 +1,265 @@
+#include "bc_encoder.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+namespace {
+
+using Block = std::array<std::array<float, 4>, 16>;
+
+// Reads the 4x4 block at block coordinates (bx, by), clamping to the image edge
+Block load_block(std::span<const uint8_t> rgba, uint32_t width, uint32_t height, uint32_t bx, uint32_t by) {
+    Block block;
+    for (uint32_t y = 0; y < 4; y++) {
+        for (uint32_t x = 0; x < 4; x++) {
+            const uint32_t sx = std::min(bx * 4 + x, width - 1);
+            const uint32_t sy = std::min(by * 4 + y, height - 1);
+            const uint8_t* texel = rgba.data() + (size_t(sy) * width + sx) * 4;
+            for (uint32_t c = 0; c < 4; c++) {
+                block[y * 4 + x][c] = texel[c];
+            }
+        }
+    }
+    return block;
+}
+
+// Appends bits LSB first into a 16 byte block
+struct BitWriter {
+    uint8_t* data;
+    uint32_t position = 0;
+
+    void write(uint32_t value, uint32_t count) {
+        for (uint32_t i = 0; i < count; i++, position++) {
+            if (value & (1u << i)) {
+                data[position / 8] |= uint8_t(1u << (position % 8));
+            }
+        }
+    }
+};
+
+constexpr uint32_t bc7_weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// 7 bit endpoint plus a p-bit shared by the channels of that endpoint, picks the p-bit with the smaller error
+void quantize_endpoint(const std::array<float, 4>& color, std::array<uint32_t, 4>& out_bits, uint32_t& out_pbit) {
+    float best_error = INFINITY;
+    for (uint32_t p = 0; p < 2; p++) {
+        std::array<uint32_t, 4> bits;
+        float error = 0.f;
+        for (uint32_t c = 0; c < 4; c++) {
+            bits[c] = static_cast<uint32_t>(std::clamp(std::lround((color[c] - float(p)) / 2.f), 0l, 127l));
+            const float reconstructed = float(bits[c] * 2 + p);
+            error += (reconstructed - color[c]) * (reconstructed - color[c]);
+        }
+        if (error < best_error) {
+            best_error = error;
+            out_bits = bits;
+            out_pbit = p;
+        }
+    }
+}
+
+void encode_bc7_block(const Block& block, uint8_t* out) {
+    std::array<float, 4> mean = {};
+    std::array<float, 4> lo = { 255.f, 255.f, 255.f, 255.f };
+    std::array<float, 4> hi = {};
+    for (const auto& texel : block) {
+        for (uint32_t c = 0; c < 4; c++) {
+            mean[c] += texel[c] / 16.f;
+            lo[c] = std::min(lo[c], texel[c]);
+            hi[c] = std::max(hi[c], texel[c]);
+        }
+    }
+
+    float covariance[4][4] = {};
+    for (const auto& texel : block) {
+        for (uint32_t i = 0; i < 4; i++) {
+            for (uint32_t j = 0; j < 4; j++) {
+                covariance[i][j] += (texel[i] - mean[i]) * (texel[j] - mean[j]);
+            }
+        }
+    }
+
+    // Principal axis by power iteration, starting from the bounding box diagonal
+    std::array<float, 4> axis = { hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2], hi[3] - lo[3] };
+    for (uint32_t iteration = 0; iteration < 8; iteration++) {
+        std::array<float, 4> next = {};
+        for (uint32_t i = 0; i < 4; i++) {
+            for (uint32_t j = 0; j < 4; j++) {
+                next[i] += covariance[i][j] * axis[j];
+            }
+        }
+        const float length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2] + next[3] * next[3]);
+        if (length < 1e-6f) {
+            break;
+        }
+        for (uint32_t i = 0; i < 4; i++) {
+            axis[i] = next[i] / length;
+        }
+    }
+    const float axis_length = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2] + axis[3] * axis[3]);
+    if (axis_length > 1e-6f) {
+        for (float& a : axis) {
+            a /= axis_length;
+        }
+    }
+
+    float t_min = 0.f;
+    float t_max = 0.f;
+    for (const auto& texel : block) {
+        float t = 0.f;
+        for (uint32_t c = 0; c < 4; c++) {
+            t += (texel[c] - mean[c]) * axis[c];
+        }
+        t_min = std::min(t_min, t);
+        t_max = std::max(t_max, t);
+    }
+
+    std::array<float, 4> endpoint_colors[2];
+    for (uint32_t c = 0; c < 4; c++) {
+        endpoint_colors[0][c] = std::clamp(mean[c] + axis[c] * t_min, 0.f, 255.f);
+        endpoint_colors[1][c] = std::clamp(mean[c] + axis[c] * t_max, 0.f, 255.f);
+    }
+
+    std::array<uint32_t, 4> endpoints[2];
+    uint32_t pbits[2];
+    quantize_endpoint(endpoint_colors[0], endpoints[0], pbits[0]);
+    quantize_endpoint(endpoint_colors[1], endpoints[1], pbits[1]);
+
+    float palette[16][4];
+    for (uint32_t i = 0; i < 16; i++) {
+        for (uint32_t c = 0; c < 4; c++) {
+            const uint32_t e0 = endpoints[0][c] * 2 + pbits[0];
+            const uint32_t e1 = endpoints[1][c] * 2 + pbits[1];
+            palette[i][c] = float(((64 - bc7_weights4[i]) * e0 + bc7_weights4[i] * e1 + 32) >> 6);
+        }
+    }
+
+    uint32_t indices[16];
+    for (uint32_t t = 0; t < 16; t++) {
+        float best_error = INFINITY;
+        for (uint32_t i = 0; i < 16; i++) {
+            float error = 0.f;
+            for (uint32_t c = 0; c < 4; c++) {
+                error += (palette[i][c] - block[t][c]) * (palette[i][c] - block[t][c]);
+            }
+            if (error < best_error) {
+                best_error = error;
+                indices[t] = i;
+            }
+        }
+    }
+
+    // The anchor index only has 3 bits, its top bit must be 0
+    if (indices[0] & 8) {
+        std::swap(endpoints[0], endpoints[1]);
+        std::swap(pbits[0], pbits[1]);
+        for (uint32_t& index : indices) {
+            index = 15 - index;
+        }
+    }
+
+    std::fill(out, out + 16, uint8_t(0));
+    BitWriter writer { out };
+    writer.write(1u << 6, 7);
+    for (uint32_t c = 0; c < 4; c++) {
+        writer.write(endpoints[0][c], 7);
+        writer.write(endpoints[1][c], 7);
+    }
+    writer.write(pbits[0], 1);
+    writer.write(pbits[1], 1);
+    writer.write(indices[0], 3);
+    for (uint32_t t = 1; t < 16; t++) {
+        writer.write(indices[t], 4);
+    }
+}
+
+void encode_bc4_block(const Block& block, uint32_t channel, uint8_t* out) {
+    float lo = 255.f;
+    float hi = 0.f;
+    for (const auto& texel : block) {
+        lo = std::min(lo, texel[channel]);
+        hi = std::max(hi, texel[channel]);
+    }
+
+    // red0 > red1 selects the 8 value mode, with equal endpoints every index decodes to the same value anyway
+    const uint32_t r0 = static_cast<uint32_t>(hi);
+    const uint32_t r1 = static_cast<uint32_t>(lo);
+    float palette[8] = { float(r0), float(r1) };
+    for (uint32_t i = 2; i < 8; i++) {
+        palette[i] = float(((8 - i) * r0 + (i - 1) * r1) / 7);
+    }
+
+    std::fill(out, out + 8, uint8_t(0));
+    out[0] = uint8_t(r0);
+    out[1] = uint8_t(r1);
+    BitWriter writer { out, 16 };
+    for (const auto& texel : block) {
+        uint32_t best = 0;
+        for (uint32_t i = 1; i < 8; i++) {
+            if (std::abs(palette[i] - texel[channel]) < std::abs(palette[best] - texel[channel])) {
+                best = i;
+            }
+        }
+        writer.write(best, 3);
+    }
+}
+
+}
+
+std::vector<uint8_t> encode_bc7(std::span<const uint8_t> rgba, uint32_t width, uint32_t height) {
+    const uint32_t blocks_x = (width + 3) / 4;
+    const uint32_t blocks_y = (height + 3) / 4;
+    std::vector<uint8_t> result(size_t(blocks_x) * blocks_y * 16);
+    for (uint32_t by = 0; by < blocks_y; by++) {
+        for (uint32_t bx = 0; bx < blocks_x; bx++) {
+            encode_bc7_block(load_block(rgba, width, height, bx, by), result.data() + (size_t(by) * blocks_x + bx) * 16);
+        }
+    }
+    return result;
+}
+
+std::vector<uint8_t> encode_bc5(std::span<const uint8_t> rgba, uint32_t width, uint32_t height) {
+    const uint32_t blocks_x = (width + 3) / 4;
+    const uint32_t blocks_y = (height + 3) / 4;
+    std::vector<uint8_t> result(size_t(blocks_x) * blocks_y * 16);
+    for (uint32_t by = 0; by < blocks_y; by++) {
+        for (uint32_t bx = 0; bx < blocks_x; bx++) {
+            const Block block = load_block(rgba, width, height, bx, by);
+            uint8_t* out = result.data() + (size_t(by) * blocks_x + bx) * 16;
+            encode_bc4_block(block, 0, out);
+            encode_bc4_block(block, 1, out + 8);
+        }
+    }
+    return result;
+}
+
+std::vector<uint8_t> downsample_rgba(std::span<const uint8_t> rgba, uint32_t width, uint32_t height) {
+    const uint32_t dst_width = std::max(width / 2, 1u);
+    const uint32_t dst_height = std::max(height / 2, 1u);
+    std::vector<uint8_t> result(size_t(dst_width) * dst_height * 4);
+
+    for (uint32_t y = 0; y < dst_height; y++) {
+        // The last destination row/column also takes the leftover source row/column of odd sizes
+        const uint32_t y0 = y * 2;
+        const uint32_t y1 = (y + 1 == dst_height) ? height : std::min(y0 + 2, height);
+        for (uint32_t x = 0; x < dst_width; x++) {
+            const uint32_t x0 = x * 2;
+            const uint32_t x1 = (x + 1 == dst_width) ? width : std::min(x0 + 2, width);
+
+            uint32_t sum[4] = {};
+            for (uint32_t sy = y0; sy < y1; sy++) {
+                for (uint32_t sx = x0; sx < x1; sx++) {
+                    for (uint32_t c = 0; c < 4; c++) {
+                        sum[c] += rgba[(size_t(sy) * width + sx) * 4 + c];
+                    }
+                }
+            }
+            const uint32_t count = (y1 - y0) * (x1 - x0);
+            for (uint32_t c = 0; c < 4; c++) {
+                result[(size_t(y) * dst_width + x) * 4 + c] = uint8_t((sum[c] + count / 2) / count);
+            }
+        }
+    }
+    return result;
+}
\ No newline at end of file
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Block compression of RGBA8 images for `td_texture_bake`, every 4x4 texel block becomes 16 bytes.
+// Edge blocks of sizes that are not a multiple of 4 repeat the last row/column.
+//
+// NOTE: Quality over speed is not a goal here, BC7 only uses mode 6 (one subset, RGBA endpoints, 4 bit indices)
+// fitted along the principal axis of the block. Good enough for albedo, an order of magnitude faster than a full search.
+std::vector<uint8_t> encode_bc7(std::span<const uint8_t> rgba, uint32_t width, uint32_t height);
+// Two BC4 blocks of the red and green channels, for tangent space normal maps. Blue is dropped, a sampler of the
+// result has to derive z from x and y itself
+std::vector<uint8_t> encode_bc5(std::span<const uint8_t> rgba, uint32_t width, uint32_t height);
+
+// Box filtered half resolution level, odd sizes fold their last row/column into the previous texel
+std::vector<uint8_t> downsample_rgba(std::span<const uint8_t> rgba, uint32_t width, uint32_t height);
\ No newline at end of file
@@ -0,0 +1,242 @@
+// Offline texture compression, converts every PNG/JPEG under an asset directory to a KTX2 file with a full
+// mip chain, block compressed so the engine can upload it as is:
+//
+//     td_texture_bake <asset dir> [--force]
+//
+// Normal maps (referenced as `normalTexture` by a glTF material, or named `*_N` / `*_N_FlipY`) become BC5,
+// everything else BC7. Outputs go to `baked_texture_path`, already baked images are skipped unless `--force`.
+
+#include "bc_encoder.h"
+#include "../renderer/vk_ktx2.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include <fastgltf/core.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <print>
+#include <set>
+#include <string>
+#include <variant>
+#include <vector>
+
+namespace {
+
+struct BakeStats {
+    uint32_t baked = 0;
+    uint32_t skipped = 0;
+    uint32_t failed = 0;
+    uint64_t source_bytes = 0;
+    uint64_t baked_bytes = 0;
+    // Written by this run, images shared by several files are only baked once even with `--force`
+    std::set<std::filesystem::path> written;
+    // Resolved image files referenced by a glTF file, baked next to it and skipped as loose images
+    std::set<std::filesystem::path> referenced;
+};
+
+std::vector<uint8_t> read_file(const std::filesystem::path& path) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        return {};
+    }
+    std::vector<uint8_t> bytes(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    return bytes;
+}
+
+bool is_normal_map_name(const std::filesystem::path& path) {
+    const std::string stem = path.stem().string();
+    return stem.ends_with("_N") || stem.ends_with("_N_FlipY");
+}
+
+void bake_image(const std::filesystem::path& source_dir, std::span<const uint8_t> encoded, bool normal_map,
+    const std::string& name, bool force, BakeStats& stats)
+{
+    const std::filesystem::path out_path = baked_texture_path(source_dir, encoded);
+    if (stats.written.contains(out_path) || (!force && std::filesystem::exists(out_path))) {
+        stats.skipped++;
+        return;
+    }
+
+    int width, height, nr_channels;
+    stbi_uc* data = stbi_load_from_memory(encoded.data(), static_cast<int>(encoded.size()), &width, &height, &nr_channels, 4);
+    if (!data) {
+        std::print("{}: could not decode ({})\n", name, stbi_failure_reason());
+        stats.failed++;
+        return;
+    }
+
+    const VkFormat format = normal_map ? VK_FORMAT_BC5_UNORM_BLOCK : VK_FORMAT_BC7_UNORM_BLOCK;
+
+    std::vector<std::vector<uint8_t>> levels;
+    std::vector<uint8_t> level(data, data + size_t(width) * height * 4);
+    stbi_image_free(data);
+
+    uint32_t level_width = width;
+    uint32_t level_height = height;
+    const uint32_t level_count = full_mip_count(level_width, level_height);
+    for (uint32_t i = 0; i < level_count; i++) {
+        levels.push_back(normal_map ? encode_bc5(level, level_width, level_height) : encode_bc7(level, level_width, level_height));
+        if (i + 1 < level_count) {
+            level = downsample_rgba(level, level_width, level_height);
+            level_width = std::max(level_width / 2, 1u);
+            level_height = std::max(level_height / 2, 1u);
+        }
+    }
+
+    const std::vector<uint8_t> file = write_ktx2(format, width, height, levels);
+
+    std::filesystem::create_directories(out_path.parent_path());
+    std::ofstream out(out_path, std::ios::binary);
+    out.write(reinterpret_cast<const char*>(file.data()), static_cast<std::streamsize>(file.size()));
+    if (!out) {
+        std::print("{}: could not write {}\n", name, out_path.string());
+        stats.failed++;
+        return;
+    }
+
+    std::print("{} -> {} ({}x{} {}, {} levels, {} KiB)\n", name, out_path.filename().string(), width, height,
+        normal_map ? "BC5" : "BC7", level_count, file.size() / 1024);
+    stats.written.insert(out_path);
+    stats.baked++;
+    stats.source_bytes += uint64_t(width) * height * 4;
+    stats.baked_bytes += file.size();
+}
+
+// Images of a glTF file, the baked path is relative to the glTF file just like `LoadedGLTF::load_gltf` looks it up
+void bake_gltf(const std::filesystem::path& path, bool force, BakeStats& stats) {
+    fastgltf::Expected<fastgltf::GltfDataBuffer> data = fastgltf::GltfDataBuffer::FromPath(path);
+    if (data.error() != fastgltf::Error::None) {
+        std::print("{}: could not read\n", path.string());
+        stats.failed++;
+        return;
+    }
+
+    constexpr auto gltf_options = fastgltf::Options::LoadGLBBuffers | fastgltf::Options::LoadExternalBuffers;
+
+    fastgltf::Parser parser {};
+    auto load = fastgltf::determineGltfFileType(data.get()) == fastgltf::GltfType::GLB
+        ? parser.loadGltfBinary(data.get(), path.parent_path(), gltf_options)
+        : parser.loadGltf(data.get(), path.parent_path(), gltf_options);
+    if (!load) {
+        std::print("{}: {}\n", path.string(), fastgltf::getErrorName(load.error()));
+        stats.failed++;
+        return;
+    }
+    fastgltf::Asset& gltf = load.get();
+
+    std::set<size_t> normal_images;
+    for (const fastgltf::Material& material : gltf.materials) {
+        if (material.normalTexture.has_value()) {
+            const fastgltf::Texture& texture = gltf.textures[material.normalTexture->textureIndex];
+            if (texture.imageIndex.has_value()) {
+                normal_images.insert(texture.imageIndex.value());
+            }
+        }
+    }
+
+    for (size_t i = 0; i < gltf.images.size(); i++) {
+        fastgltf::Image& image = gltf.images[i];
+        std::vector<uint8_t> file_bytes;
+        std::span<const uint8_t> encoded;
+
+        std::visit(
+            fastgltf::visitor {
+                [](auto& arg) {},
+                [&](fastgltf::sources::URI& file_path) {
+                    // Relative to the glTF file, not to the working directory
+                    const std::filesystem::path image_path = gltf_image_path(path.parent_path(),
+                        std::string_view(file_path.uri.path().data(), file_path.uri.path().size()));
+                    stats.referenced.insert(image_path);
+                    file_bytes = read_file(image_path);
+                    encoded = file_bytes;
+                },
+                [&](fastgltf::sources::Vector& vector) {
+                    encoded = std::span((const uint8_t*) vector.bytes.data(), vector.bytes.size());
+                },
+                [&](fastgltf::sources::BufferView& view) {
+                    fastgltf::BufferView& buffer_view = gltf.bufferViews[view.bufferViewIndex];
+                    fastgltf::Buffer& buffer = gltf.buffers[buffer_view.bufferIndex];
+                    if (auto* array = std::get_if<fastgltf::sources::Array>(&buffer.data)) {
+                        encoded = std::span((const uint8_t*) array->bytes.data() + buffer_view.byteOffset, buffer_view.byteLength);
+                    }
+                },
+            },
+            image.data
+        );
+
+        if (encoded.empty()) {
+            std::print("{}: unsupported source for image {}\n", path.string(), i);
+            stats.failed++;
+            continue;
+        }
+
+        const std::string name = std::format("{}#{}", path.filename().string(), image.name.empty() ? std::to_string(i) : std::string(image.name));
+        bake_image(path.parent_path(), encoded, normal_images.contains(i), name, force, stats);
+    }
+}
+
+}
+
+auto main(int argc, char** argv) -> int {
+    std::filesystem::path asset_dir;
+    bool force = false;
+
+    for (int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        if (arg == "--force") {
+            force = true;
+        } else if (asset_dir.empty()) {
+            asset_dir = arg;
+        } else {
+            asset_dir.clear();
+            break;
+        }
+    }
+    if (asset_dir.empty() || !std::filesystem::is_directory(asset_dir)) {
+        std::print("Usage: td_texture_bake <asset dir> [--force]\n");
+        return -1;
+    }
+
+    std::vector<std::filesystem::path> gltf_files;
+    std::vector<std::filesystem::path> image_files;
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(asset_dir)) {
+        if (!entry.is_regular_file() || entry.path().parent_path().filename() == "baked") {
+            continue;
+        }
+        std::string extension = entry.path().extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return static_cast<char>(std::tolower(c)); });
+        if (extension == ".gltf" || extension == ".glb") {
+            gltf_files.push_back(entry.path());
+        } else if (extension == ".png" || extension == ".jpg" || extension == ".jpeg") {
+            image_files.push_back(entry.path());
+        }
+    }
+
+    BakeStats stats;
+    // glTF files first, they know which images are normal maps. Loose images they reference are skipped afterwards,
+    // wherever they are, the engine only looks for the baked file next to the glTF file
+    for (const std::filesystem::path& path : gltf_files) {
+        bake_gltf(path, force, stats);
+    }
+    for (const std::filesystem::path& path : image_files) {
+        if (stats.referenced.contains(gltf_image_path(path.parent_path(), path.filename().string()))) {
+            continue;
+        }
+        const std::vector<uint8_t> encoded = read_file(path);
+        bake_image(path.parent_path(), encoded, is_normal_map_name(path), path.filename().string(), force, stats);
+    }
+
+    std::print("Baked {} textures, {} up to date, {} failed\n", stats.baked, stats.skipped, stats.failed);
+    if (stats.baked > 0) {
+        std::print("RGBA8 without mips: {} KiB, baked with mips: {} KiB\n", stats.source_bytes / 1024, stats.baked_bytes / 1024);
+    }
+
+    return stats.failed > 0 ? -1 : 0;
+}
\ No newline at end of file